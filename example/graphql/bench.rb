@@ -0,0 +1,73 @@
+# Times queries that build large result trees, a long list of rows with
+# enough fields that each row is a wide object.
+#
+# ruby bench.rb [rows] [iterations]
+
+require 'net/http'
+
+require 'agoo'
+
+ROWS = (ARGV[0] || 10_000).to_i
+ITER = (ARGV[1] || 10).to_i
+FIELDS = (1..20).map { |i| "f#{i}" }
+
+class Row
+  FIELDS.each_with_index { |f, i| define_method(f) { @id * 100 + i } }
+
+  attr_reader :id
+
+  def initialize(id)
+    @id = id
+  end
+end
+
+class Query
+  def initialize
+    @rows = {}
+  end
+
+  def rows(args={})
+    count = args['count']
+    @rows[count] ||= (1..count).map { |i| Row.new(i) }
+  end
+end
+
+class Schema
+  attr_reader :query
+
+  def initialize
+    @query = Query.new()
+  end
+end
+
+Agoo::Server.init(6464, 'root', thread_count: 1, graphql: '/graphql')
+Agoo::Server.start()
+Agoo::GraphQL.schema(Schema.new) {
+  Agoo::GraphQL.load(%^
+type Query {
+  rows(count: Int!): [Row]
+}
+type Row {
+  id: Int
+  #{FIELDS.map { |f| "#{f}: Int" }.join("\n  ")}
+}
+^)
+}
+
+def run(query, iter)
+  uri = URI("http://localhost:6464/graphql?query=#{URI.encode_www_form_component(query).gsub("+", "%20")}")
+  size = 0
+  Net::HTTP.start(uri.host, uri.port) { |h|
+    h.get(uri) # warm up
+    start = Time.now
+    iter.times { size = h.get(uri).body.size }
+    [(Time.now - start) / iter, size]
+  }
+end
+
+[ROWS / 10, ROWS].each { |n|
+  [['narrow', 'id'], ['wide', "id #{FIELDS.join(' ')}"]].each { |label, fields|
+    dt, size = run("{rows(count:#{n}){#{fields}}}", ITER)
+    puts "%6s %7d rows: %8.2f msecs per query, %d bytes" % [label, n, dt * 1000.0, size]
+  }
+}
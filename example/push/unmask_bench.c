@@ -0,0 +1,129 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+// A micro benchmark for agoo_ws_unmask. The wide strides are first checked
+// against the plain byte loop for every length up to a few hundred bytes at
+// each offset within a word so the byte, word, vector, and AVX2 paths are
+// all covered both aligned and unaligned. Then both are timed for lengths
+// below 8, from 8 to 63, and 64 and over.
+//
+// To run this example:
+// cc -O2 -I ../../ext/agoo unmask_bench.c ../../ext/agoo/wsmask.c -o unmask_bench && ./unmask_bench
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wsmask.h"
+
+#define MAX_LEN		300
+#define GUARD		16
+#define BENCH_BYTES	(256L * 1024 * 1024)
+
+// Not inlined so both sides pay for a call and only the loops are compared.
+__attribute__((noinline))
+static void
+byte_unmask(uint8_t *b, size_t len, const uint8_t *mask) {
+    size_t	i;
+
+    for (i = 0; i < len; i++) {
+	b[i] ^= mask[i & 0x03];
+    }
+}
+
+static double
+now() {
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static int
+check() {
+    uint8_t	src[MAX_LEN + 2 * GUARD];
+    uint8_t	expect[MAX_LEN + 2 * GUARD];
+    uint8_t	actual[MAX_LEN + 2 * GUARD];
+    uint8_t	mask[4];
+    size_t	len;
+    int		off;
+    size_t	i;
+    int		fails = 0;
+
+    srand(7);
+    for (i = 0; i < sizeof(src); i++) {
+	src[i] = (uint8_t)rand();
+    }
+    for (len = 0; len <= MAX_LEN; len++) {
+	for (off = 0; off < 8; off++) {
+	    for (i = 0; i < sizeof(mask); i++) {
+		mask[i] = (uint8_t)rand();
+	    }
+	    memcpy(expect, src, sizeof(src));
+	    memcpy(actual, src, sizeof(src));
+	    byte_unmask(expect + GUARD + off, len, mask);
+	    agoo_ws_unmask(actual + GUARD + off, len, mask);
+	    // The guard bytes on each side must be untouched as well.
+	    if (0 != memcmp(expect, actual, sizeof(src))) {
+		printf("*** mismatch for length %zu at offset %d\n", len, off);
+		fails++;
+	    }
+	}
+    }
+    return fails;
+}
+
+static void
+bench(size_t len, int off) {
+    uint8_t	*buf = (uint8_t*)malloc(len + 8);
+    uint8_t	mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    long	iter = BENCH_BYTES / (long)len;
+    long	i;
+    double	start;
+    double	byte_dt;
+    double	wide_dt;
+    unsigned	sum = 0;
+
+    if (100000000L < iter) {
+	iter = 100000000L;
+    }
+    memset(buf, 0x5A, len + 8);
+    start = now();
+    for (i = iter; 0 < i; i--) {
+	byte_unmask(buf + off, len, mask);
+	sum += buf[off];
+    }
+    byte_dt = now() - start;
+    start = now();
+    for (i = iter; 0 < i; i--) {
+	agoo_ws_unmask(buf + off, len, mask);
+	sum += buf[off];
+    }
+    wide_dt = now() - start;
+    printf("%8zu bytes +%d  byte loop %8.1f MB/s  unmask %8.1f MB/s  %5.1fx  (%u)\n",
+	   len, off,
+	   (double)len * iter / byte_dt / 1000000.0,
+	   (double)len * iter / wide_dt / 1000000.0,
+	   byte_dt / wide_dt, sum & 0x01);
+    free(buf);
+}
+
+int
+main(int argc, char **argv) {
+    static const size_t	lens[] = { 3, 7, 8, 24, 63, 64, 100, 1500, 65536, 0 };
+    const size_t	*lp;
+    int			fails = check();
+
+    if (0 != fails) {
+	printf("*** %d mismatches with the byte loop\n", fails);
+	return 1;
+    }
+    printf("agoo_ws_unmask matches the byte loop for lengths 0 to %d at offsets 0 to 7\n\n", MAX_LEN);
+    for (lp = lens; 0 != *lp; lp++) {
+	bench(*lp, 0);
+	bench(*lp, 3);
+    }
+    return 0;
+}
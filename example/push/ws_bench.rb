@@ -0,0 +1,74 @@
+
+require 'socket'
+require 'agoo'
+
+# A micro benchmark for reading masked WebSocket frames. Binary frames of
+# increasing size are sent by a client in this process followed by a one byte
+# marker frame. The server replies with a short ack when the marker arrives so
+# the elapsed time covers unmasking and handing every payload to the
+# handler. The throughput reported is the rate at which payload bytes pass
+# through the WebSocket read path.
+#
+# To run this example:
+# ruby -I ../../ext -I ../../lib ws_bench.rb
+
+PORT = 6464
+SIZES = [16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576]
+BYTES_PER_SIZE = 64 * 1024 * 1024
+MAX_FRAMES = 20_000
+
+Agoo::Log.configure(dir: '', console: true, classic: true, colorize: true,
+		    states: { INFO: false, DEBUG: false, connect: false, request: false,
+			      response: false, eval: false, push: false })
+Agoo::Server.init(PORT, '.', thread_count: 1)
+
+class Ack
+  def on_message(client, data)
+    client.write('k') if 1 == data.bytesize
+  end
+end
+
+class Listen
+  def call(env)
+    env['rack.upgrade'] = Ack.new unless env['rack.upgrade?'].nil?
+    [ 200, { }, [ ] ]
+  end
+end
+
+Agoo::Server.handle(:GET, "/upgrade", Listen.new)
+Agoo::Server.start()
+
+sock = TCPSocket.new('127.0.0.1', PORT)
+sock.write("GET /upgrade HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n")
+header = ''
+header << sock.readpartial(1) until header.end_with?("\r\n\r\n")
+
+def frame(size)
+  head = [0x82].pack('C')
+  if size < 126
+    head << [0x80 | size].pack('C')
+  elsif size < 0x10000
+    head << [0xFE, size].pack('Cn')
+  else
+    head << [0xFF, size].pack('CQ>')
+  end
+  # The payload content does not matter to the server so random bytes are
+  # sent as if already masked.
+  head << [1, 2, 3, 4].pack('C4') << Random.bytes(size)
+end
+
+$stdout.sync = true
+marker = frame(1)
+puts '      size     frames      MB/s'
+SIZES.each { |size|
+  f = frame(size)
+  cnt = [BYTES_PER_SIZE / size, MAX_FRAMES].min
+  start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  cnt.times { sock.write(f) }
+  sock.write(marker)
+  sock.read(3) # 0x81, 0x01, 'k'
+  dt = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+  printf("%10d %10d %9.1f\n", size, cnt, size * cnt / dt / 1_000_000.0)
+}
+sock.close
+Agoo::shutdown
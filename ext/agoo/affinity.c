@@ -0,0 +1,280 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_MEMPOLICY_H
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+#include "atomic.h"
+#include "debug.h"
+#include "log.h"
+
+#include "affinity.h"
+
+#define NODE_DIR	"/sys/devices/system/node"
+#define MAX_NODES	64
+
+static struct _affinity {
+    int		*loop_cpus;
+    int		loop_cnt;
+    int		*eval_cpus;
+    int		eval_cnt;
+    bool	numa;
+    atomic_int	eval_next;
+} aff = {
+    .loop_cpus = NULL,
+    .loop_cnt = 0,
+    .eval_cpus = NULL,
+    .eval_cnt = 0,
+    .numa = false,
+    .eval_next = AGOO_ATOMIC_INT_INIT(0),
+};
+
+// Parses a Linux style CPU list such as "0-3,8,10-11".
+int
+agoo_affinity_parse(agooErr err, const char *spec, int **cpusp, int *cntp) {
+    const char	*s = spec;
+    char	*end;
+    long	first;
+    long	last;
+    int		*cpus = NULL;
+    int		cnt = 0;
+
+    while ('\0' != *s && '\n' != *s) {
+	first = strtol(s, &end, 10);
+	if (end == s || 0 > first) {
+	    AGOO_FREE(cpus);
+	    return agoo_err_set(err, AGOO_ERR_ARG, "Invalid CPU list '%s'.", spec);
+	}
+	last = first;
+	if ('-' == *end) {
+	    s = end + 1;
+	    last = strtol(s, &end, 10);
+	    if (end == s || last < first) {
+		AGOO_FREE(cpus);
+		return agoo_err_set(err, AGOO_ERR_ARG, "Invalid CPU list '%s'.", spec);
+	    }
+	}
+	if (NULL == (cpus = (int*)AGOO_REALLOC(cpus, sizeof(int) * (cnt + last - first + 1)))) {
+	    return AGOO_ERR_MEM(err, "CPU list");
+	}
+	for (; first <= last; first++) {
+	    cpus[cnt++] = (int)first;
+	}
+	s = end;
+	if (',' == *s) {
+	    s++;
+	}
+    }
+    *cpusp = cpus;
+    *cntp = cnt;
+
+    return AGOO_ERR_OK;
+}
+
+static int
+set_cpus(agooErr err, int **cpusp, int *cntp, const int *cpus, int cnt) {
+    AGOO_FREE(*cpusp);
+    *cpusp = NULL;
+    *cntp = 0;
+    if (0 < cnt) {
+	if (NULL == (*cpusp = (int*)AGOO_MALLOC(sizeof(int) * cnt))) {
+	    return AGOO_ERR_MEM(err, "CPU list");
+	}
+	memcpy(*cpusp, cpus, sizeof(int) * cnt);
+	*cntp = cnt;
+    }
+    return AGOO_ERR_OK;
+}
+
+int
+agoo_affinity_set_loops(agooErr err, const int *cpus, int cnt) {
+    return set_cpus(err, &aff.loop_cpus, &aff.loop_cnt, cpus, cnt);
+}
+
+int
+agoo_affinity_set_evals(agooErr err, const int *cpus, int cnt) {
+    return set_cpus(err, &aff.eval_cpus, &aff.eval_cnt, cpus, cnt);
+}
+
+void
+agoo_affinity_set_numa(bool on) {
+    aff.numa = on;
+}
+
+static void
+pin(int cpu) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t	set;
+    int		stat;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (0 != (stat = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))) {
+	agoo_log_cat(&agoo_warn_cat, "Failed to pin a thread to CPU %d. %s", cpu, strerror(stat));
+    }
+#endif
+}
+
+// Pins the calling connection loop thread.
+void
+agoo_affinity_loop(int id) {
+    if (0 < aff.loop_cnt) {
+	pin(aff.loop_cpus[id % aff.loop_cnt]);
+    }
+}
+
+// Pins the calling eval thread to the next CPU of the eval list.
+void
+agoo_affinity_eval(void) {
+    if (0 < aff.eval_cnt) {
+	pin(aff.eval_cpus[atomic_fetch_add(&aff.eval_next, 1) % aff.eval_cnt]);
+    }
+}
+
+// Returns the CPU the loop with the id is pinned to or -1 if not pinned.
+int
+agoo_affinity_loop_cpu(int id) {
+    if (0 < aff.loop_cnt) {
+	return aff.loop_cpus[id % aff.loop_cnt];
+    }
+    return -1;
+}
+
+// Returns the CPU that handled the last packet received on the socket,
+// which follows the receive queue the connection was hashed to, or -1 if
+// not known.
+int
+agoo_affinity_incoming_cpu(int sock) {
+#ifdef SO_INCOMING_CPU
+    int		cpu = -1;
+    socklen_t	len = sizeof(cpu);
+
+    if (0 < aff.loop_cnt && 0 == getsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len)) {
+	return cpu;
+    }
+#endif
+    return -1;
+}
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+// Keeps only the CPUs that are also in the set. If none are left the list
+// is replaced by the set so threads still stay on the node.
+static int
+restrict_cpus(agooErr err, int **cpusp, int *cntp, const int *node_cpus, int node_cnt) {
+    int	*cpus = *cpusp;
+    int	cnt = 0;
+    int	i;
+    int	j;
+
+    for (i = 0; i < *cntp; i++) {
+	for (j = 0; j < node_cnt; j++) {
+	    if (cpus[i] == node_cpus[j]) {
+		cpus[cnt++] = cpus[i];
+		break;
+	    }
+	}
+    }
+    if (0 < cnt) {
+	*cntp = cnt;
+	return AGOO_ERR_OK;
+    }
+    return set_cpus(err, cpusp, cntp, node_cpus, node_cnt);
+}
+
+static int
+node_count(void) {
+    char	path[64];
+    int		cnt;
+
+    for (cnt = 0; cnt < MAX_NODES; cnt++) {
+	snprintf(path, sizeof(path), "%s/node%d", NODE_DIR, cnt);
+	if (0 != access(path, F_OK)) {
+	    break;
+	}
+    }
+    return cnt;
+}
+#endif
+
+// Called in each process after forking, before any server threads are
+// started, with 0 for the first process and the worker number
+// otherwise. Binds the process and the memory it allocates to a NUMA node
+// picked round robin. The connection loop and eval CPU lists are narrowed
+// to the CPUs of the node.
+int
+agoo_affinity_worker(agooErr err, int index) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    char	path[64];
+    char	buf[1024];
+    FILE	*f;
+    int		*cpus = NULL;
+    int		cnt = 0;
+    int		ncnt;
+    int		node;
+    int		i;
+    cpu_set_t	set;
+
+    if (!aff.numa || 2 > (ncnt = node_count())) {
+	return AGOO_ERR_OK;
+    }
+    node = index % ncnt;
+    snprintf(path, sizeof(path), "%s/node%d/cpulist", NODE_DIR, node);
+    if (NULL == (f = fopen(path, "r"))) {
+	return agoo_err_set(err, AGOO_ERR_READ, "Failed to read %s. %s", path, strerror(errno));
+    }
+    if (NULL == fgets(buf, sizeof(buf), f)) {
+	*buf = '\0';
+    }
+    fclose(f);
+    if (AGOO_ERR_OK != agoo_affinity_parse(err, buf, &cpus, &cnt)) {
+	return err->code;
+    }
+    if (0 == cnt) { // a memory only node
+	return AGOO_ERR_OK;
+    }
+    CPU_ZERO(&set);
+    for (i = 0; i < cnt; i++) {
+	CPU_SET(cpus[i], &set);
+    }
+    if (0 != sched_setaffinity(0, sizeof(set), &set)) {
+	agoo_log_cat(&agoo_warn_cat, "Failed to bind pid %d to NUMA node %d. %s", getpid(), node, strerror(errno));
+    }
+#if defined(HAVE_LINUX_MEMPOLICY_H) && defined(SYS_set_mempolicy)
+    {
+	unsigned long	mask = 1UL << node;
+
+	if (0 != syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8)) {
+	    agoo_log_cat(&agoo_warn_cat, "Failed to set the memory policy of pid %d. %s", getpid(), strerror(errno));
+	}
+    }
+#endif
+    if ((0 < aff.loop_cnt && AGOO_ERR_OK != restrict_cpus(err, &aff.loop_cpus, &aff.loop_cnt, cpus, cnt)) ||
+	(0 < aff.eval_cnt && AGOO_ERR_OK != restrict_cpus(err, &aff.eval_cpus, &aff.eval_cnt, cpus, cnt))) {
+	AGOO_FREE(cpus);
+	return err->code;
+    }
+    AGOO_FREE(cpus);
+    agoo_log_cat(&agoo_info_cat, "Worker %d with pid %d bound to NUMA node %d.", index, getpid(), node);
+#endif
+    return AGOO_ERR_OK;
+}
+
+void
+agoo_affinity_cleanup(void) {
+    AGOO_FREE(aff.loop_cpus);
+    aff.loop_cpus = NULL;
+    aff.loop_cnt = 0;
+    AGOO_FREE(aff.eval_cpus);
+    aff.eval_cpus = NULL;
+    aff.eval_cnt = 0;
+}
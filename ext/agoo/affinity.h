@@ -0,0 +1,28 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#ifndef AGOO_AFFINITY_H
+#define AGOO_AFFINITY_H
+
+#include <stdbool.h>
+
+#include "err.h"
+
+// Connection loops and eval threads can be pinned to CPUs and each forked
+// worker bound to a NUMA node. Loop n is pinned to the nth CPU of its list,
+// wrapping, so the list can follow the CPUs that service the NIC receive
+// queues. Pinning is silently skipped where the platform does not support
+// it.
+
+extern int	agoo_affinity_parse(agooErr err, const char *spec, int **cpusp, int *cntp);
+extern int	agoo_affinity_set_loops(agooErr err, const int *cpus, int cnt);
+extern int	agoo_affinity_set_evals(agooErr err, const int *cpus, int cnt);
+extern void	agoo_affinity_set_numa(bool on);
+
+extern int	agoo_affinity_worker(agooErr err, int index);
+extern void	agoo_affinity_loop(int id);
+extern void	agoo_affinity_eval(void);
+extern int	agoo_affinity_loop_cpu(int id);
+extern int	agoo_affinity_incoming_cpu(int sock);
+extern void	agoo_affinity_cleanup(void);
+
+#endif // AGOO_AFFINITY_H
@@ -6,6 +6,7 @@
 #include <string.h>
 
 #include <ruby.h>
+#include <ruby/encoding.h>
 
 #include "atomic.h"
 #include "debug.h"
@@ -59,14 +60,21 @@ ragoo_shutdown(VALUE self) {
  *
  * Publish a message on the given subject. A subject is normally a String but
  * Symbols can also be used as can any other object that responds to #to_s.
+ * A message with a binary (ASCII-8BIT) encoding is sent to WebSocket
+ * listeners as a binary frame.
  */
 VALUE
 ragoo_publish(VALUE self, VALUE subject, VALUE message) {
     int		slen;
     const char	*subj = extract_subject(subject, &slen);
+    agooPub	pub;
 
     rb_check_type(message, T_STRING);
-    agoo_server_publish(agoo_pub_publish(subj, slen, StringValuePtr(message), (int)RSTRING_LEN(message)));
+    pub = agoo_pub_publish(subj, slen, StringValuePtr(message), (int)RSTRING_LEN(message));
+    if (NULL != pub && RB_ENCODING_IS_ASCII8BIT(message)) {
+	pub->msg->bin = true;
+    }
+    agoo_server_publish(pub);
 
     return Qnil;
 }
@@ -93,6 +101,16 @@ sig_handler(int sig) {
     agoo_stop = 1;
 }
 
+static void
+restart_handler(int sig) {
+    agoo_server.restart = 1;
+}
+
+static void
+drain_handler(int sig) {
+    agoo_server.drain = 1;
+}
+
 /* Document-module: Agoo
  *
  * A High Performance HTTP Server that supports the Ruby rack API. The word
@@ -118,6 +136,8 @@ Init_agoo(void) {
 
     if (SIG_ERR == signal(SIGINT, sig_handler) ||
 	SIG_ERR == signal(SIGTERM, sig_handler) ||
+	SIG_ERR == signal(SIGUSR2, restart_handler) ||
+	SIG_ERR == signal(SIGQUIT, drain_handler) ||
 	SIG_ERR == signal(SIGPIPE, SIG_IGN) ||
 
 	// This causes sleeps and queue pops to return immediately and it can be
@@ -95,6 +95,39 @@ atomic_fetch_sub(agooAtom a, int delta) {
     return before;
 }
 
+#define atomic_exchange(a, v) _atomic_exchange((a), (void*)(v))
+
+static inline void*
+_atomic_exchange(agooAtom a, void *value) {
+    void	*prev;
+
+    pthread_mutex_lock(&a->lock);
+    prev = (void*)a->value;
+    a->value = value;
+    pthread_mutex_unlock(&a->lock);
+
+    return prev;
+}
+
+#define atomic_compare_exchange_weak(a, e, v) _atomic_compare_exchange((a), (void*)(e), (void*)(v))
+
+static inline bool
+_atomic_compare_exchange(agooAtom a, void *expected, void *value) {
+    void	**ep = (void**)expected;
+    bool	done = false;
+
+    pthread_mutex_lock(&a->lock);
+    if (a->value == *ep) {
+	a->value = value;
+	done = true;
+    } else {
+	*ep = (void*)a->value;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    return done;
+}
+
 static inline void
 atomic_flag_clear(agooAtom a) {
     pthread_mutex_lock(&a->lock);
@@ -0,0 +1,492 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "log.h"
+#include "pub.h"
+#include "server.h"
+#include "subject.h"
+#include "text.h"
+
+#include "bus.h"
+
+// A frame is a fixed header followed by the subject and then the message.
+// The header is the subject length, the message length, the kind, and the
+// flags.
+#define HEAD_SIZE	10
+#define FLAG_BIN	0x01
+
+// Frames queued for a peer that does not keep up are dropped past this.
+#define MAX_QUEUED	(64 * 1024 * 1024)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
+// A frame waiting to be written to a peer. The text is shared by all the
+// peers a frame goes to.
+typedef struct _out {
+    struct _out	*next;
+    agooText	text;
+} *Out;
+
+typedef struct _peer {
+    int		fd;
+    Out		head;
+    Out		tail;
+    long	off; // written from the head frame
+    long	queued;
+    bool	dropping;
+    char	*buf; // partial frame read so far
+    long	blen;
+    long	bcap;
+} *Peer;
+
+static struct _agooBus {
+    int			(*pairs)[2];
+    int			pair_cnt;
+    Peer		peers; // one per worker for the hub, just the hub for a worker
+    int			cnt;
+    int			index;
+    bool		active;
+    bool		started; // the thread must be joined
+    int			wake[2];
+    pthread_t		thread;
+    pthread_mutex_t	lock; // protects the peer queues
+} bus = {
+    .pairs = NULL,
+    .pair_cnt = 0,
+    .peers = NULL,
+    .cnt = 0,
+    .index = 0,
+    .active = false,
+    .started = false,
+    .wake = { -1, -1 },
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Creates a socket pair for each worker other than the hub. Must be called
+// before forking.
+int
+agoo_bus_setup(agooErr err, int worker_cnt) {
+    int	i;
+
+    if (2 > worker_cnt) {
+	return AGOO_ERR_OK;
+    }
+    bus.pair_cnt = worker_cnt - 1;
+    if (NULL == (bus.pairs = (int(*)[2])AGOO_CALLOC(bus.pair_cnt, sizeof(*bus.pairs))) ||
+	NULL == (bus.peers = (Peer)AGOO_CALLOC(bus.pair_cnt, sizeof(struct _peer)))) {
+	return AGOO_ERR_MEM(err, "Bus");
+    }
+    for (i = 0; i < bus.pair_cnt; i++) {
+	if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, bus.pairs[i])) {
+	    return agoo_err_set(err, AGOO_ERR_NETWORK, "Failed to create bus socket pair. %s", strerror(errno));
+	}
+    }
+    return AGOO_ERR_OK;
+}
+
+static void
+peer_attach(int fd) {
+    Peer	peer = &bus.peers[bus.cnt++];
+
+    fcntl(fd, F_SETFL, O_NONBLOCK | fcntl(fd, F_GETFL, 0));
+    memset(peer, 0, sizeof(struct _peer));
+    peer->fd = fd;
+}
+
+// Called after forking with 0 for the hub and the worker number otherwise to
+// close the socket ends that belong to other processes.
+void
+agoo_bus_attach(int index) {
+    int	i;
+
+    if (NULL == bus.pairs) {
+	return;
+    }
+    bus.index = index;
+    bus.cnt = 0;
+    for (i = 0; i < bus.pair_cnt; i++) {
+	if (0 == index) {
+	    close(bus.pairs[i][1]);
+	    peer_attach(bus.pairs[i][0]);
+	} else if (i == index - 1) {
+	    close(bus.pairs[i][0]);
+	    peer_attach(bus.pairs[i][1]);
+	} else {
+	    close(bus.pairs[i][0]);
+	    close(bus.pairs[i][1]);
+	}
+    }
+    AGOO_FREE(bus.pairs);
+    bus.pairs = NULL;
+    bus.active = (0 < bus.cnt);
+}
+
+bool
+agoo_bus_active(void) {
+    return bus.active;
+}
+
+static void
+peer_clear(Peer peer) {
+    Out	out;
+
+    while (NULL != (out = peer->head)) {
+	peer->head = out->next;
+	agoo_text_release(out->text);
+	AGOO_FREE(out);
+    }
+    peer->tail = NULL;
+    peer->off = 0;
+    peer->queued = 0;
+}
+
+static void
+peer_close(Peer peer) {
+    if (0 <= peer->fd) {
+	close(peer->fd);
+	peer->fd = -1;
+    }
+    peer_clear(peer);
+    AGOO_FREE(peer->buf);
+    peer->buf = NULL;
+    peer->blen = 0;
+    peer->bcap = 0;
+}
+
+// Queues a frame for every peer except the one at skip. Must be called with
+// the lock held. Returns true if a queue that was empty now has a frame.
+static bool
+queue_frame(agooText frame, int skip) {
+    Peer	peer;
+    Out		out;
+    bool	started = false;
+    int		i;
+
+    for (i = 0, peer = bus.peers; i < bus.cnt; i++, peer++) {
+	if (i == skip || 0 > peer->fd) {
+	    continue;
+	}
+	if (MAX_QUEUED < peer->queued + frame->len) {
+	    if (!peer->dropping) {
+		agoo_log_cat(&agoo_error_cat, "Bus peer of pid %d is not keeping up, dropping messages.", getpid());
+		peer->dropping = true;
+	    }
+	    continue;
+	}
+	if (NULL == (out = (Out)AGOO_MALLOC(sizeof(struct _out)))) {
+	    agoo_log_cat(&agoo_error_cat, "Out of memory for a bus frame.");
+	    continue;
+	}
+	out->next = NULL;
+	out->text = frame;
+	agoo_text_ref(frame);
+	if (NULL == peer->tail) {
+	    peer->head = out;
+	    started = true;
+	} else {
+	    peer->tail->next = out;
+	}
+	peer->tail = out;
+	peer->queued += frame->len;
+    }
+    return started;
+}
+
+// Writes as much of the queue as the socket takes without blocking. Must
+// be called with the lock held. Returns false if the peer failed.
+static bool
+peer_flush(Peer peer) {
+    Out		out;
+    ssize_t	cnt;
+
+    while (NULL != (out = peer->head)) {
+	if (0 > (cnt = send(peer->fd, out->text->text + peer->off, out->text->len - peer->off, MSG_NOSIGNAL))) {
+	    if (EINTR == errno) {
+		continue;
+	    }
+	    if (EAGAIN == errno || EWOULDBLOCK == errno) {
+		break;
+	    }
+	    agoo_log_cat(&agoo_error_cat, "Bus write failed in pid %d. %s.", getpid(), strerror(errno));
+	    return false;
+	}
+	peer->off += cnt;
+	if (peer->off < out->text->len) {
+	    continue;
+	}
+	peer->queued -= out->text->len;
+	peer->off = 0;
+	if (NULL == (peer->head = out->next)) {
+	    peer->tail = NULL;
+	}
+	agoo_text_release(out->text);
+	AGOO_FREE(out);
+    }
+    if (NULL == peer->head) {
+	peer->dropping = false;
+    }
+    return true;
+}
+
+// Only publishes and unsubscribes that are not tied to a connection are
+// meaningful in other processes. The frame is queued and the bus thread
+// writes it so a slow peer never blocks the publisher.
+void
+agoo_bus_send(agooPub pub) {
+    const char	*subject;
+    uint32_t	slen;
+    uint32_t	mlen;
+    agooText	frame;
+    char	*h; // the text is allocated past its declared size
+    bool	started;
+
+    if (!bus.active ||
+	!(AGOO_PUB_MSG == pub->kind || (AGOO_PUB_UN == pub->kind && NULL == pub->up))) {
+	return;
+    }
+    subject = (NULL == pub->subject) ? "" : pub->subject->pattern;
+    slen = (uint32_t)strlen(subject);
+    mlen = (NULL == pub->msg) ? 0 : (uint32_t)pub->msg->len;
+    if (NULL == (frame = agoo_text_allocate((int)(HEAD_SIZE + slen + mlen)))) {
+	agoo_log_cat(&agoo_error_cat, "Out of memory for a bus frame.");
+	return;
+    }
+    h = frame->text;
+    memcpy(h, &slen, 4);
+    memcpy(h + 4, &mlen, 4);
+    h[8] = (char)pub->kind;
+    h[9] = (NULL != pub->msg && pub->msg->bin) ? FLAG_BIN : 0;
+    memcpy(h + HEAD_SIZE, subject, slen);
+    if (0 < mlen) {
+	memcpy(h + HEAD_SIZE + slen, pub->msg->text, mlen);
+    }
+    frame->len = HEAD_SIZE + slen + mlen;
+    agoo_text_ref(frame);
+    pthread_mutex_lock(&bus.lock);
+    started = queue_frame(frame, -1);
+    pthread_mutex_unlock(&bus.lock);
+    agoo_text_release(frame);
+    if (started && 0 <= bus.wake[1]) {
+	if (write(bus.wake[1], ".", 1)) {}
+    }
+}
+
+// Relays a frame if the hub and delivers it to the local connection loops.
+static void
+deliver_frame(int i, const char *frame, uint32_t slen, uint32_t mlen) {
+    agooPub	pub = NULL;
+    agooText	t;
+
+    if (0 == bus.index && 1 < bus.cnt && NULL != (t = agoo_text_create(frame, (int)(HEAD_SIZE + slen + mlen)))) {
+	agoo_text_ref(t);
+	pthread_mutex_lock(&bus.lock);
+	queue_frame(t, i);
+	pthread_mutex_unlock(&bus.lock);
+	agoo_text_release(t);
+    }
+    switch ((agooPubKind)frame[8]) {
+    case AGOO_PUB_MSG:
+	if (NULL != (pub = agoo_pub_publish(frame + HEAD_SIZE, (int)slen, frame + HEAD_SIZE + slen, mlen))) {
+	    pub->msg->bin = (0 != (frame[9] & FLAG_BIN));
+	}
+	break;
+    case AGOO_PUB_UN:
+	pub = agoo_pub_unsubscribe(NULL, frame + HEAD_SIZE, (int)slen);
+	break;
+    default:
+	agoo_log_cat(&agoo_error_cat, "Unexpected bus frame kind '%c'.", frame[8]);
+	break;
+    }
+    if (NULL != pub) {
+	agoo_server_publish_local(pub);
+    }
+}
+
+// Reads what is available from a peer and delivers every complete frame.
+// Returns false if the peer has closed or failed.
+static bool
+peer_read(int i) {
+    Peer	peer = &bus.peers[i];
+    ssize_t	cnt;
+    uint32_t	slen;
+    uint32_t	mlen;
+    long	flen;
+    long	pos;
+    char	*b;
+
+    while (true) {
+	if (peer->bcap - peer->blen < 4096) {
+	    long	cap = (0 == peer->bcap) ? 16384 : peer->bcap * 2;
+
+	    if (NULL == (b = (char*)AGOO_REALLOC(peer->buf, cap))) {
+		agoo_log_cat(&agoo_error_cat, "Out of memory for a bus frame.");
+		return false;
+	    }
+	    peer->buf = b;
+	    peer->bcap = cap;
+	}
+	if (0 >= (cnt = read(peer->fd, peer->buf + peer->blen, peer->bcap - peer->blen))) {
+	    if (0 > cnt) {
+		if (EINTR == errno) {
+		    continue;
+		}
+		if (EAGAIN == errno || EWOULDBLOCK == errno) {
+		    break;
+		}
+	    }
+	    return false;
+	}
+	peer->blen += cnt;
+	for (pos = 0; HEAD_SIZE <= peer->blen - pos; pos += flen) {
+	    memcpy(&slen, peer->buf + pos, 4);
+	    memcpy(&mlen, peer->buf + pos + 4, 4);
+	    flen = HEAD_SIZE + (long)slen + (long)mlen;
+	    if (peer->blen - pos < flen) {
+		break;
+	    }
+	    deliver_frame(i, peer->buf + pos, slen, mlen);
+	}
+	if (0 < pos) {
+	    memmove(peer->buf, peer->buf + pos, peer->blen - pos);
+	    peer->blen -= pos;
+	}
+    }
+    return true;
+}
+
+static void*
+bus_loop(void *x) {
+    struct pollfd	*pa;
+    struct pollfd	*p;
+    Peer		peer;
+    char		buf[64];
+    int			i;
+
+    atomic_fetch_add(&agoo_server.running, 1);
+    if (NULL == (pa = (struct pollfd*)AGOO_CALLOC(bus.cnt + 1, sizeof(struct pollfd)))) {
+	agoo_log_cat(&agoo_error_cat, "Out of memory for the bus.");
+	atomic_fetch_sub(&agoo_server.running, 1);
+	return NULL;
+    }
+    pa->fd = bus.wake[0];
+    pa->events = POLLIN;
+    while (bus.active && agoo_server.active) {
+	pthread_mutex_lock(&bus.lock);
+	for (i = 0, p = pa + 1, peer = bus.peers; i < bus.cnt; i++, p++, peer++) {
+	    p->fd = peer->fd;
+	    p->events = (NULL == peer->head) ? POLLIN : POLLIN | POLLOUT;
+	}
+	pthread_mutex_unlock(&bus.lock);
+	if (0 > (i = poll(pa, bus.cnt + 1, 200))) {
+	    if (EAGAIN == errno || EINTR == errno) {
+		continue;
+	    }
+	    agoo_log_cat(&agoo_error_cat, "Bus polling error. %s.", strerror(errno));
+	    break;
+	}
+	if (0 == i) {
+	    continue;
+	}
+	if (0 != (pa->revents & POLLIN)) {
+	    while (0 < read(bus.wake[0], buf, sizeof(buf))) {
+	    }
+	}
+	pa->revents = 0;
+	for (i = 0, p = pa + 1, peer = bus.peers; i < bus.cnt; i++, p++, peer++) {
+	    bool	ok = true;
+
+	    if (0 > p->fd) {
+		continue;
+	    }
+	    if (0 != (p->revents & (POLLIN | POLLERR | POLLHUP))) {
+		ok = peer_read(i);
+	    }
+	    pthread_mutex_lock(&bus.lock);
+	    if (ok && NULL != peer->head) {
+		ok = peer_flush(peer);
+	    }
+	    if (!ok) {
+		agoo_log_cat(&agoo_con_cat, "Bus peer of pid %d closed.", getpid());
+		peer_close(peer);
+	    }
+	    pthread_mutex_unlock(&bus.lock);
+	    p->revents = 0;
+	}
+    }
+    AGOO_FREE(pa);
+    atomic_fetch_sub(&agoo_server.running, 1);
+
+    return NULL;
+}
+
+int
+agoo_bus_start(agooErr err) {
+    int	stat;
+
+    if (!bus.active) {
+	return AGOO_ERR_OK;
+    }
+    if (0 != pipe(bus.wake)) {
+	return agoo_err_set(err, AGOO_ERR_NETWORK, "Failed to create bus wake pipe. %s", strerror(errno));
+    }
+    fcntl(bus.wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(bus.wake[1], F_SETFL, O_NONBLOCK);
+    if (0 != (stat = pthread_create(&bus.thread, NULL, bus_loop, NULL))) {
+	return agoo_err_set(err, AGOO_ERR_THREAD, "Failed to create bus thread. %s", strerror(stat));
+    }
+    bus.started = true;
+
+    return AGOO_ERR_OK;
+}
+
+void
+agoo_bus_shutdown(void) {
+    int	i;
+
+    // The bus thread is stopped and joined before anything it uses is
+    // closed or freed.
+    bus.active = false;
+    if (bus.started) {
+	if (0 <= bus.wake[1]) {
+	    if (write(bus.wake[1], ".", 1)) {}
+	}
+	pthread_join(bus.thread, NULL);
+	bus.started = false;
+    }
+    pthread_mutex_lock(&bus.lock);
+    for (i = 0; i < bus.cnt; i++) {
+	peer_close(&bus.peers[i]);
+    }
+    bus.cnt = 0;
+    for (i = 0; i < 2; i++) {
+	if (0 <= bus.wake[i]) {
+	    close(bus.wake[i]);
+	    bus.wake[i] = -1;
+	}
+    }
+    pthread_mutex_unlock(&bus.lock);
+    if (NULL != bus.pairs) {
+	for (i = 0; i < bus.pair_cnt; i++) {
+	    close(bus.pairs[i][0]);
+	    close(bus.pairs[i][1]);
+	}
+	AGOO_FREE(bus.pairs);
+	bus.pairs = NULL;
+    }
+    if (NULL != bus.peers) {
+	AGOO_FREE(bus.peers);
+	bus.peers = NULL;
+    }
+}
@@ -0,0 +1,24 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#ifndef AGOO_BUS_H
+#define AGOO_BUS_H
+
+#include <stdbool.h>
+
+#include "err.h"
+
+struct _agooPub;
+
+// The bus carries published messages between forked worker processes. The
+// first process is the hub with a Unix socket pair to each worker. A
+// worker sends to the hub which delivers locally and relays to every other
+// worker.
+
+extern int	agoo_bus_setup(agooErr err, int worker_cnt);
+extern void	agoo_bus_attach(int index);
+extern bool	agoo_bus_active(void);
+extern int	agoo_bus_start(agooErr err);
+extern void	agoo_bus_send(struct _agooPub *pub);
+extern void	agoo_bus_shutdown(void);
+
+#endif // AGOO_BUS_H
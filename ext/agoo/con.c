@@ -2,10 +2,13 @@
 
 #include <ctype.h>
 #include <netdb.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "affinity.h"
 #include "bind.h"
 #include "con.h"
 #include "debug.h"
@@ -21,13 +24,29 @@
 #include "res.h"
 #include "seg.h"
 #include "server.h"
+#include "slab.h"
 #include "sse.h"
 #include "subject.h"
 #include "upgraded.h"
 #include "websocket.h"
 
+// Limits on how much of the push queue is coalesced into one writev.
+#define WRITE_IOV_MAX	64
+#define WRITE_BUDGET	65536
+
+// A loop measures how busy it is every LOAD_WINDOW seconds.
+#define LOAD_WINDOW	1.0
+#define PARK_WAIT	0.5
+// How often a draining loop looks for connections that can be closed.
+#define DRAIN_FREQ	0.1
+
 double con_timeout = 30.0;
 
+// Spin and park totals of all the loops, added to by each loop at the end
+// of a load window.
+static struct _agooPollStats	poll_stats = { 0.0, 0.0, 0, 0 };
+static pthread_mutex_t		poll_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
 typedef enum {
     HEAD_AGAIN		= 'A',
     HEAD_ERR		= 'E',
@@ -59,9 +78,10 @@ agooCon
 agoo_con_create(agooErr err, int sock, uint64_t id, agooBind b) {
     agooCon	c;
 
-    if (NULL == (c = (agooCon)AGOO_CALLOC(1, sizeof(struct _agooCon)))) {
+    if (NULL == (c = (agooCon)agoo_slab_alloc(AGOO_SLAB_CON, sizeof(struct _agooCon)))) {
 	AGOO_ERR_MEM(err, "Connection");
     } else {
+	memset(c, 0, sizeof(struct _agooCon));
 	// It would be better to get this information in server.c after
 	// accept() but that does not work on macOS so instead a call to
 	// getpeername() is used instead.
@@ -83,7 +103,8 @@ agoo_con_create(agooErr err, int sock, uint64_t id, agooBind b) {
 	c->timeout = dtime() + con_timeout;
 	c->bind = b;
 	c->loop = NULL;
-	pthread_mutex_init(&c->res_lock, 0);
+	atomic_init(&c->inbox, NULL);
+	atomic_init(&c->hold, 0);
     }
     return c;
 }
@@ -91,6 +112,9 @@ agoo_con_create(agooErr err, int sock, uint64_t id, agooBind b) {
 void
 agoo_con_destroy(agooCon c) {
     atomic_fetch_sub(&agoo_server.con_cnt, 1);
+    if (NULL != c->loop) {
+	atomic_fetch_sub(&c->loop->con_cnt, 1);
+    }
     if (AGOO_CON_WS == c->bind->kind || AGOO_CON_SSE == c->bind->kind) {
 	agoo_ws_req_close(c);
     }
@@ -119,63 +143,235 @@ agoo_con_destroy(agooCon c) {
     agoo_log_cat(&agoo_con_cat, "Connection %llu closed.", (unsigned long long)c->id);
 
     agooRes	res;
+    agooRes	next;
 
     while (NULL != (res = c->res_head)) {
 	c->res_head = res->next;
-	AGOO_FREE(res);
+	agoo_res_destroy(res);
+    }
+    for (res = (agooRes)atomic_load(&c->inbox); NULL != res; res = next) {
+	next = res->next;
+	agoo_res_destroy(res);
     }
-    pthread_mutex_destroy(&c->res_lock);
-    AGOO_FREE(c);
+    agoo_slab_free(c);
 }
 
+// Must only be called from the connection loop thread.
 void
 agoo_con_res_append(agooCon c, agooRes res) {
-    pthread_mutex_lock(&c->res_lock);
     if (NULL == c->res_tail) {
 	c->res_head = res;
     } else {
 	c->res_tail->next = res;
     }
     c->res_tail = res;
-    pthread_mutex_unlock(&c->res_lock);
+    agoo_con_dirty(c);
+}
+
+// Marks the connection so the loop thread re-evaluates the events it waits
+// on. A caller on another thread must make sure the connection is not
+// removed concurrently, either with the hold count or by holding the lock on
+// the list the connection was found in.
+void
+agoo_con_dirty(agooCon c) {
+    if (NULL != c->link) {
+	agoo_ready_dirty(c->loop->ready, c->link);
+    }
+}
+
+static uint64_t
+subject_hash(const char *subject) {
+    uint64_t	h = 14695981039346656037ULL;
+
+    for (; '\0' != *subject; subject++) {
+	h ^= (uint8_t)*subject;
+	h *= 1099511628211ULL;
+    }
+    return (0 == h) ? 1 : h;
+}
+
+// Removes queued push messages, oldest first, until len more bytes fit in
+// the limit. Messages that have already been framed may be in the middle of
+// being written so they are left alone. Removed responses are added to the
+// drop list.
+static void
+drop_oldest(agooCon c, long len, agooRes *dropp) {
+    agooRes	res;
+    agooRes	prev = NULL;
+    agooRes	next;
+
+    for (res = c->res_head; NULL != res && agoo_server.max_push_bytes < c->qbytes + len; res = next) {
+	next = res->next;
+	if (res->framed || 0 >= res->qlen) {
+	    prev = res;
+	    continue;
+	}
+	if (NULL == prev) {
+	    c->res_head = next;
+	} else {
+	    prev->next = next;
+	}
+	if (res == c->res_tail) {
+	    c->res_tail = prev;
+	}
+	c->qbytes -= res->qlen;
+	res->next = *dropp;
+	*dropp = res;
+    }
+}
+
+static bool
+push_append(agooCon c, agooRes res) {
+    agooRes	drop = NULL;
+    agooRes	r;
+    long	len = (NULL == res->message) ? 0 : res->message->len;
+    bool	added = true;
+    int		dcnt = 0;
+
+    res->qlen = len;
+    if (0 < agoo_server.max_push_bytes && agoo_server.max_push_bytes < c->qbytes + len) {
+	switch (agoo_server.push_policy) {
+	case AGOO_PUSH_COALESCE:
+	    if (0 != res->subject) {
+		// Replace the message of a queued response on the same
+		// subject with the latest one.
+		for (r = c->res_head; NULL != r; r = r->next) {
+		    if (r->subject == res->subject && !r->framed && 0 < r->qlen) {
+			agooText	t = r->message;
+
+			r->message = res->message;
+			res->message = t;
+			c->qbytes += len - r->qlen;
+			r->qlen = len;
+			added = false;
+			break;
+		    }
+		}
+		if (!added) {
+		    res->next = drop;
+		    drop = res;
+		    break;
+		}
+	    }
+	    // fall through
+	case AGOO_PUSH_DROP_OLDEST:
+	    drop_oldest(c, len, &drop);
+	    if (agoo_server.max_push_bytes < c->qbytes + len) {
+		added = false;
+	    }
+	    break;
+	case AGOO_PUSH_DISCONNECT:
+	    agoo_log_cat(&agoo_warn_cat, "Push queue limit exceeded. Closing connection %llu.", (unsigned long long)c->id);
+	    c->dead = true;
+	    added = false;
+	    break;
+	case AGOO_PUSH_DROP_NEWEST:
+	default:
+	    added = false;
+	    break;
+	}
+    }
+    if (added) {
+	if (NULL == c->res_tail) {
+	    c->res_head = res;
+	} else {
+	    c->res_tail->next = res;
+	}
+	c->res_tail = res;
+	c->qbytes += len;
+    } else if (res != drop) {
+	res->next = drop;
+	drop = res;
+    }
+    agoo_con_dirty(c);
+
+    while (NULL != (r = drop)) {
+	drop = r->next;
+	agoo_res_destroy(r);
+	dcnt++;
+    }
+    if (0 < dcnt) {
+	atomic_fetch_add(&agoo_server.push_dropped, dcnt);
+	if (NULL != c->up) {
+	    atomic_fetch_add(&c->up->dropped, dcnt);
+	}
+    }
+    return added;
+}
+
+// Appends a push message response while enforcing the per connection byte
+// limit set by max_push_bytes. Returns false if the new message was not
+// queued, in which case the response has been destroyed. The subject is used
+// by the coalesce policy and can be NULL. Must only be called from the
+// connection loop thread.
+bool
+agoo_con_push_append(agooCon c, agooRes res, const char *subject) {
+    res->subject = (NULL == subject) ? 0 : subject_hash(subject);
+
+    return push_append(c, res);
+}
+
+// Posts a push message response from a thread other than the connection
+// loop. The response is moved to the queue, and the limits applied, the
+// next time the loop looks at the queue. The caller must make sure the
+// connection is not removed concurrently.
+void
+agoo_con_push_post(agooCon c, agooRes res, const char *subject) {
+    agooRes	head = (agooRes)atomic_load(&c->inbox);
+
+    res->subject = (NULL == subject) ? 0 : subject_hash(subject);
+    do {
+	res->next = head;
+    } while (!atomic_compare_exchange_weak(&c->inbox, &head, res));
+    agoo_con_dirty(c);
 }
 
 static void
 agoo_con_res_prepend(agooCon c, agooRes res) {
-    pthread_mutex_lock(&c->res_lock);
     res->next = c->res_head;
     c->res_head = res;
     if (NULL == c->res_tail) {
 	c->res_tail = res;
     }
-    pthread_mutex_unlock(&c->res_lock);
+    agoo_con_dirty(c);
 }
 
 static agooRes
 agoo_con_res_pop(agooCon c) {
     agooRes	res;
 
-    pthread_mutex_lock(&c->res_lock);
     if (NULL != (res = c->res_head)) {
 	c->res_head = res->next;
 	if (res == c->res_tail) {
 	    c->res_tail = NULL;
 	}
+	c->qbytes -= res->qlen;
+	res->qlen = 0;
     }
-    pthread_mutex_unlock(&c->res_lock);
-
     return res;
 }
 
+// Moves posted responses, oldest first, onto the queue before returning the
+// head.
 static agooRes
 agoo_con_res_peek(agooCon c) {
-    agooRes	res;
-
-    pthread_mutex_lock(&c->res_lock);
-    res = c->res_head;
-    pthread_mutex_unlock(&c->res_lock);
+    if (NULL != atomic_load(&c->inbox)) {
+	agooRes	res = (agooRes)atomic_exchange(&c->inbox, NULL);
+	agooRes	list = NULL;
+	agooRes	next;
 
-    return res;
+	for (; NULL != res; res = next) {
+	    next = res->next;
+	    res->next = list;
+	    list = res;
+	}
+	for (res = list; NULL != res; res = next) {
+	    next = res->next;
+	    res->next = NULL;
+	    push_append(c, res);
+	}
+    }
+    return c->res_head;
 }
 
 const char*
@@ -225,7 +421,7 @@ bad_request(agooCon c, int status, int line) {
 
 	agoo_con_res_append(c, res);
 	res->close = true;
-	agoo_res_message_push(res, message);
+	agoo_res_message_set(res, message);
     }
     return HEAD_ERR;
 }
@@ -256,7 +452,7 @@ page_response(agooCon c, agooPage p, char *hend) {
     if (res->close) {
 	c->closing = true;
     }
-    agoo_res_message_push(res, p->resp);
+    agoo_res_message_set(res, p->resp);
 
     return false;
 }
@@ -581,6 +777,7 @@ agoo_con_http_read(agooCon c) {
 	c->dead = true;
 	return true;
     }
+    c->used = true;
     c->bcnt += cnt;
     while (true) {
 	if (NULL == c->req) {
@@ -721,10 +918,13 @@ agoo_con_http_write(agooCon c) {
     }
     c->wcnt += cnt;
     if (c->wcnt == message->len) { // finished
+	// Final is read before taking the next message so a message posted
+	// just before final was set is not missed.
+	bool		final = agoo_res_final(res);
 	agooText	next = agoo_res_message_next(res);
 
 	c->wcnt = 0;
-	if (NULL == next && res->final) {
+	if (NULL == next && final) {
 	    bool	done = res->close;
 
 	    agoo_res_destroy(res);
@@ -815,15 +1015,20 @@ con_ws_read(agooCon c) {
 	    }
 	}
 	if (NULL != c->req) {
+	    size_t	off = 0;
+
 	    mlen = c->req->mlen;
-	    c->req->mlen = agoo_ws_decode(c->req->msg, c->req->mlen);
-	    if (mlen <= (long)c->bcnt) {
-		if (agoo_debug_cat.on) {
-		    if (AGOO_ON_MSG == c->req->method) {
-			agoo_log_cat(&agoo_debug_cat, "WebSocket message on %llu: %s", (unsigned long long)c->id, c->req->msg);
-		    } else {
-			agoo_log_cat(&agoo_debug_cat, "WebSocket binary message on %llu", (unsigned long long)c->id);
-		    }
+	    if ((long)c->bcnt < mlen) {
+		return false; // Wait for the rest of the frame.
+	    }
+	    // The payload is left in place and referenced by the body.
+	    c->req->body.len = (unsigned int)agoo_ws_decode(c->req->msg, c->req->mlen, &off);
+	    c->req->body.start = c->req->msg + off;
+	    if (agoo_debug_cat.on) {
+		if (AGOO_ON_MSG == c->req->method) {
+		    agoo_log_cat(&agoo_debug_cat, "WebSocket message on %llu: %s", (unsigned long long)c->id, c->req->body.start);
+		} else {
+		    agoo_log_cat(&agoo_debug_cat, "WebSocket binary message on %llu", (unsigned long long)c->id);
 		}
 	    }
 	    agoo_upgraded_ref(c->up);
@@ -848,72 +1053,90 @@ con_ws_read(agooCon c) {
 static const char	ping_msg[] = "\x89\x00";
 static const char	pong_msg[] = "\x8a\x00";
 
+// Gather the pending push messages into a single writev. Only the current
+// text of each response is included and a response is only followed by the
+// next one if that text completes it. The first response is always included
+// even if larger than the budget. Framed messages are never altered by the
+// queue limit policies since they may be partially sent.
 static bool
-con_ws_write(agooCon c) {
-    agooRes	res = agoo_con_res_pop(c);
-    agooText	message = agoo_res_message_peek(res);
-    ssize_t	cnt;
-
-    if (NULL == message) {
-	if (res->ping) {
-	    if (0 > (cnt = send(c->sock, ping_msg, sizeof(ping_msg) - 1, 0))) {
-		char	msg[1024];
-		int	len;
-
-		if (EAGAIN == errno) {
-		    return true;
-		}
-		len = snprintf(msg, sizeof(msg) - 1, "Socket error @ %llu.", (unsigned long long)c->id);
-		push_error(c->up, msg, len);
-
-		agoo_log_cat(&agoo_error_cat, "Socket error @ %llu.", (unsigned long long)c->id);
-		agoo_ws_req_close(c);
-		agoo_res_destroy(res);
-
-		return false;
+con_push_writev(agooCon c, bool ws) {
+    struct iovec	iov[WRITE_IOV_MAX];
+    agooRes		ra[WRITE_IOV_MAX];
+    agooRes		res;
+    agooText		message;
+    size_t		total = 0;
+    ssize_t		cnt;
+    int			rcnt = 0;
+    int			i;
+    bool		final;
+
+    for (res = agoo_con_res_peek(c); NULL != res && rcnt < WRITE_IOV_MAX && total < WRITE_BUDGET; res = res->next) {
+	final = agoo_res_final(res);
+	if (NULL == (message = agoo_res_message_peek(res))) {
+	    if (!ws || !(res->ping || res->pong)) {
+		break; // a close, handled once it is at the head
 	    }
-	} else if (res->pong) {
-	    if (0 > (cnt = send(c->sock, pong_msg, sizeof(pong_msg) - 1, 0))) {
-		char	msg[1024];
-		int	len;
-
-		if (EAGAIN == errno) {
-		    return true;
-		}
-		len = snprintf(msg, sizeof(msg) - 1, "Socket error @ %llu.", (unsigned long long)c->id);
-		push_error(c->up, msg, len);
-		agoo_log_cat(&agoo_error_cat, "Socket error @ %llu.", (unsigned long long)c->id);
-		agoo_ws_req_close(c);
-		agoo_res_destroy(res);
-
-		return false;
+	    if (res->ping) {
+		iov[rcnt].iov_base = (void*)ping_msg;
+		iov[rcnt].iov_len = sizeof(ping_msg) - 1;
+	    } else {
+		iov[rcnt].iov_base = (void*)pong_msg;
+		iov[rcnt].iov_len = sizeof(pong_msg) - 1;
 	    }
 	} else {
-	    agoo_ws_req_close(c);
-	    agoo_res_destroy(res);
-
-	    return false;
-	}
-	return true;
-    }
-    c->timeout = dtime() + con_timeout;
-    if (0 == c->wcnt) {
-	agooText	t;
+	    if (!res->framed) {
+		agooText	t;
 
-	if (agoo_push_cat.on) {
-	    if (message->bin) {
-		agoo_log_cat(&agoo_push_cat, "%llu binary", (unsigned long long)c->id);
-	    } else {
-		agoo_log_cat(&agoo_push_cat, "%llu: %s", (unsigned long long)c->id, message->text);
+		if (agoo_push_cat.on) {
+		    if (message->bin) {
+			agoo_log_cat(&agoo_push_cat, "%llu binary", (unsigned long long)c->id);
+		    } else {
+			agoo_log_cat(&agoo_push_cat, "%llu: %s", (unsigned long long)c->id, message->text);
+		    }
+		}
+		// Framing changes the text in place so a text shared with
+		// other responses, such as a GraphQL subscription result, or a
+		// pinned text that may be read-only is copied first.
+		if (message->pinned || 1 < (long)atomic_load(&message->ref_cnt)) {
+		    if (NULL == (t = agoo_text_dup(message))) {
+			agoo_log_cat(&agoo_error_cat, "Failed to copy a push message on connection %llu.", (unsigned long long)c->id);
+			return false;
+		    }
+		    t->next = message->next;
+		    t->bin = message->bin;
+		    agoo_text_ref(t);
+		    agoo_text_release(message);
+		    res->message = t;
+		    message = t;
+		}
+		if (ws) {
+		    t = agoo_ws_expand(message);
+		} else {
+		    t = agoo_sse_expand(message);
+		}
+		if (t != message) {
+		    // The text was reallocated when expanded so the response
+		    // must reference the new one.
+		    res->message = t;
+		    message = t;
+		}
+		res->framed = true;
 	    }
+	    iov[rcnt].iov_base = message->text;
+	    iov[rcnt].iov_len = message->len;
+	}
+	if (0 == rcnt) {
+	    iov[rcnt].iov_base = (char*)iov[rcnt].iov_base + c->wcnt;
+	    iov[rcnt].iov_len -= c->wcnt;
 	}
-	t = agoo_ws_expand(message);
-	if (t != message) {
-	    agoo_res_message_push(res, t);
-	    message = t;
+	total += iov[rcnt].iov_len;
+	ra[rcnt++] = res;
+	if (NULL != message && (NULL != message->next || !final)) {
+	    break;
 	}
     }
-    if (0 > (cnt = send(c->sock, message->text + c->wcnt, message->len - c->wcnt, 0))) {
+
+    if (0 > (cnt = writev(c->sock, iov, rcnt))) {
 	char	msg[1024];
 	int	len;
 
@@ -923,81 +1146,70 @@ con_ws_write(agooCon c) {
 	len = snprintf(msg, sizeof(msg) - 1, "Socket error @ %llu.", (unsigned long long)c->id);
 	push_error(c->up, msg, len);
 	agoo_log_cat(&agoo_error_cat, "Socket error @ %llu.", (unsigned long long)c->id);
-	agoo_ws_req_close(c);
-
+	if (ws) {
+	    agoo_ws_req_close(c);
+	}
 	return false;
     }
-    c->wcnt += cnt;
-    if (c->wcnt == message->len) { // finished
-	agooText	next = agoo_res_message_next(res);
-
+    // Account for what was written. Completed responses are removed and a
+    // partially written one is left at the head with wcnt set.
+    for (i = 0; i < rcnt; i++) {
+	if ((size_t)cnt < iov[i].iov_len) {
+	    c->wcnt += cnt;
+	    break;
+	}
+	cnt -= iov[i].iov_len;
 	c->wcnt = 0;
-	if (NULL == next && res->final) {
-	    bool	done = res->close;
-
+	res = ra[i];
+	if (NULL != res->message) {
+	    final = agoo_res_final(res);
+	    if (NULL != agoo_res_message_next(res)) {
+		res->framed = false;
+		break;
+	    }
+	    if (!final) {
+		break;
+	    }
+	}
+	agoo_con_res_pop(c);
+	if (res->close) {
 	    agoo_res_destroy(res);
-
-	    return !done;
+	    return false;
 	}
+	agoo_res_destroy(res);
     }
-    agoo_con_res_prepend(c, res);
-
     return true;
 }
 
 static bool
-con_sse_write(agooCon c) {
-    agooRes	res = agoo_con_res_pop(c);
-    agooText	message = agoo_res_message_peek(res);
-    ssize_t	cnt;
+con_ws_write(agooCon c) {
+    agooRes	res = agoo_con_res_peek(c);
 
-    if (NULL == message) {
+    if (NULL == agoo_res_message_peek(res) && !res->ping && !res->pong) {
+	agoo_con_res_pop(c);
+	agoo_ws_req_close(c);
 	agoo_res_destroy(res);
 
 	return false;
     }
-    c->timeout = dtime() + con_timeout *2;
-    if (0 == c->wcnt) {
-	agooText	t;
-
-	if (agoo_push_cat.on) {
-	    agoo_log_cat(&agoo_push_cat, "%llu: %s %p", (unsigned long long)c->id, message->text, (void*)res);
-	}
-	t = agoo_sse_expand(message);
-	if (t != message) {
-	    agoo_res_message_push(res, t);
-	    message = t;
-	}
-    }
-    if (0 > (cnt = send(c->sock, message->text + c->wcnt, message->len - c->wcnt, 0))) {
-	char	msg[1024];
-	int	len;
-
-	if (EAGAIN == errno) {
-	    return true;
-	}
-	len = snprintf(msg, sizeof(msg) - 1, "Socket error @ %llu.", (unsigned long long)c->id);
-	push_error(c->up, msg, len);
-	agoo_log_cat(&agoo_error_cat, "Socket error @ %llu.", (unsigned long long)c->id);
+    c->timeout = dtime() + con_timeout;
 
-	return false;
-    }
-    c->wcnt += cnt;
-    if (c->wcnt == message->len) { // finished
-	agooText	next = agoo_res_message_next(res);
+    return con_push_writev(c, true);
+}
 
-	c->wcnt = 0;
-	if (NULL == next) {
-	    bool	done = res->close;
+static bool
+con_sse_write(agooCon c) {
+    agooRes	res = agoo_con_res_peek(c);
 
-	    agoo_res_destroy(res);
+    if (NULL == agoo_res_message_peek(res)) {
+	agoo_con_res_pop(c);
+	agoo_res_destroy(res);
 
-	    return !done;
-	}
+	return false;
     }
-    agoo_con_res_prepend(c, res);
+    c->timeout = dtime() + con_timeout *2;
 
-    return true;
+    return con_push_writev(c, false);
 }
 
 static void
@@ -1008,11 +1220,15 @@ publish_pub(agooPub pub, agooConLoop loop) {
     for (up = agoo_server.up_list; NULL != up; up = up->next) {
 	if (NULL != up->con && up->con->loop == loop && agoo_upgraded_match(up, sub)) {
 	    agooRes	res = agoo_res_create(up->con);
+	    agooText	t;
 
 	    if (NULL != res) {
-		agoo_con_res_append(up->con, res);
 		res->con_kind = AGOO_CON_ANY;
-		agoo_res_message_push(res, agoo_text_dup(pub->msg));
+		if (NULL != (t = agoo_text_dup(pub->msg))) {
+		    t->bin = pub->msg->bin;
+		}
+		agoo_res_message_set(res, t);
+		agoo_con_push_append(up->con, res, sub);
 	    }
 	}
     }
@@ -1060,9 +1276,10 @@ process_pub_con(agooPub pub, agooConLoop loop) {
 	    agooRes	res = agoo_res_create(up->con);
 
 	    if (NULL != res) {
-		agoo_con_res_append(up->con, res);
 		res->con_kind = up->con->bind->kind;
 		res->close = true;
+		agoo_res_message_set(res, NULL);
+		agoo_con_res_append(up->con, res);
 	    }
 	}
 	break;
@@ -1073,9 +1290,9 @@ process_pub_con(agooPub pub, agooConLoop loop) {
 	    agooRes	res = agoo_res_create(up->con);
 
 	    if (NULL != res) {
-		agoo_con_res_append(up->con, res);
 		res->con_kind = AGOO_CON_ANY;
-		agoo_res_message_push(res, pub->msg);
+		agoo_res_message_set(res, pub->msg);
+		agoo_con_push_append(up->con, res, NULL);
 	    }
 	}
 	break;
@@ -1105,7 +1322,7 @@ agoo_con_http_events(agooCon c) {
     short	events = 0;
     agooRes	res = agoo_con_res_peek(c);
 
-    if (NULL != res && NULL != res->message) {
+    if (NULL != res && NULL != agoo_res_message_peek(res)) {
 	events = POLLIN | POLLOUT;
     } else if (!c->closing) {
 	events = POLLIN;
@@ -1118,7 +1335,7 @@ con_ws_events(agooCon c) {
     short	events = 0;
     agooRes	res = agoo_con_res_peek(c);
 
-    if (NULL != res && (res->close || res->ping || NULL != res->message)) {
+    if (NULL != res && (res->close || res->ping || NULL != agoo_res_message_peek(res))) {
 	events = POLLIN | POLLOUT;
     } else if (!c->closing) {
 	events = POLLIN;
@@ -1131,32 +1348,35 @@ con_sse_events(agooCon c) {
     short	events = 0;
     agooRes	res = agoo_con_res_peek(c);
 
-    if (NULL != res && NULL != res->message) {
+    if (NULL != res && NULL != agoo_res_message_peek(res)) {
 	events = POLLOUT;
     }
     return events;
 }
 
+// Responses still waiting on an eval thread are kept, as is the connection,
+// until they are final. A connection held by another thread is also kept.
+// A GraphQL subscription is removed from the server list first so a
+// publish can not take a new hold on the connection after the check.
 static bool
 remove_dead_res(agooCon c) {
     agooRes	res;
-    bool	empty;
 
-    pthread_mutex_lock(&c->res_lock);
-    while (NULL != (res = c->res_head)) {
-	if (NULL == agoo_res_message_peek(c->res_head) && !c->res_head->close && !c->res_head->ping) {
+    if (NULL != c->gsub) {
+	agoo_server_del_gsub(c->gsub);
+    }
+    while (NULL != (res = agoo_con_res_peek(c))) {
+	if (!agoo_res_final(res)) {
 	    break;
 	}
-	c->res_head = res->next;
-	if (res == c->res_tail) {
-	    c->res_tail = NULL;
-	}
+	agoo_con_res_pop(c);
 	agoo_res_destroy(res);
     }
-    empty = NULL == c->res_head;
-    pthread_mutex_unlock(&c->res_lock);
-
-    return empty;
+    // The hold is checked after the final responses are taken. A thread
+    // posting a response holds the connection before it sets final and
+    // releases it only after it is done with the connection, so a final
+    // response seen here means that hold is still visible.
+    return NULL == c->res_head && 0 == (long)atomic_load(&c->hold);
 }
 
 static agooReadyIO
@@ -1193,6 +1413,8 @@ con_ready_check(void *ctx, double now) {
 	c->timeout = dtime() + con_timeout;
 	if (AGOO_CON_WS == c->bind->kind) {
 	    agoo_ws_ping(c);
+	} else {
+	    agoo_sse_heartbeat(c);
 	}
 	return false;
     } else {
@@ -1202,6 +1424,18 @@ con_ready_check(void *ctx, double now) {
     return false;
 }
 
+// The next time the connection needs attention from con_ready_check. Dead
+// connections are checked right away.
+static double
+con_ready_deadline(void *ctx) {
+    agooCon	c = (agooCon)ctx;
+
+    if (c->dead || 0 == c->sock) {
+	return 0.0;
+    }
+    return c->timeout;
+}
+
 static bool
 con_ready_read(agooReady ready, void *ctx) {
     agooCon	c = (agooCon)ctx;
@@ -1263,12 +1497,33 @@ con_ready_error(void *ctx) {
 static struct _agooHandler	con_handler = {
     .io = con_ready_io,
     .check = con_ready_check,
+    .deadline = con_ready_deadline,
     .read = con_ready_read,
     .write = con_ready_write,
     .error = con_ready_error,
     .destroy = con_ready_destroy,
 };
 
+// Closes a connection with nothing in flight so the client reconnects to
+// the process that is now accepting. Bytes waiting to be read are the start
+// of a request that is still answered, as is the first request on a
+// connection accepted just before the listeners were closed.
+static void
+drain_con(void *ctx, void *arg) {
+    agooCon	c = (agooCon)ctx;
+    char	b;
+
+    if (c->dead || 0 == c->sock || NULL == c->link || !c->used || NULL != c->req || 0 < c->bcnt ||
+	NULL != c->res_head || NULL != atomic_load(&c->inbox) || 0 != (long)atomic_load(&c->hold)) {
+	return;
+    }
+    if (0 < recv(c->sock, &b, 1, MSG_PEEK | MSG_DONTWAIT)) {
+	return;
+    }
+    c->dead = true;
+    agoo_ready_dirty((agooReady)arg, c->link);
+}
+
 static agooReadyIO
 queue_ready_io(void *ctx) {
     return AGOO_READY_IN;
@@ -1292,29 +1547,48 @@ con_ssl_setup(agooCon c) {
 #endif
 }
 
-static bool
-con_queue_ready_read(agooReady ready, void *ctx) {
-    agooConLoop		loop = (agooConLoop)ctx;
+static void
+add_con(agooReady ready, agooConLoop loop, agooCon c) {
     struct _agooErr	err = AGOO_ERR_INIT;
-    agooCon		c;
+    agooLink		link;
 
-    agoo_queue_release(&agoo_server.con_queue);
-    while (NULL != (c = (agooCon)agoo_queue_pop(&agoo_server.con_queue, 0.0))) {
-	c->loop = loop;
-	if (AGOO_ERR_OK != agoo_ready_add(&err, ready, c->sock, &con_handler, c)) {
-	    agoo_log_cat(&agoo_error_cat, "Failed to add connection to manager. %s", err.msg);
-	    agoo_err_clear(&err);
-	}
+    c->loop = loop;
+    if (AGOO_ERR_OK != agoo_ready_add(&err, ready, c->sock, &con_handler, c, &link)) {
+	agoo_log_cat(&agoo_error_cat, "Failed to add connection to manager. %s", err.msg);
+	return;
+    }
+    c->link = link;
+}
+
+static void
+take_cons(agooReady ready, agooConLoop loop) {
+    agooCon	c;
+
+    while (NULL != (c = (agooCon)agoo_queue_pop(&loop->con_queue, 0.0))) {
+	add_con(ready, loop, c);
 	if (AGOO_CON_HTTPS == c->bind->kind) {
 	    con_ssl_setup(c);
 	}
     }
+}
+
+static bool
+con_queue_ready_read(agooReady ready, void *ctx) {
+    agooConLoop	loop = (agooConLoop)ctx;
+
+    // Listen again before draining so a connection assigned after the
+    // drain writes to the pipe instead of waiting for the next pass.
+    agoo_queue_release(&loop->con_queue);
+    agoo_queue_listen(&loop->con_queue);
+    take_cons(ready, loop);
+
     return true;
 }
 
 static struct _agooHandler	con_queue_handler = {
     .io = queue_ready_io,
     .check = NULL,
+    .deadline = NULL,
     .read = con_queue_ready_read,
     .write = NULL,
     .error = NULL,
@@ -1336,20 +1610,46 @@ pub_queue_ready_read(agooReady ready, void *ctx) {
 static struct _agooHandler	pub_queue_handler = {
     .io = queue_ready_io,
     .check = NULL,
+    .deadline = NULL,
     .read = pub_queue_ready_read,
     .write = NULL,
     .error = NULL,
     .destroy = NULL,
 };
 
+// Waits up to PARK_WAIT for a publish, a connection, or a wakeup. Both
+// queues are set to waiting before they are checked so a push after the
+// check still writes to the pipe. The connection queue is left listening
+// as the ready handler expects.
+static void
+park_wait(agooConLoop loop, int con_fd, int pub_fd) {
+    struct pollfd	pa[2];
+
+    agoo_queue_listen(&loop->con_queue);
+    agoo_queue_listen(&loop->pub_queue);
+    if (loop->parked && agoo_queue_empty(&loop->con_queue) && agoo_queue_empty(&loop->pub_queue)) {
+	pa[0].fd = con_fd;
+	pa[0].events = POLLIN;
+	pa[0].revents = 0;
+	pa[1].fd = pub_fd;
+	pa[1].events = POLLIN;
+	pa[1].revents = 0;
+	if (poll(pa, 2, (int)(PARK_WAIT * 1000.0))) {}
+    }
+    agoo_queue_release(&loop->pub_queue);
+    agoo_queue_release(&loop->con_queue);
+    agoo_queue_listen(&loop->con_queue);
+}
+
 void*
 agoo_con_loop(void *x) {
     agooConLoop		loop = (agooConLoop)x;
     struct _agooErr	err = AGOO_ERR_INIT;
     agooReady		ready = agoo_ready_create(&err);
     agooPub		pub;
-    agooCon		c;
-    int			con_queue_fd = agoo_queue_listen(&agoo_server.con_queue);
+    double		now;
+    double		drain_next = 0.0;
+    int			con_queue_fd = agoo_queue_listen(&loop->con_queue);
     int			pub_queue_fd = agoo_queue_listen(&loop->pub_queue);
 
     if (NULL == ready) {
@@ -1357,26 +1657,39 @@ agoo_con_loop(void *x) {
 	exit(EXIT_FAILURE);
 	return NULL;
     }
-    if (AGOO_ERR_OK != agoo_ready_add(&err, ready, con_queue_fd, &con_queue_handler, loop) ||
-	AGOO_ERR_OK != agoo_ready_add(&err, ready, pub_queue_fd, &pub_queue_handler, loop)) {
+    loop->ready = ready;
+    if (agoo_server.io_uring && AGOO_ERR_OK != agoo_ready_io_uring(&err, ready)) {
+	agoo_log_cat(&agoo_warn_cat, "io_uring not available, using the default poller. %s", err.msg);
+	agoo_err_clear(&err);
+    }
+    agoo_ready_busy_poll(ready, agoo_server.busy_poll);
+    if (AGOO_ERR_OK != agoo_ready_add(&err, ready, con_queue_fd, &con_queue_handler, loop, NULL) ||
+	AGOO_ERR_OK != agoo_ready_add(&err, ready, pub_queue_fd, &pub_queue_handler, loop, NULL)) {
 	agoo_log_cat(&agoo_error_cat, "Failed to add queue connection to manager. %s", err.msg);
 	exit(EXIT_FAILURE);
 
 	return NULL;
     }
+    agoo_affinity_loop(loop->id);
     atomic_fetch_add(&agoo_server.running, 1);
+    loop->window = dtime();
 
     while (agoo_server.active) {
-	while (NULL != (c = (agooCon)agoo_queue_pop(&agoo_server.con_queue, 0.0))) {
-	    c->loop = loop;
-	    if (AGOO_ERR_OK != agoo_ready_add(&err, ready, c->sock, &con_handler, c)) {
-		agoo_log_cat(&agoo_error_cat, "Failed to add connection to manager. %s", err.msg);
-		agoo_err_clear(&err);
-	    }
-	    if (AGOO_CON_HTTPS == c->bind->kind) {
-		con_ssl_setup(c);
+	// A parked loop with no connections left only has publishes to deal
+	// with so it waits on those instead of polling. The connection queue
+	// is watched as well so a resumed loop picks up its first connection
+	// right away instead of sleeping out the wait.
+	if (loop->parked && 0 == (long)atomic_load(&loop->con_cnt) && agoo_queue_empty(&loop->con_queue)) {
+	    park_wait(loop, con_queue_fd, pub_queue_fd);
+	    while (NULL != (pub = (agooPub)agoo_queue_pop(&loop->pub_queue, 0.0))) {
+		process_pub_con(pub, loop);
 	    }
+	    agoo_ready_idle(ready);
+	    loop->window = dtime();
+	    atomic_store(&loop->load, 0);
+	    continue;
 	}
+	take_cons(ready, loop);
 	while (NULL != (pub = (agooPub)agoo_queue_pop(&loop->pub_queue, 0.0))) {
 	    process_pub_con(pub, loop);
 	}
@@ -1384,6 +1697,20 @@ agoo_con_loop(void *x) {
 	    agoo_log_cat(&agoo_error_cat, "IO error. %s", err.msg);
 	    agoo_err_clear(&err);
 	}
+	now = dtime();
+	if (agoo_server.draining && drain_next <= now) {
+	    agoo_ready_iterate(ready, &con_handler, drain_con, ready);
+	    drain_next = now + DRAIN_FREQ;
+	}
+	if (loop->window + LOAD_WINDOW <= now) {
+	    double	span = now - loop->window;
+
+	    atomic_store(&loop->load, (int)((span - agoo_ready_idle(ready)) * 1000.0 / span));
+	    loop->window = now;
+	    pthread_mutex_lock(&poll_stats_lock);
+	    agoo_ready_stats(ready, &poll_stats);
+	    pthread_mutex_unlock(&poll_stats_lock);
+	}
     }
     agoo_ready_destroy(ready);
     atomic_fetch_sub(&agoo_server.running, 1);
@@ -1401,18 +1728,17 @@ agoo_conloop_create(agooErr err, int id) {
 	int	stat;
 
 	loop->next = NULL;
-	if (AGOO_ERR_OK != agoo_queue_multi_init(err, &loop->pub_queue, 256, true, false)) {
+	loop->ready = NULL;
+	atomic_init(&loop->con_cnt, 0);
+	atomic_init(&loop->load, 0);
+	loop->window = 0.0;
+	loop->parked = false;
+	if (AGOO_ERR_OK != agoo_queue_multi_init(err, &loop->pub_queue, 256, true, false) ||
+	    AGOO_ERR_OK != agoo_queue_init(err, &loop->con_queue, 1024)) {
 	    AGOO_FREE(loop);
 	    return NULL;
 	}
 	loop->id = id;
-	loop->res_head = NULL;
-	loop->res_tail = NULL;
-	if (0 != pthread_mutex_init(&loop->lock, 0)) {
-	    AGOO_FREE(loop);
-	    agoo_err_no(err, "Failed to initialize loop mutex.");
-	    return NULL;
-	}
 	if (0 != (stat = pthread_create(&loop->thread, NULL, agoo_con_loop, loop))) {
 	    agoo_err_set(err, stat, "Failed to create connection loop. %s", strerror(stat));
 	    return NULL;
@@ -1421,14 +1747,17 @@ agoo_conloop_create(agooErr err, int id) {
     return loop;
 }
 
+// Copies the spin and park totals of all the loops.
 void
-agoo_conloop_destroy(agooConLoop loop) {
-    agooRes	res;
+agoo_conloop_poll_stats(agooPollStats stats) {
+    pthread_mutex_lock(&poll_stats_lock);
+    *stats = poll_stats;
+    pthread_mutex_unlock(&poll_stats_lock);
+}
 
+void
+agoo_conloop_destroy(agooConLoop loop) {
     agoo_queue_cleanup(&loop->pub_queue);
-    while (NULL != (res = loop->res_head)) {
-	loop->res_head = res->next;
-	AGOO_FREE(res);
-    }
+    agoo_queue_cleanup(&loop->con_queue);
     AGOO_FREE(loop);
 }
@@ -28,18 +28,21 @@ struct _agooRes;
 struct _agooBind;
 struct _agooQueue;
 struct _gqlSub;
+struct _agooReady;
+struct _agooLink;
+struct _agooPollStats;
 
 typedef struct _agooConLoop {
     struct _agooConLoop	*next;
     struct _agooQueue	pub_queue;
+    struct _agooQueue	con_queue; // new connections assigned by the listener
+    struct _agooReady	*ready;
     pthread_t		thread;
     int			id;
-
-    // Cache of responses to be reused.
-    struct _agooRes	*res_head;
-    struct _agooRes	*res_tail;
-    pthread_mutex_t	lock;
-
+    atomic_int		con_cnt; // assigned connections not yet closed
+    atomic_int		load; // busy per mille over the last load window
+    double		window; // start of the current load window
+    volatile bool	parked; // takes no new connections and sleeps once empty
 } *agooConLoop;
 
 typedef struct _agooCon {
@@ -54,15 +57,20 @@ typedef struct _agooCon {
 
     ssize_t			mcnt;  // how much has been read so far
     ssize_t			wcnt;  // how much has been written
+    long			qbytes; // push message bytes queued
 
     double			timeout;
     bool			closing;
     bool			dead;
+    bool			used; // a request has started to arrive
     volatile bool		hijacked;
     struct _agooReq		*req;
+    // The response queue is only touched by the connection loop thread.
+    // Other threads post to the inbox.
     struct _agooRes		*res_head;
     struct _agooRes		*res_tail;
-    pthread_mutex_t		res_lock;
+    _Atomic(struct _agooRes*)	inbox;
+    atomic_int			hold; // held while another thread marks dirty
 
     struct _agooUpgraded	*up; // only set for push connections
     struct _gqlSub		*gsub; // for graphql subscription
@@ -70,6 +78,7 @@ typedef struct _agooCon {
     SSL				*ssl;
 #endif
     agooConLoop			loop;
+    struct _agooLink		*link; // set once polled
 } *agooCon;
 
 extern agooCon		agoo_con_create(agooErr err, int sock, uint64_t id, struct _agooBind *b);
@@ -78,8 +87,12 @@ extern const char*	agoo_con_header_value(const char *header, int hlen, const cha
 
 extern agooConLoop	agoo_conloop_create(agooErr err, int id);
 extern void		agoo_conloop_destroy(agooConLoop loop);
+extern void		agoo_conloop_poll_stats(struct _agooPollStats *stats);
 
 extern void		agoo_con_res_append(agooCon c, struct _agooRes *res);
+extern void		agoo_con_dirty(agooCon c);
+extern bool		agoo_con_push_append(agooCon c, struct _agooRes *res, const char *subject);
+extern void		agoo_con_push_post(agooCon c, struct _agooRes *res, const char *subject);
 
 extern bool		agoo_con_http_read(agooCon c);
 extern bool		agoo_con_http_write(agooCon c);
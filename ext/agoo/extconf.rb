@@ -21,6 +21,10 @@ CONFIG['warnflags'].slice!(/ -Wmissing-noreturn/)
 
 have_header('stdatomic.h')
 have_header('sys/epoll.h')
+have_header('linux/io_uring.h')
+have_header('linux/mempolicy.h')
+have_func('pthread_setaffinity_np', 'pthread.h')
+have_func('posix_spawn_file_actions_addclosefrom_np', 'spawn.h')
 have_header('openssl/ssl.h')
 have_library('ssl')
 have_library('crypto')
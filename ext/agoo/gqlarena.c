@@ -0,0 +1,124 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "debug.h"
+#include "gqlarena.h"
+
+#define FIRST_SIZE	8192
+#define MAX_SIZE	(1024 * 1024)
+#define ALIGN(size)	(((size) + 15) & ~(size_t)15)
+
+typedef struct _block {
+    struct _block	*next;
+    size_t		size;
+    char		data[] __attribute__ ((aligned (16)));
+} *Block;
+
+struct _gqlArena {
+    Block	blocks; // newest first
+    char	*cur;
+    char	*end;
+    size_t	next_size;
+};
+
+static _Thread_local gqlArena	current = NULL;
+
+gqlArena
+gql_arena_create(agooErr err) {
+    gqlArena	arena = (gqlArena)AGOO_MALLOC(sizeof(struct _gqlArena));
+
+    if (NULL == arena) {
+	AGOO_ERR_MEM(err, "GraphQL Arena");
+	return NULL;
+    }
+    arena->blocks = NULL;
+    arena->cur = NULL;
+    arena->end = NULL;
+    arena->next_size = FIRST_SIZE;
+
+    return arena;
+}
+
+void
+gql_arena_destroy(gqlArena arena) {
+    Block	b;
+
+    if (NULL == arena) {
+	return;
+    }
+    if (current == arena) {
+	current = NULL;
+    }
+    while (NULL != (b = arena->blocks)) {
+	arena->blocks = b->next;
+	AGOO_FREE(b);
+    }
+    AGOO_FREE(arena);
+}
+
+static bool
+grow(gqlArena arena, size_t size) {
+    size_t	bsize = arena->next_size;
+    Block	b;
+
+    if (bsize < size) {
+	bsize = ALIGN(size);
+    } else if (arena->next_size < MAX_SIZE) {
+	arena->next_size *= 2;
+    }
+    if (NULL == (b = (Block)AGOO_MALLOC(sizeof(struct _block) + bsize))) {
+	return false;
+    }
+    b->size = bsize;
+    // Only the newest block is allocated from.
+    b->next = arena->blocks;
+    arena->blocks = b;
+    arena->cur = b->data;
+    arena->end = b->data + bsize;
+
+    return true;
+}
+
+void*
+gql_arena_alloc(gqlArena arena, size_t size) {
+    char	*ptr;
+
+    size = ALIGN(size);
+    if ((size_t)(arena->end - arena->cur) < size && !grow(arena, size)) {
+	return NULL;
+    }
+    ptr = arena->cur;
+    arena->cur += size;
+
+    return ptr;
+}
+
+char*
+gql_arena_strndup(gqlArena arena, const char *str, size_t len) {
+    char	*s;
+
+    if (NULL != (s = (char*)gql_arena_alloc(arena, len + 1))) {
+	memcpy(s, str, len);
+	s[len] = '\0';
+    }
+    return s;
+}
+
+// Sets the arena values are created in on this thread and returns the one
+// it replaces. NULL turns off arena allocation.
+gqlArena
+gql_arena_use(gqlArena arena) {
+    gqlArena	prev = current;
+
+    current = arena;
+
+    return prev;
+}
+
+gqlArena
+gql_arena_current(void) {
+    return current;
+}
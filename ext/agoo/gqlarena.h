@@ -0,0 +1,26 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#ifndef AGOO_GQLARENA_H
+#define AGOO_GQLARENA_H
+
+#include <stddef.h>
+
+#include "err.h"
+
+// Values created while evaluating a request are bump allocated from an
+// arena that belongs to the request document. Values from an arena are not
+// freed one at a time. All of them are released when the arena is. The
+// arena in use is per thread so only values created on the thread that
+// set it come from it.
+
+typedef struct _gqlArena	*gqlArena;
+
+extern gqlArena	gql_arena_create(agooErr err);
+extern void	gql_arena_destroy(gqlArena arena);
+extern void*	gql_arena_alloc(gqlArena arena, size_t size);
+extern char*	gql_arena_strndup(gqlArena arena, const char *str, size_t len);
+
+extern gqlArena	gql_arena_use(gqlArena arena);
+extern gqlArena	gql_arena_current(void);
+
+#endif // AGOO_GQLARENA_H
@@ -0,0 +1,257 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "debug.h"
+#include "gqlcache.h"
+#include "graphql.h"
+#include "sdl.h"
+#include "sha256.h"
+
+#define BUCKET_SIZE	256
+#define BUCKET_MASK	255
+
+typedef struct _entry {
+    struct _entry	*next;  // in bucket
+    struct _entry	*newer;
+    struct _entry	*older;
+    uint8_t		hash[SHA256_DIGEST_SIZE];
+    gqlDoc		doc;
+} *Entry;
+
+static struct _cache {
+    Entry		buckets[BUCKET_SIZE];
+    Entry		newest;
+    Entry		oldest;
+    int			cnt;
+    int			max;
+    pthread_mutex_t	lock;
+} cache = {
+    .buckets = { NULL },
+    .newest = NULL,
+    .oldest = NULL,
+    .cnt = 0,
+    .max = GQL_CACHE_DEFAULT_MAX,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static Entry*
+get_bucketp(const uint8_t *hash) {
+    return cache.buckets + (((uint32_t)hash[0] | ((uint32_t)hash[1] << 8)) & BUCKET_MASK);
+}
+
+static void
+lru_unlink(Entry e) {
+    if (NULL == e->newer) {
+	cache.newest = e->older;
+    } else {
+	e->newer->older = e->older;
+    }
+    if (NULL == e->older) {
+	cache.oldest = e->newer;
+    } else {
+	e->older->newer = e->newer;
+    }
+}
+
+static void
+lru_push(Entry e) {
+    e->newer = NULL;
+    e->older = cache.newest;
+    if (NULL == cache.newest) {
+	cache.oldest = e;
+    } else {
+	cache.newest->newer = e;
+    }
+    cache.newest = e;
+}
+
+// Removes the entry. The document lives on until the last request using
+// it is done.
+static void
+entry_remove(Entry e) {
+    Entry	*bp = get_bucketp(e->hash);
+
+    for (; NULL != *bp; bp = &(*bp)->next) {
+	if (e == *bp) {
+	    *bp = e->next;
+	    break;
+	}
+    }
+    lru_unlink(e);
+    cache.cnt--;
+    gql_doc_release(e->doc);
+    AGOO_FREE(e);
+}
+
+// Must be called with the lock held.
+static gqlDoc
+cache_get(const uint8_t *hash) {
+    Entry	e;
+
+    for (e = *get_bucketp(hash); NULL != e; e = e->next) {
+	if (0 == memcmp(hash, e->hash, SHA256_DIGEST_SIZE)) {
+	    lru_unlink(e);
+	    lru_push(e);
+	    atomic_fetch_add(&e->doc->ref_cnt, 1);
+
+	    return e->doc;
+	}
+    }
+    return NULL;
+}
+
+// Must be called with the lock held. If another thread cached the same
+// query first that one is kept.
+static void
+cache_set(const uint8_t *hash, gqlDoc doc) {
+    Entry	*bp = get_bucketp(hash);
+    Entry	e;
+
+    for (e = *bp; NULL != e; e = e->next) {
+	if (0 == memcmp(hash, e->hash, SHA256_DIGEST_SIZE)) {
+	    return;
+	}
+    }
+    if (NULL == (e = (Entry)AGOO_MALLOC(sizeof(struct _entry)))) {
+	return;
+    }
+    memcpy(e->hash, hash, SHA256_DIGEST_SIZE);
+    e->doc = doc;
+    atomic_fetch_add(&doc->ref_cnt, 1);
+    e->next = *bp;
+    *bp = e;
+    lru_push(e);
+    cache.cnt++;
+    while (cache.max < cache.cnt) {
+	entry_remove(cache.oldest);
+    }
+}
+
+static int
+read_hex(agooErr err, const char *hex, int len, uint8_t *hash) {
+    const char	*end = hex + len;
+    int		i = 0;
+    uint8_t	b;
+    char	c;
+
+    if (SHA256_DIGEST_SIZE * 2 != len) {
+	return agoo_err_set(err, AGOO_ERR_ARG, "persisted query hash must be a hex encoded SHA-256");
+    }
+    for (; hex < end; hex++, i++) {
+	c = *hex;
+	if ('0' <= c && c <= '9') {
+	    b = (uint8_t)(c - '0');
+	} else if ('a' <= c && c <= 'f') {
+	    b = (uint8_t)(c - 'a' + 10);
+	} else if ('A' <= c && c <= 'F') {
+	    b = (uint8_t)(c - 'A' + 10);
+	} else {
+	    return agoo_err_set(err, AGOO_ERR_ARG, "persisted query hash must be a hex encoded SHA-256");
+	}
+	if (0 == (i & 1)) {
+	    hash[i / 2] = (uint8_t)(b << 4);
+	} else {
+	    hash[i / 2] |= b;
+	}
+    }
+    return AGOO_ERR_OK;
+}
+
+void
+gql_cache_set_max(int max) {
+    pthread_mutex_lock(&cache.lock);
+    cache.max = max;
+    while (cache.max < cache.cnt) {
+	entry_remove(cache.oldest);
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+void
+gql_cache_clear(void) {
+    pthread_mutex_lock(&cache.lock);
+    while (NULL != cache.oldest) {
+	entry_remove(cache.oldest);
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// Returns a document for the query, or for the hash if the query is NULL,
+// with the variables attached. The variables belong to the returned
+// document, or are freed on error. If only a hash is given and it is not
+// in the cache the error message is PersistedQueryNotFound as expected by
+// clients that then send the full query along with the hash.
+gqlDoc
+gql_cache_doc(agooErr err, const char *query, int qlen, const char *hash, int hlen, gqlVar vars, gqlOpKind default_kind) {
+    uint8_t	digest[SHA256_DIGEST_SIZE];
+    uint8_t	qd[SHA256_DIGEST_SIZE];
+    gqlDoc	doc;
+    gqlDoc	base = NULL;
+    gqlVar	v;
+    gqlVar	rv;
+    bool	shared = 0 < cache.max && GQL_QUERY == default_kind;
+
+    if (NULL == (doc = gql_doc_create(err))) {
+	return NULL;
+    }
+    doc->vars = vars;
+    if (NULL != hash && AGOO_ERR_OK != read_hex(err, hash, hlen, digest)) {
+	goto ERROR;
+    }
+    if (NULL != query) {
+	sha256((const uint8_t*)query, (size_t)qlen, qd);
+	if (NULL != hash && 0 != memcmp(qd, digest, sizeof(digest))) {
+	    agoo_err_set(err, AGOO_ERR_ARG, "provided sha does not match query");
+	    goto ERROR;
+	}
+	memcpy(digest, qd, sizeof(digest));
+    } else if (NULL == hash) {
+	agoo_err_set(err, AGOO_ERR_ARG, "a query is required");
+	goto ERROR;
+    }
+    if (shared) {
+	pthread_mutex_lock(&cache.lock);
+	base = cache_get(digest);
+	pthread_mutex_unlock(&cache.lock);
+    }
+    if (NULL == base) {
+	if (NULL == query) {
+	    agoo_err_set(err, AGOO_ERR_NOT_FOUND, "PersistedQueryNotFound");
+	    goto ERROR;
+	}
+	// Parsed outside the lock since parsing can take a while.
+	if (NULL == (base = sdl_parse_doc(err, query, qlen, NULL, default_kind))) {
+	    goto ERROR;
+	}
+	if (shared) {
+	    pthread_mutex_lock(&cache.lock);
+	    cache_set(digest, base);
+	    pthread_mutex_unlock(&cache.lock);
+	}
+    }
+    doc->base = base;
+    doc->ops = base->ops;
+    doc->frags = base->frags;
+
+    // Variables the operations use without declaring them must be provided.
+    for (v = base->vars; NULL != v; v = v->next) {
+	for (rv = vars; NULL != rv; rv = rv->next) {
+	    if (0 == strcmp(v->name, rv->name)) {
+		break;
+	    }
+	}
+	if (NULL == rv) {
+	    agoo_err_set(err, AGOO_ERR_EVAL, "variable $%s not defined for operation or document", v->name);
+	    goto ERROR;
+	}
+    }
+    return doc;
+
+ERROR:
+    gql_doc_destroy(doc);
+
+    return NULL;
+}
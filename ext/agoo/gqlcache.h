@@ -0,0 +1,23 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#ifndef AGOO_GQLCACHE_H
+#define AGOO_GQLCACHE_H
+
+#include <stdbool.h>
+
+#include "err.h"
+#include "graphql.h"
+
+#define GQL_CACHE_DEFAULT_MAX	256
+
+// Parsed and validated documents are kept in a least recently used cache
+// keyed by the SHA-256 of the query text. Each request gets a light
+// document that shares the operations and fragments of the cached one and
+// holds its own variables. The same hash identifies Automatic Persisted
+// Queries so clients can send the hash in place of a known query.
+
+extern void	gql_cache_set_max(int max);
+extern gqlDoc	gql_cache_doc(agooErr err, const char *query, int qlen, const char *hash, int hlen, gqlVar vars, gqlOpKind default_kind);
+extern void	gql_cache_clear(void);
+
+#endif // AGOO_GQLCACHE_H
@@ -1,5 +1,6 @@
 // Copyright (c) 2018, Peter Ohler, All rights reserved.
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,11 +12,47 @@
 #include "graphql.h"
 
 
+static uint32_t
+method_hash(const char *key) {
+    uint32_t		h = 2166136261U;
+    const uint8_t	*k = (const uint8_t*)key;
+
+    for (; '\0' != *k; k++) {
+	h = (h ^ *k) * 16777619U;
+    }
+    return h;
+}
+
+// Builds the method table of a class. Must be called once the GraphQL type
+// for the class exists and before the class is used.
+int
+gql_cclass_index(agooErr err, gqlCclass clas) {
+    gqlCmethod	method;
+    uint32_t	i;
+    int		cnt = 0;
+
+    memset(clas->slots, 0, sizeof(clas->slots));
+    for (method = clas->methods; NULL != method->key; method++) {
+	if (GQL_CCLASS_SLOTS / 2 <= ++cnt) {
+	    return agoo_err_set(err, AGOO_ERR_TOO_MANY, "Too many methods on %s.", clas->name);
+	}
+	for (i = method_hash(method->key) & (GQL_CCLASS_SLOTS - 1); NULL != clas->slots[i]; i = (i + 1) & (GQL_CCLASS_SLOTS - 1)) {
+	}
+	clas->slots[i] = method;
+    }
+    clas->type = gql_type_get(clas->name);
+
+    return AGOO_ERR_OK;
+}
+
 gqlType
 gql_cobj_ref_type(gqlRef ref) {
     gqlCobj	obj = (gqlCobj)ref;
 
     if (NULL != obj && NULL != obj->clas) {
+	if (NULL != obj->clas->type) {
+	    return obj->clas->type;
+	}
 	return gql_type_get(obj->clas->name);
     }
     return NULL;
@@ -25,8 +62,9 @@ int
 gql_cobj_resolve(agooErr err, gqlDoc doc, gqlRef target, gqlField field, gqlSel sel, gqlValue result, int depth) {
     gqlCobj	obj = (gqlCobj)target;
     gqlCmethod	method;
+    uint32_t	i = method_hash(sel->name) & (GQL_CCLASS_SLOTS - 1);
 
-    for (method = obj->clas->methods; NULL != method->key; method++) {
+    for (; NULL != (method = obj->clas->slots[i]); i = (i + 1) & (GQL_CCLASS_SLOTS - 1)) {
 	if (0 == strcmp(method->key, sel->name)) {
 	    return method->func(err, doc, obj, field, sel, result, depth);
 	}
@@ -17,9 +17,14 @@ typedef struct _gqlCmethod {
     int			(*func)(agooErr err, struct _gqlDoc *doc, struct _gqlCobj *obj, struct _gqlField *field, struct _gqlSel *sel, struct _gqlValue *result, int depth);
 } *gqlCmethod;
 
+#define GQL_CCLASS_SLOTS	32
+
 typedef struct _gqlCclass {
     const char		*name;
-    gqlCmethod		methods; // TBD use a hash instead of a simple array
+    gqlCmethod		methods;
+    // Set by gql_cclass_index().
+    struct _gqlType	*type;
+    gqlCmethod		slots[GQL_CCLASS_SLOTS];
 } *gqlCclass;
 
 typedef struct _gqlCobj {
@@ -27,6 +32,7 @@ typedef struct _gqlCobj {
     void		*ptr;
 } *gqlCobj;
 
+extern int		gql_cclass_index(agooErr err, gqlCclass clas);
 extern struct _gqlType*	gql_cobj_ref_type(gqlRef ref);
 extern int		gql_cobj_resolve(agooErr		err,
 					 struct _gqlDoc		*doc,
@@ -0,0 +1,167 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#include <limits.h>
+#include <string.h>
+
+#include "gqlcost.h"
+#include "gqleval.h"
+#include "gqlvalue.h"
+#include "log.h"
+
+long	gql_max_cost = 0;
+
+static bool
+int_value(gqlValue value, long *ip) {
+    if (NULL != value) {
+	if (&gql_int_type == value->type) {
+	    *ip = (long)value->i;
+	    return true;
+	}
+	if (&gql_i64_type == value->type) {
+	    *ip = (long)value->i64;
+	    return true;
+	}
+    }
+    return false;
+}
+
+static bool
+is_size_arg(const char *name) {
+    return 0 == strcmp("first", name) || 0 == strcmp("last", name) || 0 == strcmp("limit", name);
+}
+
+static gqlValue
+cost_arg(gqlField field, const char *key) {
+    gqlDirUse	use;
+    gqlLink	a;
+
+    if (NULL == field) {
+	return NULL;
+    }
+    for (use = field->dir; NULL != use; use = use->next) {
+	if (NULL != use->dir && 0 == strcmp("cost", use->dir->name)) {
+	    for (a = use->args; NULL != a; a = a->next) {
+		if (0 == strcmp(key, a->key)) {
+		    return a->value;
+		}
+	    }
+	}
+    }
+    return NULL;
+}
+
+static double
+field_cost(gqlField field) {
+    long	cost;
+
+    if (int_value(cost_arg(field, "value"), &cost) && 0 <= cost) {
+	return (double)cost;
+    }
+    return 1.0;
+}
+
+// An argument in the selection wins over a default in the field definition
+// which wins over the @cost size.
+static double
+list_size(gqlDoc doc, gqlSel sel) {
+    gqlSelArg	sa;
+    gqlArg	a;
+    long	size;
+
+    for (sa = sel->args; NULL != sa; sa = sa->next) {
+	if (is_size_arg(sa->name) && int_value(gql_sel_arg_value(doc, sa), &size) && 0 <= size) {
+	    return (double)size;
+	}
+    }
+    if (NULL != sel->field) {
+	for (a = sel->field->args; NULL != a; a = a->next) {
+	    if (is_size_arg(a->name) && int_value(a->default_value, &size) && 0 <= size) {
+		return (double)size;
+	    }
+	}
+    }
+    if (int_value(cost_arg(sel->field, "size"), &size) && 0 <= size) {
+	return (double)size;
+    }
+    return (double)GQL_COST_LIST_SIZE;
+}
+
+// A double is used so nested lists can not overflow. The walk stops once
+// the cost is over the max so fragments spread many times over can not
+// make the check itself expensive.
+static double
+sels_cost(gqlDoc doc, gqlSel sels, double mult, double cost, double max, int depth) {
+    gqlSel	sel;
+    gqlFrag	frag;
+    gqlType	type;
+    double	size;
+    bool	outer;
+
+    if (GQL_MAX_DEPTH < depth) { // reported when evaluated
+	return cost;
+    }
+    for (sel = sels; NULL != sel && (0.0 >= max || cost <= max); sel = sel->next) {
+	if (NULL == sel->name) {
+	    if (NULL != sel->inline_frag) {
+		cost = sels_cost(doc, sel->inline_frag->sels, mult, cost, max, depth + 1);
+	    } else if (NULL != sel->frag && NULL != (frag = gql_sel_frag(doc, sel))) {
+		cost = sels_cost(doc, frag->sels, mult, cost, max, depth + 1);
+	    }
+	    continue;
+	}
+	if ('_' == *sel->name && '_' == sel->name[1]) {
+	    // Introspection results are bounded by the schema and cached.
+	    cost += mult;
+	    continue;
+	}
+	cost += mult * field_cost(sel->field);
+	if (NULL == sel->sels) {
+	    continue;
+	}
+	size = 1.0;
+	outer = true;
+	for (type = sel->type; NULL != type; type = type->base) {
+	    if (GQL_LIST == type->kind) {
+		// Hints only apply to the outer list.
+		size *= outer ? list_size(doc, sel) : (double)GQL_COST_LIST_SIZE;
+		outer = false;
+	    } else if (GQL_NON_NULL != type->kind) {
+		break;
+	    }
+	}
+	cost = sels_cost(doc, sel->sels, mult * size, cost, max, depth + 1);
+    }
+    return cost;
+}
+
+// Returns the cost of the operation. If max is greater than zero the
+// returned cost may be short of the full cost once it is over max.
+long
+gql_op_cost(gqlDoc doc, gqlOp op, long max) {
+    double	cost = sels_cost(doc, op->sels, 1.0, 0.0, (double)max, 0);
+
+    if ((double)LONG_MAX <= cost) {
+	return LONG_MAX;
+    }
+    return (long)cost;
+}
+
+// Sets the cost of the operation about to be evaluated and fails if it is
+// over gql_max_cost. The cost is only worked out if there is a limit or
+// debug logging is on.
+int
+gql_doc_cost_check(agooErr err, gqlDoc doc) {
+    if (NULL == doc->op || (0 >= gql_max_cost && !agoo_debug_cat.on)) {
+	return AGOO_ERR_OK;
+    }
+    doc->cost = gql_op_cost(doc, doc->op, gql_max_cost);
+    if (NULL == doc->op->name) {
+	agoo_log_cat(&agoo_debug_cat, "GraphQL operation cost %ld.", doc->cost);
+    } else {
+	agoo_log_cat(&agoo_debug_cat, "GraphQL operation %s cost %ld.", doc->op->name, doc->cost);
+    }
+    if (0 < gql_max_cost && gql_max_cost < doc->cost) {
+	return agoo_err_set(err, AGOO_ERR_EVAL, "Query cost exceeds the maximum of %ld.", gql_max_cost);
+    }
+    return AGOO_ERR_OK;
+}
@@ -0,0 +1,26 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#ifndef AGOO_GQLCOST_H
+#define AGOO_GQLCOST_H
+
+#include "err.h"
+#include "graphql.h"
+
+#define GQL_COST_LIST_SIZE	10
+
+// The cost of an operation is an estimate of the number of fields that will
+// be resolved, worked out from the validated document before anything is
+// resolved. Each field costs 1 or the value of a @cost(value: Int) directive
+// on the field definition. Fields under a list are multiplied by the size
+// of the list, which is the first, last, or limit argument if there is one,
+// the size argument of @cost, or GQL_COST_LIST_SIZE. The @cost directive is
+// not built in so it must be declared in the schema as:
+//
+//   directive @cost(value: Int, size: Int) on FIELD_DEFINITION
+
+extern long	gql_max_cost; // 0 for no limit
+
+extern long	gql_op_cost(gqlDoc doc, gqlOp op, long max);
+extern int	gql_doc_cost_check(agooErr err, gqlDoc doc);
+
+#endif // AGOO_GQLCOST_H
@@ -4,6 +4,9 @@
 #include <string.h>
 
 #include "debug.h"
+#include "gqlarena.h"
+#include "gqlcache.h"
+#include "gqlcost.h"
 #include "gqleval.h"
 #include "gqlintro.h"
 #include "gqljson.h"
@@ -21,7 +24,6 @@
 #include "websocket.h"
 
 #define MAX_RESOLVE_ARGS	16
-#define MAX_DEPTH		100
 
 gqlRef		gql_root = NULL;
 gqlType		_gql_root_type = NULL;
@@ -29,6 +31,7 @@ gqlResolveFunc	gql_resolve_func = NULL;
 gqlTypeFunc	gql_type_func = NULL;
 gqlRef		(*gql_root_op)(const char *op) = NULL;
 
+static const char	extensions_str[] = "extensions";
 static const char	graphql_content_type[] = "application/graphql";
 static const char	indent_str[] = "indent";
 static const char	json_content_type[] = "application/json";
@@ -64,6 +67,130 @@ err_resp(agooRes res, agooErr err, int status) {
 
 static char	ws_up[] = "HTTP/1.1 101 Switching Protocols\r\n";
 
+// Large results are written in segments of about this size.
+#define SEGMENT_SIZE	(64 * 1024)
+// Room for the Content-Length value, filled in once the body is written.
+#define CLEN_WIDTH	20
+// A chunk size is written as 8 hex digits and a CRLF.
+#define CHUNK_PREFIX	10
+
+static const char	clen_field[] = "Content-Length: ";
+static const char	chunked_field[] = "Transfer-Encoding: chunked";
+static const char	last_chunk[] = "0\r\n\r\n";
+
+bool	gql_chunked = false;
+bool	gql_parallel = false;
+
+typedef struct _stream {
+    struct _gqlWriter	w;
+    agooRes		res;
+    agooText		head;  // first segment with the headers once flushed
+    agooText		tail;  // last segment held until the length is known
+    long		body;  // offset of the body in the first segment
+    long		clen;  // offset of the Content-Length value
+    long		len;   // body bytes in held segments
+    bool		chunked;
+} *Stream;
+
+static agooText
+chunk_close(agooText text, long start) {
+    char	prefix[32];
+
+    snprintf(prefix, sizeof(prefix), "%08lx\r\n", text->len - start - CHUNK_PREFIX);
+    memcpy(text->text + start, prefix, CHUNK_PREFIX);
+
+    return agoo_text_append(text, "\r\n", 2);
+}
+
+// Called as the JSON text grows. With chunked transfers each full segment
+// is sent as a chunk while the rest is written, otherwise the segments are
+// held in order until the Content-Length is known. Either way the body is
+// never moved to make room for the headers.
+static agooText
+stream_flush(gqlWriter w, agooText text) {
+    Stream	s = (Stream)w;
+    agooText	next;
+    long	start = 0;
+
+    if (NULL == (next = agoo_text_allocate(SEGMENT_SIZE + CHUNK_PREFIX + 2))) {
+	agoo_text_release(text);
+	return NULL;
+    }
+    if (gql_chunked) {
+	if (!s->chunked) {
+	    char	*f = text->text + s->clen - (sizeof(clen_field) - 1);
+
+	    // The Content-Length field is replaced in place, padded with spaces.
+	    memset(f, ' ', sizeof(clen_field) - 1 + CLEN_WIDTH);
+	    memcpy(f, chunked_field, sizeof(chunked_field) - 1);
+	    if (NULL == (text = agoo_text_append(text, "          ", CHUNK_PREFIX))) {
+		agoo_text_release(next);
+		return NULL;
+	    }
+	    memmove(text->text + s->body + CHUNK_PREFIX, text->text + s->body, text->len - s->body - CHUNK_PREFIX);
+	    start = s->body;
+	    s->chunked = true;
+	}
+	if (NULL == (text = chunk_close(text, start))) {
+	    agoo_text_release(next);
+	    return NULL;
+	}
+	agoo_res_message_add(s->res, text);
+	next->len = CHUNK_PREFIX;
+    } else {
+	// The first segment may have moved as it grew.
+	if (NULL == s->head) {
+	    s->head = text;
+	    start = s->body;
+	} else {
+	    s->tail->next = text;
+	}
+	s->tail = text;
+	s->len += text->len - start;
+    }
+    return next;
+}
+
+// Sends the headers and body held by the stream.
+static void
+stream_finish(Stream s, agooText text) {
+    agooText	t;
+    agooText	next;
+
+    if (s->chunked) {
+	if (CHUNK_PREFIX < text->len) {
+	    text = chunk_close(text, 0);
+	} else {
+	    text->len = 0;
+	}
+	if (NULL == (text = agoo_text_append(text, last_chunk, sizeof(last_chunk) - 1))) {
+	    agoo_log_cat(&agoo_error_cat, "Failed to allocate memory for a response.");
+	    s->res->close = true;
+	}
+	agoo_res_message_push(s->res, text);
+	return;
+    }
+    if (NULL == s->head) {
+	s->head = text;
+	s->len = text->len - s->body;
+    } else {
+	s->len += text->len;
+	s->tail->next = text;
+    }
+    {
+	char	num[CLEN_WIDTH + 1];
+	int	cnt = snprintf(num, sizeof(num), "%ld", s->len);
+
+	memcpy(s->head->text + s->clen, num, cnt);
+    }
+    for (t = s->head; t != text; t = next) {
+	next = t->next;
+	t->next = NULL;
+	agoo_res_message_add(s->res, t);
+    }
+    agoo_res_message_push(s->res, text);
+}
+
 static void
 value_resp(agooReq req, gqlValue result, int status, int indent) {
     agooRes		res = req->res;
@@ -72,6 +199,7 @@ value_resp(agooReq req, gqlValue result, int status, int indent) {
     int			cnt;
     agooText		text = agoo_text_allocate(4094);
     gqlValue		msg = gql_object_create(&err);
+    struct _stream	s;
 
     if (NULL == msg) {
 	AGOO_ERR_MEM(&err, "response");
@@ -104,43 +232,41 @@ value_resp(agooReq req, gqlValue result, int status, int indent) {
     if (AGOO_ERR_OK != gql_object_set(&err, msg, "data", result)) {
 	goto FAILED;
     }
-    text = gql_value_json(text, msg, indent, 0);
-    gql_value_destroy(msg); // also destroys result
     result = NULL;
 
-    cnt = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %ld\r\n\r\n",
-		   status, agoo_http_code_message(status), text->len);
-    if (NULL != gql_headers || NULL != gql_build_headers) {
-	agooText	headers = agoo_text_allocate(4094);
-
-	headers = agoo_text_append(headers, buf, cnt - 2);
-	if (NULL == headers) {
-	    agoo_log_cat(&agoo_error_cat, "Failed to allocate memory for a response.");
-	    return;
-	}
+    // The headers go first with room left for the Content-Length.
+    cnt = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n%s%*s\r\n",
+		   status, agoo_http_code_message(status), clen_field, CLEN_WIDTH, "");
+    text = agoo_text_append(text, buf, cnt);
+    if (NULL != text && (NULL != gql_headers || NULL != gql_build_headers)) {
 	if (NULL != gql_headers) {
-	    headers = agoo_text_append(headers, gql_headers->text, (int)gql_headers->len);
+	    text = agoo_text_append(text, gql_headers->text, (int)gql_headers->len);
 	} else {
-	    headers = gql_build_headers(&err, req, headers);
-	}
-	headers = agoo_text_append(headers, "\r\n", 2);
-	if (NULL == headers) {
-	    agoo_log_cat(&agoo_error_cat, "Failed to allocate memory for a response.");
-	    return;
-	}
-	if (NULL == (text = agoo_text_prepend(text, headers->text, (int)headers->len))) {
-	    agoo_log_cat(&agoo_error_cat, "Failed to allocate memory for a response.");
-	    agoo_text_release(headers);
-	    return;
-	}
-	agoo_text_release(headers);
-    } else {
-	if (NULL == (text = agoo_text_prepend(text, buf, cnt))) {
-	    agoo_log_cat(&agoo_error_cat, "Failed to allocate memory for a response.");
-	    return;
+	    text = gql_build_headers(&err, req, text);
 	}
     }
-    agoo_res_message_push(res, text);
+    if (NULL == (text = agoo_text_append(text, "\r\n", 2))) {
+	agoo_log_cat(&agoo_error_cat, "Failed to allocate memory for a response.");
+	gql_value_destroy(msg);
+	return;
+    }
+    memset(&s, 0, sizeof(s));
+    s.w.max = SEGMENT_SIZE;
+    s.w.flush = stream_flush;
+    s.res = res;
+    s.body = text->len;
+    s.clen = cnt - CLEN_WIDTH - 2;
+
+    text = gql_value_json_write(&s.w, text, msg, indent, 0);
+    gql_value_destroy(msg); // also destroys result
+
+    if (NULL == text) {
+	agoo_log_cat(&agoo_error_cat, "Failed to allocate memory for a response.");
+	res->close = true;
+	agoo_res_message_push(res, NULL);
+	return;
+    }
+    stream_finish(&s, text);
 
     return;
 
@@ -185,8 +311,26 @@ doc_var_value(gqlDoc doc, const char *key) {
     return NULL;
 }
 
-static bool
-frag_include(gqlDoc doc, gqlFrag frag, gqlRef ref) {
+// Returns the value of a selection argument. Variables are looked up by
+// name in the request variables first so a cached document can be shared
+// by requests with different variables.
+gqlValue
+gql_sel_arg_value(gqlDoc doc, gqlSelArg sa) {
+    gqlVar	var;
+
+    if (NULL == sa->var) {
+	return sa->value;
+    }
+    for (var = doc->vars; NULL != var; var = var->next) {
+	if (0 == strcmp(sa->var->name, var->name)) {
+	    return var->value;
+	}
+    }
+    return sa->var->value;
+}
+
+bool
+gql_frag_include(gqlDoc doc, gqlFrag frag, gqlRef ref) {
     gqlDirUse	dir;
 
     if (NULL != frag->on) {
@@ -269,42 +413,63 @@ gql_set_typename(agooErr err, gqlType type, const char *key, gqlValue result) {
     return AGOO_ERR_OK;
 }
 
+// Returns the field for a selection. Validation sets the field on the
+// selection so the parent field is only used for selections that were not
+// validated.
+gqlField
+gql_sel_field(gqlField field, gqlSel sel) {
+    if (NULL == sel->name) {
+	return field;
+    }
+    if (NULL != sel->field) {
+	return sel->field;
+    }
+    if (NULL != field) {
+	return gql_type_get_field(field->type, sel->name);
+    }
+    return NULL;
+}
+
+// Returns the fragment named by a fragment spread selection.
+gqlFrag
+gql_sel_frag(gqlDoc doc, gqlSel sel) {
+    gqlFrag	frag;
+
+    if (NULL != sel->spread) {
+	return sel->spread;
+    }
+    for (frag = doc->frags; NULL != frag; frag = frag->next) {
+	if (NULL != frag->name && 0 == strcmp(frag->name, sel->frag)) {
+	    break;
+	}
+    }
+    return frag;
+}
+
 int
 gql_eval_sels(agooErr err, gqlDoc doc, gqlRef ref, gqlField field, gqlSel sels, gqlValue result, int depth) {
     gqlSel	sel;
     gqlField	sf = NULL;
 
-    if (MAX_DEPTH < depth) {
-	return agoo_err_set(err, AGOO_ERR_EVAL, "Maximum resolve depth of %d exceeded.", MAX_DEPTH);
+    if (GQL_MAX_DEPTH < depth) {
+	return agoo_err_set(err, AGOO_ERR_EVAL, "Maximum resolve depth of %d exceeded.", GQL_MAX_DEPTH);
     }
     depth++;
 
     for (sel = sels; NULL != sel; sel = sel->next) {
-	if (NULL != field) {
-	    if (NULL == sel->name) {
-		sf = field;
-	    } else {
-		sf = gql_type_get_field(field->type, sel->name);
-	    }
-	} else {
-	    sf = NULL;
-	}
+	sf = gql_sel_field(field, sel);
 	if (NULL != sel->inline_frag) {
-	    if (frag_include(doc, sel->inline_frag, ref)) {
+	    if (gql_frag_include(doc, sel->inline_frag, ref)) {
 		if (AGOO_ERR_OK != gql_eval_sels(err, doc, ref, sf, sel->inline_frag->sels, result, depth)) {
 		    return err->code;
 		}
 	    }
 	} else if (NULL != sel->frag) {
-	    gqlFrag	frag;
+	    gqlFrag	frag = gql_sel_frag(doc, sel);
 
-	    for (frag = doc->frags; NULL != frag; frag = frag->next) {
-		if (NULL != frag->name && 0 == strcmp(frag->name, sel->frag)) {
-		    if (frag_include(doc, frag, ref)) {
-			if (AGOO_ERR_OK != gql_eval_sels(err, doc, ref, sf, frag->sels, result, depth)) {
-			    return err->code;
-			}
-		    }
+	    if (NULL != frag && gql_frag_include(doc, frag, ref)) {
+		if (AGOO_ERR_OK != gql_eval_sels(err, doc, ref, sf, frag->sels, result, depth)) {
+		    return err->code;
 		}
 	    }
 	} else {
@@ -411,13 +576,14 @@ DONE:
     return vars;
 }
 
-static void
-set_doc_op(gqlDoc doc, const char *op_name, int oplen) {
+static int
+set_doc_op(agooErr err, gqlDoc doc, const char *op_name) {
+    gqlVar	var;
+    gqlVar	rv;
+
     if (NULL != op_name) {
 	gqlOp	op;
 
-	// This null terminates the string.
-	agoo_req_query_decode((char*)op_name, oplen);
 	for (op = doc->ops; NULL != op; op = op->next) {
 	    if (NULL != op->name && 0 == strcmp(op_name, op->name)) {
 		doc->op = op;
@@ -427,6 +593,62 @@ set_doc_op(gqlDoc doc, const char *op_name, int oplen) {
     } else {
 	doc->op = doc->ops;
     }
+    if (NULL == doc->op) {
+	return AGOO_ERR_OK;
+    }
+    // A non-null variable without a default must be provided.
+    for (var = doc->op->vars; NULL != var; var = var->next) {
+	if (NULL != var->value || NULL == var->type || GQL_NON_NULL != var->type->kind) {
+	    continue;
+	}
+	for (rv = doc->vars; NULL != rv; rv = rv->next) {
+	    if (0 == strcmp(var->name, rv->name)) {
+		break;
+	    }
+	}
+	if (NULL == rv || NULL == rv->value || &gql_null_type == rv->value->type) {
+	    return agoo_err_set(err, AGOO_ERR_EVAL, "variable $%s not defined for operation or document", var->name);
+	}
+    }
+    return AGOO_ERR_OK;
+}
+
+// Subscriptions keep the document and evaluate it as a query on each
+// publish so the operation is copied to leave a cached one as is.
+static int
+sub_op(agooErr err, gqlDoc doc) {
+    gqlOp	op;
+
+    if (NULL == (op = (gqlOp)AGOO_MALLOC(sizeof(struct _gqlOp)))) {
+	return AGOO_ERR_MEM(err, "GraphQL Operation");
+    }
+    *op = *doc->op;
+    op->next = NULL;
+    op->kind = GQL_QUERY;
+    doc->ops = op;
+    doc->op = op;
+
+    return AGOO_ERR_OK;
+}
+
+// Returns the sha256Hash of an Automatic Persisted Query or NULL.
+static const char*
+persisted_hash(agooErr err, gqlValue ext, int *lenp) {
+    gqlValue	pq;
+    gqlValue	h;
+    const char	*hash;
+
+    if (NULL == ext || GQL_SCALAR_OBJECT != ext->type->scalar_kind ||
+	NULL == (pq = gql_object_get(ext, "persistedQuery"))) {
+	return NULL;
+    }
+    if (NULL == (h = gql_object_get(pq, "sha256Hash")) || NULL == (hash = gql_string_get(h))) {
+	agoo_err_set(err, AGOO_ERR_ARG, "persistedQuery must have a sha256Hash");
+	return NULL;
+    }
+    *lenp = (int)strlen(hash);
+
+    return hash;
 }
 
 void
@@ -435,41 +657,77 @@ gql_eval_get_hook(agooReq req) {
     const char		*gq; // graphql query
     const char		*op_name = NULL;
     const char		*var_json = NULL;
-    int			qlen;
+    const char		*ext_json = NULL;
+    const char		*hash = NULL;
+    int			qlen = 0;
     int			oplen;
     int			vlen;
+    int			elen;
+    int			hlen = 0;
     int			indent = 0;
     gqlDoc		doc;
     gqlValue		result;
+    gqlValue		ext = NULL;
     gqlVar		vars = NULL;
+    gqlArena		arena;
     gqlOpKind		default_kind = GQL_QUERY;
 
     if (NULL != (gq = agoo_req_query_value(req, indent_str, sizeof(indent_str) - 1, &qlen))) {
 	indent = (int)strtol(gq, NULL, 10);
     }
+    ext_json = agoo_req_query_value(req, extensions_str, sizeof(extensions_str) - 1, &elen);
     if (NULL == (gq = agoo_req_query_value(req, query_str, sizeof(query_str) - 1, &qlen))) {
-	if (NULL == (gq = agoo_req_query_value(req, subscription_str, sizeof(subscription_str) - 1, &qlen))) {
+	if (NULL != (gq = agoo_req_query_value(req, subscription_str, sizeof(subscription_str) - 1, &qlen))) {
+	    default_kind = GQL_SUBSCRIPTION;
+	} else if (NULL == ext_json) {
 	    err_resp(req->res, &err, 500);
 	    return;
 	}
-	default_kind = GQL_SUBSCRIPTION;
     }
     op_name = agoo_req_query_value(req, operation_name_str, sizeof(operation_name_str) - 1, &oplen);
     var_json = agoo_req_query_value(req, variables_str, sizeof(variables_str) - 1, &vlen);
 
+    if (NULL == (arena = gql_arena_create(&err))) {
+	err_resp(req->res, &err, 500);
+	return;
+    }
+    gql_arena_use(arena);
+
+    // Decoding terminates the strings with a \0 so all values are found first.
+    if (NULL != ext_json) {
+	elen = agoo_req_query_decode((char*)ext_json, elen);
+	if (NULL == (ext = gql_json_parse(&err, ext_json, elen)) ||
+	    (NULL == (hash = persisted_hash(&err, ext, &hlen)) && AGOO_ERR_OK != err.code)) {
+	    gql_arena_destroy(arena);
+	    err_resp(req->res, &err, 400);
+	    return;
+	}
+    }
     if (NULL != var_json) {
 	if (NULL == (vars = parse_query_vars(&err, var_json, vlen)) && AGOO_ERR_OK != err.code) {
+	    gql_arena_destroy(arena);
 	    err_resp(req->res, &err, 400);
 	    return;
 	}
     }
-    // Only call after extracting the variables as it terminates the string with a \0.
-    qlen = agoo_req_query_decode((char*)gq, qlen);
-    if (NULL == (doc = sdl_parse_doc(&err, gq, qlen, vars, default_kind))) {
-	err_resp(req->res, &err, 500);
+    if (NULL != op_name) {
+	agoo_req_query_decode((char*)op_name, oplen);
+    }
+    if (NULL != gq) {
+	qlen = agoo_req_query_decode((char*)gq, qlen);
+    }
+    if (NULL == (doc = gql_cache_doc(&err, gq, qlen, hash, hlen, vars, default_kind))) {
+	gql_arena_destroy(arena);
+	err_resp(req->res, &err, AGOO_ERR_NOT_FOUND == err.code ? 200 : 500);
+	return;
+    }
+    doc->arena = arena;
+    if (AGOO_ERR_OK != set_doc_op(&err, doc, op_name) ||
+	AGOO_ERR_OK != gql_doc_cost_check(&err, doc)) {
+	gql_doc_destroy(doc);
+	err_resp(req->res, &err, 400);
 	return;
     }
-    set_doc_op(doc, op_name, oplen);
     doc->req = req;
 
     if (NULL == gql_doc_eval_func) {
@@ -519,51 +777,69 @@ gql_eval_get_hook(agooReq req) {
 	if (AGOO_CON_WS == req->res->con_kind) {
 	    status = 101;
 	}
-	doc->op->kind = GQL_QUERY; // need so eval does the right thing
-	if (NULL == (sub = gql_sub_create(&err, req->res->con, subject, doc))) {
+	// Need the op to be a query so eval does the right thing.
+	if (AGOO_ERR_OK != sub_op(&err, doc) ||
+	    NULL == (sub = gql_sub_create(&err, req->res->con, subject, doc))) {
+	    gql_doc_destroy(doc);
 	    err_resp(req->res, &err, 400);
 	    return;
 	}
+	// The subscription keeps the document and the arena with it.
+	gql_arena_use(NULL);
 	agoo_server_add_gsub(sub);
 
 	value_resp(req, NULL, status, indent);
 
 	return;
     }
-    gql_doc_destroy(doc);
+    gql_arena_use(NULL);
     value_resp(req, result, 200, indent);
+    gql_doc_destroy(doc);
 }
 
+// The document is returned as well since the result is in its arena.
 static gqlValue
-eval_post(agooErr err, agooReq req) {
+eval_post(agooErr err, agooReq req, gqlDoc *docp) {
     gqlDoc		doc = NULL;
     const char		*op_name = NULL;
     const char		*var_json = NULL;
     const char		*query = NULL;
+    const char		*hash = NULL;
     int			oplen;
     int			vlen;
     int			qlen = 0;
+    int			hlen = 0;
     gqlVar		vars = NULL;
     const char		*s;
     int			len;
     gqlValue		result = NULL;
     gqlValue		j = NULL;
+    gqlArena		arena;
 
     op_name = agoo_req_query_value(req, operation_name_str, sizeof(operation_name_str) - 1, &oplen);
     var_json = agoo_req_query_value(req, variables_str, sizeof(variables_str) - 1, &vlen);
 
+    if (NULL == (arena = gql_arena_create(err))) {
+	return NULL;
+    }
+    gql_arena_use(arena);
     if (NULL != var_json) {
 	if (NULL == (vars = parse_query_vars(err, var_json, vlen)) && AGOO_ERR_OK != err->code) {
-	    return NULL;
+	    goto DONE;
 	}
     }
     if (NULL == (s = agoo_req_header_value(req, "Content-Type", &len))) {
 	agoo_err_set(err, AGOO_ERR_TYPE, "required Content-Type not in the HTTP header");
-	return NULL;
+	goto DONE;
+    }
+    if (NULL != op_name) {
+	agoo_req_query_decode((char*)op_name, oplen);
     }
     if (0 == strncasecmp(graphql_content_type, s, sizeof(graphql_content_type) - 1)) {
-	if (NULL == (doc = sdl_parse_doc(err, req->body.start, req->body.len, vars, GQL_QUERY))) {
-	    return NULL;
+	doc = gql_cache_doc(err, req->body.start, (int)req->body.len, NULL, 0, vars, GQL_QUERY);
+	vars = NULL;
+	if (NULL == doc) {
+	    goto DONE;
 	}
     } else if (0 == strncasecmp(json_content_type, s, sizeof(json_content_type) - 1)) {
 	gqlLink	m;
@@ -587,7 +863,10 @@ eval_post(agooErr err, agooReq req) {
 			goto DONE;
 		    }
 		    op_name = s;
-		    oplen = (int)strlen(s);
+		} else if (0 == strcmp("extensions", m->key)) {
+		    if (NULL == (hash = persisted_hash(err, m->value, &hlen)) && AGOO_ERR_OK != err->code) {
+			goto DONE;
+		    }
 		} else if (0 == strcmp("variables", m->key)) {
 		    gqlLink	link;
 
@@ -612,7 +891,9 @@ eval_post(agooErr err, agooReq req) {
 		    }
 		}
 	    }
-	    if (NULL == (doc = sdl_parse_doc(err, query, qlen, vars, GQL_QUERY))) {
+	    doc = gql_cache_doc(err, query, qlen, hash, hlen, vars, GQL_QUERY);
+	    vars = NULL;
+	    if (NULL == doc) {
 		goto DONE;
 	    }
 	} else {
@@ -620,9 +901,14 @@ eval_post(agooErr err, agooReq req) {
 	}
     } else {
 	agoo_err_set(err, AGOO_ERR_TYPE, "unsupported content type");
-	return NULL;
+	goto DONE;
+    }
+    doc->arena = arena;
+    arena = NULL;
+    if (AGOO_ERR_OK != set_doc_op(err, doc, op_name) ||
+	AGOO_ERR_OK != gql_doc_cost_check(err, doc)) {
+	goto DONE;
     }
-    set_doc_op(doc, op_name, oplen);
     doc->req = req;
 
     if (NULL == gql_doc_eval_func) {
@@ -634,10 +920,16 @@ eval_post(agooErr err, agooReq req) {
 	result = NULL;
     }
 DONE:
+    gql_arena_use(NULL);
     if (NULL != doc) {
-	gql_doc_destroy(doc);
+	if (NULL == result) {
+	    gql_doc_destroy(doc);
+	} else {
+	    *docp = doc;
+	}
     }
-    gql_value_destroy(j);
+    // Values parsed before there was a document are in the arena.
+    gql_arena_destroy(arena);
 
     return result;
 }
@@ -646,6 +938,7 @@ void
 gql_eval_post_hook(agooReq req) {
     struct _agooErr	err = AGOO_ERR_INIT;
     gqlValue		result;
+    gqlDoc		doc = NULL;
     const char		*s;
     int			len;
     int			indent = 0;
@@ -653,11 +946,13 @@ gql_eval_post_hook(agooReq req) {
     if (NULL != (s = agoo_req_query_value(req, indent_str, sizeof(indent_str) - 1, &len))) {
 	indent = (int)strtol(s, NULL, 10);
     }
-    if (NULL == (result = eval_post(&err, req)) && AGOO_ERR_OK != err.code) {
+    if (NULL == (result = eval_post(&err, req, &doc)) && AGOO_ERR_OK != err.code) {
 	int code = 400;
 
 	if (err.code < 0) {
 	    code = -err.code;
+	} else if (AGOO_ERR_NOT_FOUND == err.code) { // PersistedQueryNotFound
+	    code = 200;
 	}
 	err.code = AGOO_ERR_EVAL;
 	err_resp(req->res, &err, code);
@@ -665,6 +960,7 @@ gql_eval_post_hook(agooReq req) {
 	value_resp(req, result, 200, indent);
     } else {
 	value_resp(req, result, 200, indent);
+	gql_doc_destroy(doc);
     }
 }
 
@@ -7,6 +7,8 @@
 
 #include "err.h"
 
+#define GQL_MAX_DEPTH	100
+
 // Used for references to implemenation entities.
 typedef void*	gqlRef;
 
@@ -19,7 +21,9 @@ struct _agooReq;
 struct _agooText;
 struct _gqlDoc;
 struct _gqlField;
+struct _gqlFrag;
 struct _gqlSel;
+struct _gqlSelArg;
 struct _gqlType;
 struct _gqlValue;
 
@@ -38,7 +42,11 @@ typedef struct _gqlType*	(*gqlTypeFunc)(gqlRef ref);
 
 extern struct _gqlValue*	gql_doc_eval(agooErr err, struct _gqlDoc *doc);
 extern struct _gqlValue*	gql_get_arg_value(gqlKeyVal args, const char *key);
+extern struct _gqlValue*	gql_sel_arg_value(struct _gqlDoc *doc, struct _gqlSelArg *sa);
 extern int			gql_eval_sels(agooErr err, struct _gqlDoc *doc, gqlRef ref, struct _gqlField *field, struct _gqlSel *sels, struct _gqlValue *result, int depth);
+extern struct _gqlField*	gql_sel_field(struct _gqlField *field, struct _gqlSel *sel);
+extern struct _gqlFrag*	gql_sel_frag(struct _gqlDoc *doc, struct _gqlSel *sel);
+extern bool			gql_frag_include(struct _gqlDoc *doc, struct _gqlFrag *frag, gqlRef ref);
 extern int			gql_set_typename(agooErr err, struct _gqlType *type, const char *key, struct _gqlValue *result);
 extern struct _gqlType*		gql_root_type();
 
@@ -53,5 +61,7 @@ extern struct _gqlValue*	(*gql_doc_eval_func)(agooErr err, struct _gqlDoc *doc);
 extern struct _agooText*	(*gql_build_headers)(agooErr err, struct _agooReq *req, struct _agooText *headers);
 extern struct _agooText*	gql_add_header(agooErr err, struct _agooText *headers, const char *key, const char *value);
 extern struct _agooText*	gql_headers;
+extern bool			gql_chunked;
+extern bool			gql_parallel;
 
 #endif // AGOO_GQLEVAL_H
@@ -1,14 +1,41 @@
 // Copyright (c) 2018, Peter Ohler, All rights reserved.
 
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "debug.h"
+#include "gqlarena.h"
 #include "gqlcobj.h"
+#include "gqleval.h"
 #include "gqlintro.h"
 #include "gqlvalue.h"
 #include "graphql.h"
+#include "text.h"
+
+#define CACHE_MAX	64
+
+// Introspection results keyed by the selection that produced them. The
+// schema does not change once loaded so the same selection always gives
+// the same result until the cache is cleared by a schema change.
+typedef struct _entry {
+    struct _entry	*next;
+    uint64_t		hash;
+    char		*key;
+    gqlValue		value;
+} *Entry;
+
+static struct _cache {
+    Entry		entries;
+    int			cnt;
+    pthread_mutex_t	lock;
+} cache = {
+    .entries = NULL,
+    .cnt = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 // type __Schema {
 //   types: [__Type!]!
@@ -400,6 +427,8 @@ create_dir_deprecated(agooErr err) {
     return AGOO_ERR_OK;
 }
 
+static int	index_classes(agooErr err);
+
 int
 gql_intro_init(agooErr err) {
     if (AGOO_ERR_OK != create_type_kind_type(err) ||
@@ -412,7 +441,8 @@ gql_intro_init(agooErr err) {
 	AGOO_ERR_OK != create_schema_type(err) ||
 	AGOO_ERR_OK != create_dir_skip(err) ||
 	AGOO_ERR_OK != create_dir_include(err) ||
-	AGOO_ERR_OK != create_dir_deprecated(err)) {
+	AGOO_ERR_OK != create_dir_deprecated(err) ||
+	AGOO_ERR_OK != index_classes(err)) {
 
 	return err->code;
     }
@@ -424,7 +454,7 @@ gql_intro_init(agooErr err) {
 static struct _gqlCclass	type_class;
 
 gqlValue
-gql_extract_arg(agooErr err, gqlField field, gqlSel sel, const char *key) {
+gql_extract_arg(agooErr err, gqlDoc doc, gqlField field, gqlSel sel, const char *key) {
     if (NULL != sel->args) {
 	gqlSelArg	sa;
 	gqlValue	v = NULL;
@@ -433,11 +463,7 @@ gql_extract_arg(agooErr err, gqlField field, gqlSel sel, const char *key) {
 	    if (0 != strcmp(sa->name, key)) {
 		continue;
 	    }
-	    if (NULL != sa->var) {
-		v = sa->var->value;
-	    } else {
-		v = sa->value;
-	    }
+	    v = gql_sel_arg_value(doc, sa);
 	    if (NULL != field) {
 		gqlArg	fa;
 
@@ -948,7 +974,7 @@ type_fields(agooErr err, gqlDoc doc, gqlCobj obj, gqlField field, gqlSel sel, gq
     struct _gqlField	cf;
     struct _gqlCobj	child = { .clas = &field_class };
     int			d2 = depth + 1;
-    gqlValue		a = gql_extract_arg(err, field, sel, "includeDeprecated");
+    gqlValue		a = gql_extract_arg(err, doc, field, sel, "includeDeprecated");
     bool		inc_dep = false;
 
     if (NULL != sel->alias) {
@@ -1159,7 +1185,7 @@ type_enum_values(agooErr err, gqlDoc doc, gqlCobj obj, gqlField field, gqlSel se
     struct _gqlField	cf;
     struct _gqlCobj	child = { .clas = &enum_value_class };
     int			d2 = depth + 1;
-    gqlValue		a = gql_extract_arg(err, field, sel, "includeDeprecated");
+    gqlValue		a = gql_extract_arg(err, doc, field, sel, "includeDeprecated");
     bool		inc_dep = false;
 
     if (NULL != sel->alias) {
@@ -1449,7 +1475,7 @@ root_schema(agooErr err, gqlDoc doc, gqlCobj obj, gqlField field, gqlSel sel, gq
 
 static int
 root_type(agooErr err, gqlDoc doc, gqlCobj obj, gqlField field, gqlSel sel, gqlValue result, int depth) {
-    gqlValue		na = gql_extract_arg(err, field, sel, "name");
+    gqlValue		na = gql_extract_arg(err, doc, field, sel, "name");
     const char		*name = NULL;
     const char		*key = sel->name;
     int			d2 = depth + 1;
@@ -1491,10 +1517,169 @@ static struct _gqlCclass	root_class = {
     .methods = root_methods,
 };
 
+void
+gql_intro_cache_clear(void) {
+    Entry	e;
+
+    pthread_mutex_lock(&cache.lock);
+    while (NULL != (e = cache.entries)) {
+	cache.entries = e->next;
+	gql_value_destroy(e->value);
+	AGOO_FREE(e->key);
+	AGOO_FREE(e);
+    }
+    cache.cnt = 0;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+static agooText	sels_key(agooText text, gqlDoc doc, gqlSel sels);
+
+static agooText
+frag_key(agooText text, gqlDoc doc, gqlFrag frag) {
+    if (NULL == text) {
+	return NULL;
+    }
+    if (NULL == frag || NULL != frag->dir) {
+	agoo_text_release(text);
+	return NULL;
+    }
+    text = agoo_text_append(text, "...", 3);
+    if (NULL != frag->on) {
+	text = agoo_text_append(text, frag->on->name, -1);
+    }
+    text = agoo_text_append_char(text, '{');
+    text = sels_key(text, doc, frag->sels);
+
+    return agoo_text_append_char(text, '}');
+}
+
+// Writes everything about a selection that can change the result with
+// fragments expanded and variables replaced by their values. NULL is
+// returned if the selection includes directives as those are not cached.
+static agooText
+sel_key(agooText text, gqlDoc doc, gqlSel sel) {
+    if (NULL == text) {
+	return NULL;
+    }
+    if (NULL != sel->dir) {
+	agoo_text_release(text);
+	return NULL;
+    }
+    if (NULL != sel->inline_frag) {
+	text = frag_key(text, doc, sel->inline_frag);
+    } else if (NULL != sel->frag) {
+	text = frag_key(text, doc, gql_sel_frag(doc, sel));
+    } else {
+	gqlSelArg	sa;
+	gqlValue	v;
+
+	if (NULL != sel->alias) {
+	    text = agoo_text_append(text, sel->alias, -1);
+	    text = agoo_text_append_char(text, ':');
+	}
+	text = agoo_text_append(text, sel->name, -1);
+	if (NULL != sel->args) {
+	    text = agoo_text_append_char(text, '(');
+	    for (sa = sel->args; NULL != sa && NULL != text; sa = sa->next) {
+		text = agoo_text_append(text, sa->name, -1);
+		text = agoo_text_append_char(text, ':');
+		if (NULL == (v = gql_sel_arg_value(doc, sa))) {
+		    text = agoo_text_append(text, "null", 4);
+		} else {
+		    text = gql_value_json(text, v, 0, 0);
+		}
+		text = agoo_text_append_char(text, ',');
+	    }
+	    text = agoo_text_append_char(text, ')');
+	}
+	if (NULL != sel->sels) {
+	    text = agoo_text_append_char(text, '{');
+	    text = sels_key(text, doc, sel->sels);
+	    text = agoo_text_append_char(text, '}');
+	}
+    }
+    return text;
+}
+
+static agooText
+sels_key(agooText text, gqlDoc doc, gqlSel sels) {
+    gqlSel	sel;
+
+    for (sel = sels; NULL != sel && NULL != text; sel = sel->next) {
+	text = sel_key(text, doc, sel);
+	text = agoo_text_append_char(text, ' ');
+    }
+    return text;
+}
+
+static uint64_t
+key_hash(const char *key, long len) {
+    uint64_t		h = 14695981039346656037ULL;
+    const uint8_t	*k = (const uint8_t*)key;
+    const uint8_t	*end = k + len;
+
+    for (; k < end; k++) {
+	h = (h ^ *k) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// Must be called with the lock held.
+static Entry
+cache_get(uint64_t hash, const char *key) {
+    Entry	e;
+
+    for (e = cache.entries; NULL != e; e = e->next) {
+	if (hash == e->hash && 0 == strcmp(key, e->key)) {
+	    break;
+	}
+    }
+    return e;
+}
+
+// Keeps a copy of the value outside of any request arena.
+static void
+cache_set(uint64_t hash, const char *key, long len, gqlValue value) {
+    struct _agooErr	err = AGOO_ERR_INIT;
+    gqlArena		prev = gql_arena_use(NULL);
+    gqlValue		dup = gql_value_dup(&err, value);
+    Entry		e;
+
+    gql_arena_use(prev);
+    if (NULL == dup) {
+	return;
+    }
+    pthread_mutex_lock(&cache.lock);
+    if (CACHE_MAX <= cache.cnt || NULL != cache_get(hash, key) ||
+	NULL == (e = (Entry)AGOO_MALLOC(sizeof(struct _entry)))) {
+	pthread_mutex_unlock(&cache.lock);
+	gql_value_destroy(dup);
+	return;
+    }
+    if (NULL == (e->key = AGOO_STRNDUP(key, len))) {
+	pthread_mutex_unlock(&cache.lock);
+	AGOO_FREE(e);
+	gql_value_destroy(dup);
+	return;
+    }
+    e->hash = hash;
+    e->value = dup;
+    e->next = cache.entries;
+    cache.entries = e;
+    cache.cnt++;
+    pthread_mutex_unlock(&cache.lock);
+}
+
 int
 gql_intro_eval(agooErr err, gqlDoc doc, gqlSel sel, gqlValue result, int depth) {
     struct _gqlField	field;
     struct _gqlCobj	obj;
+    gqlResolveFunc	resolve = doc->funcs.resolve;
+    gqlTypeFunc		type = doc->funcs.type;
+    agooText		key;
+    uint64_t		hash = 0;
+    gqlLink		tail;
+    int			code;
 
     if (0 == strcmp("__type", sel->name)) {
 	if (2 < depth) {
@@ -1511,6 +1696,23 @@ gql_intro_eval(agooErr err, gqlDoc doc, gqlSel sel, gqlValue result, int depth)
     } else {
 	return agoo_err_set(err, AGOO_ERR_EVAL, "%s can only be called from the query root.", sel->name);
     }
+    if (NULL != (key = sel_key(agoo_text_allocate(1024), doc, sel))) {
+	Entry	e;
+
+	hash = key_hash(key->text, key->len);
+	pthread_mutex_lock(&cache.lock);
+	if (NULL != (e = cache_get(hash, key->text))) {
+	    gqlValue	dup = gql_value_dup(err, e->value);
+
+	    pthread_mutex_unlock(&cache.lock);
+	    agoo_text_release(key);
+	    if (NULL == dup) {
+		return err->code;
+	    }
+	    return gql_object_set(err, result, (NULL == sel->alias) ? sel->name : sel->alias, dup);
+	}
+	pthread_mutex_unlock(&cache.lock);
+    }
     memset(&field, 0, sizeof(field));
     field.name = sel->name;
     field.type = sel->type;
@@ -1518,5 +1720,32 @@ gql_intro_eval(agooErr err, gqlDoc doc, gqlSel sel, gqlValue result, int depth)
     doc->funcs.resolve = gql_cobj_resolve;
     doc->funcs.type = gql_cobj_ref_type;
 
-    return gql_cobj_resolve(err, doc, &obj, &field, sel, result, depth);
+    tail = result->tail;
+    code = gql_cobj_resolve(err, doc, &obj, &field, sel, result, depth);
+
+    // Sibling fields are still resolved by the original functions.
+    doc->funcs.resolve = resolve;
+    doc->funcs.type = type;
+
+    if (NULL != key) {
+	if (AGOO_ERR_OK == code && tail != result->tail) {
+	    cache_set(hash, key->text, key->len, result->tail->value);
+	}
+	agoo_text_release(key);
+    }
+    return code;
+}
+
+static int
+index_classes(agooErr err) {
+    if (AGOO_ERR_OK != gql_cclass_index(err, &input_value_class) ||
+	AGOO_ERR_OK != gql_cclass_index(err, &field_class) ||
+	AGOO_ERR_OK != gql_cclass_index(err, &enum_value_class) ||
+	AGOO_ERR_OK != gql_cclass_index(err, &directive_class) ||
+	AGOO_ERR_OK != gql_cclass_index(err, &type_class) ||
+	AGOO_ERR_OK != gql_cclass_index(err, &schema_class) ||
+	AGOO_ERR_OK != gql_cclass_index(err, &root_class)) {
+	return err->code;
+    }
+    return AGOO_ERR_OK;
 }
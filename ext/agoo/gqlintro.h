@@ -12,8 +12,9 @@ struct _gqlType;
 struct _gqlValue;
 
 extern int			gql_intro_init(agooErr err);
+extern void			gql_intro_cache_clear(void);
 
 extern int			gql_intro_eval(agooErr err, struct _gqlDoc *doc, struct _gqlSel *sel, struct _gqlValue *result, int depth);
-extern struct _gqlValue*	gql_extract_arg(agooErr err, struct _gqlField *field, struct _gqlSel *sel, const char *key);
+extern struct _gqlValue*	gql_extract_arg(agooErr err, struct _gqlDoc *doc, struct _gqlField *field, struct _gqlSel *sel, const char *key);
 
 #endif // AGOO_GQLINTRO_H
@@ -3,7 +3,45 @@
 #include "con.h"
 #include "debug.h"
 #include "gqlsub.h"
+#include "gqlvalue.h"
 #include "graphql.h"
+#include "text.h"
+
+// Subscriptions with the same key give the same result for an event so a
+// publish evaluates them once. The key is the query as written back out
+// followed by the variable values.
+static char*
+sub_key(gqlDoc query, uint64_t *hashp) {
+    agooText	t = agoo_text_allocate(1024);
+    gqlVar	var;
+    char	*key = NULL;
+    uint64_t	h = 14695981039346656037ULL;
+    const char	*s;
+
+    t = gql_doc_sdl(query, t);
+    for (var = query->vars; NULL != var && NULL != t; var = var->next) {
+	t = agoo_text_append(t, "$", 1);
+	t = agoo_text_append(t, var->name, -1);
+	t = agoo_text_append(t, "=", 1);
+	if (NULL == var->value) {
+	    t = agoo_text_append(t, "null", 4);
+	} else {
+	    t = gql_value_json(t, var->value, 0, 0);
+	}
+	t = agoo_text_append(t, "\n", 1);
+    }
+    if (NULL != t) {
+	if (NULL != (key = AGOO_STRNDUP(t->text, t->len))) {
+	    for (s = key; '\0' != *s; s++) {
+		h ^= (uint8_t)*s;
+		h *= 1099511628211ULL;
+	    }
+	    *hashp = h;
+	}
+	agoo_text_release(t);
+    }
+    return key;
+}
 
 gqlSub
 gql_sub_create(agooErr err, agooCon con, const char *subject, struct _gqlDoc *query) {
@@ -18,6 +56,12 @@ gql_sub_create(agooErr err, agooCon con, const char *subject, struct _gqlDoc *qu
 	AGOO_FREE(sub);
 	return NULL;
     }
+    if (NULL == (sub->key = sub_key(query, &sub->hash))) {
+	AGOO_ERR_MEM(err, "GraphQL subscription key");
+	AGOO_FREE(sub->subject);
+	AGOO_FREE(sub);
+	return NULL;
+    }
     sub->next = NULL;
     sub->con = con;
     con->gsub = sub;
@@ -30,6 +74,7 @@ gql_sub_create(agooErr err, agooCon con, const char *subject, struct _gqlDoc *qu
 void
 gql_sub_destroy(gqlSub sub) {
     AGOO_FREE(sub->subject);
+    AGOO_FREE(sub->key);
     if (NULL != sub->query) {
 	gql_doc_destroy(sub->query);
     }
@@ -4,6 +4,7 @@
 #define AGOO_GQL_SUB_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "err.h"
@@ -16,6 +17,8 @@ typedef struct _gqlSub {
     struct _agooCon	*con;
     char		*subject;
     struct _gqlDoc	*query;
+    char		*key;  // normalized query and variables
+    uint64_t		hash;  // of the key
 } *gqlSub;
 
 extern gqlSub	gql_sub_create(agooErr err, struct _agooCon *con, const char *subject, struct _gqlDoc *query);
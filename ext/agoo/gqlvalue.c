@@ -6,10 +6,22 @@
 #include <time.h>
 
 #include "debug.h"
+#include "gqlarena.h"
 #include "gqlvalue.h"
 #include "graphql.h"
 #include "sectime.h"
 
+// Objects with more members than this get a hash index.
+#define INDEX_MIN	16
+
+typedef struct _gqlIndex {
+    int		size; // always a power of 2
+    gqlLink	slots[];
+} *gqlIndex;
+
+// The writer for the JSON being written on this thread, if any.
+static _Thread_local gqlWriter	writer = NULL;
+
 static const char	spaces[257] = "\n                                                                                                                                                                                                                                                               ";
 
 // Null type
@@ -73,10 +85,21 @@ struct _gqlType	gql_i64_type = {
     .to_sdl = i64_to_text,
 };
 
+// Strings of arena values are in the arena as well.
+static char*
+value_strndup(gqlValue value, const char *str, size_t len) {
+    gqlArena	arena;
+
+    if (value->arena && NULL != (arena = gql_arena_current())) {
+	return gql_arena_strndup(arena, str, len);
+    }
+    return AGOO_STRNDUP(str, len);
+}
+
 // String type
 static void
 string_destroy(gqlValue value) {
-    if (value->str.alloced) {
+    if (value->str.alloced && !value->arena) {
 	AGOO_FREE((char*)value->str.ptr);
     }
 }
@@ -583,6 +606,14 @@ struct _gqlType	gql_uuid_type = {
     .to_sdl = uuid_to_text,
 };
 
+static agooText
+write_check(agooText text) {
+    if (NULL != writer && NULL != text && writer->max <= text->len) {
+	text = writer->flush(writer, text);
+    }
+    return text;
+}
+
 // List, not visible but used for list values.
 static void
 list_destroy(gqlValue value) {
@@ -592,6 +623,8 @@ list_destroy(gqlValue value) {
 	value->members = link->next;
 	gql_link_destroy(link);
     }
+    value->tail = NULL;
+    value->cnt = 0;
 }
 
 static agooText
@@ -618,6 +651,7 @@ list_to_json(agooText text, gqlValue value, int indent, int depth) {
 	if (NULL != link->next) {
 	    text = agoo_text_append(text, ",", 1);
 	}
+	text = write_check(text);
     }
     if (0 < indent) {
 	text = agoo_text_append(text, spaces, i);
@@ -680,6 +714,10 @@ object_destroy(gqlValue value) {
 	value->members = link->next;
 	gql_link_destroy(link);
     }
+    value->tail = NULL;
+    value->cnt = 0;
+    AGOO_FREE(value->index);
+    value->index = NULL;
 }
 
 agooText
@@ -713,6 +751,7 @@ gql_object_to_json(agooText text, gqlValue value, int indent, int depth) {
 	if (NULL != link->next) {
 	    text = agoo_text_append(text, ",", 1);
 	}
+	text = write_check(text);
     }
     if (0 < indent) {
 	text = agoo_text_append(text, spaces, i);
@@ -773,9 +812,10 @@ struct _gqlType	object_type = { // unregistered
 };
 
 ////////////////////////////////////////////////////////////////////////////////
+// Arena values are released with the arena.
 void
 gql_value_destroy(gqlValue value) {
-    if (NULL != value) {
+    if (NULL != value && !value->arena) {
 	if (GQL_SCALAR == value->type->kind) {
 	    if (NULL != value->type->destroy) {
 		value->type->destroy(value);
@@ -831,7 +871,7 @@ string_set(agooErr err, gqlValue value, const char *str, int len) {
 	    value->str.alloced = false;
 	} else {
 	    value->str.alloced = true;
-	    if (NULL == (value->str.ptr = AGOO_STRNDUP(str, len))) {
+	    if (NULL == (value->str.ptr = value_strndup(value, str, len))) {
 		return AGOO_ERR_MEM(err, "strndup()");
 	    }
 	}
@@ -933,6 +973,30 @@ gql_link_create(agooErr err, const char *key, gqlValue item) {
     return link;
 }
 
+// Members of arena containers are allocated from the arena too.
+static gqlLink
+member_create(agooErr err, gqlValue container, const char *key, gqlValue item) {
+    gqlArena	arena;
+    gqlLink	link;
+
+    if (!container->arena || NULL == (arena = gql_arena_current())) {
+	return gql_link_create(err, key, item);
+    }
+    if (NULL == (link = (gqlLink)gql_arena_alloc(arena, sizeof(struct _gqlLink)))) {
+	AGOO_ERR_MEM(err, "GraphQL List Link");
+	return NULL;
+    }
+    link->next = NULL;
+    link->key = NULL;
+    if (NULL != key && NULL == (link->key = gql_arena_strndup(arena, key, strlen(key)))) {
+	AGOO_ERR_MEM(err, "strdup()");
+	return NULL;
+    }
+    link->value = item;
+
+    return link;
+}
+
 void
 gql_link_destroy(gqlLink link) {
     AGOO_FREE(link->key);
@@ -944,58 +1008,169 @@ gql_link_destroy(gqlLink link) {
 
 int
 gql_list_append(agooErr err, gqlValue list, gqlValue item) {
-    gqlLink	link = gql_link_create(err, NULL, item);
+    gqlLink	link = member_create(err, list, NULL, item);
 
     if (NULL != link) {
 	if (NULL == list->members) {
 	    list->members = link;
 	} else {
-	    gqlLink	last = list->members;
-
-	    for (; NULL != last->next; last = last->next) {
-	    }
-	    last->next = link;
+	    list->tail->next = link;
 	}
+	list->tail = link;
+	list->cnt++;
     }
     return AGOO_ERR_OK;
 }
 
 int
 gql_list_prepend(agooErr err, gqlValue list, gqlValue item) {
-    gqlLink	link = gql_link_create(err, NULL, item);
+    gqlLink	link = member_create(err, list, NULL, item);
 
     if (NULL != link) {
+	if (NULL == list->members) {
+	    list->tail = link;
+	}
 	link->next = list->members;
 	list->members = link;
+	list->cnt++;
     }
     return AGOO_ERR_OK;
 }
 
+// FNV-1a
+static uint32_t
+key_hash(const char *key) {
+    uint32_t	h = 2166136261U;
+
+    for (; '\0' != *key; key++) {
+	h ^= (uint8_t)*key;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+// Adds a link unless a link with the same key is already indexed so the
+// first member set is the one found, the same as a scan of the members.
+static void
+index_add(gqlIndex index, gqlLink link) {
+    uint32_t	mask = (uint32_t)index->size - 1;
+    uint32_t	i = key_hash(link->key) & mask;
+    gqlLink	*sp;
+
+    for (sp = index->slots + i; NULL != *sp; sp = index->slots + i) {
+	if (0 == strcmp((*sp)->key, link->key)) {
+	    return;
+	}
+	i = (i + 1) & mask;
+    }
+    *sp = link;
+}
+
+// Builds a new index at least twice the size of the member count.
+static gqlIndex
+index_build(gqlValue obj, int cnt) {
+    gqlIndex	index;
+    gqlLink	link;
+    gqlArena	arena;
+    size_t	isize;
+    int		size = INDEX_MIN * 2;
+
+    while (size <= cnt * 2) {
+	size *= 2;
+    }
+    isize = sizeof(struct _gqlIndex) + sizeof(gqlLink) * size;
+
+    if (obj->arena && NULL != (arena = gql_arena_current())) {
+	if (NULL == (index = (gqlIndex)gql_arena_alloc(arena, isize))) {
+	    return NULL;
+	}
+	memset(index, 0, isize);
+    } else if (NULL == (index = (gqlIndex)AGOO_CALLOC(1, isize))) {
+	return NULL;
+    }
+    index->size = size;
+    for (link = obj->members; NULL != link; link = link->next) {
+	index_add(index, link);
+    }
+    return index;
+}
+
+static void
+member_add(gqlValue obj, gqlLink link) {
+    if (NULL == obj->members) {
+	obj->members = link;
+    } else {
+	obj->tail->next = link;
+    }
+    obj->tail = link;
+    obj->cnt++;
+    // The index is only changed here so lookups never modify the object
+    // and can be made from more than one thread.
+    if (NULL == obj->index) {
+	if (INDEX_MIN < obj->cnt) {
+	    obj->index = index_build(obj, obj->cnt);
+	}
+    } else if (obj->index->size <= obj->cnt * 2) {
+	gqlIndex	index = index_build(obj, obj->cnt);
+
+	// If the index can not grow it is dropped and lookups scan.
+	if (!obj->arena) {
+	    AGOO_FREE(obj->index);
+	}
+	obj->index = index;
+    } else {
+	index_add(obj->index, link);
+    }
+}
+
 int
 gql_object_set(agooErr err, gqlValue obj, const char *key, gqlValue item) {
-    gqlLink	link = gql_link_create(err, key, item);
+    gqlLink	link = member_create(err, obj, key, item);
 
     if (NULL != link) {
-	//link->next = obj->members;
-	if (NULL == obj->members) {
-	    obj->members = link;
-	} else {
-	    gqlLink	last = obj->members;
-
-	    for (; NULL != last->next; last = last->next) {
-	    }
-	    last->next = link;
-	}
+	member_add(obj, link);
     }
     return AGOO_ERR_OK;
 }
 
+// Moves the members of from to the end of obj leaving from empty. Both
+// objects must come from the same arena or neither from an arena.
+void
+gql_object_move(gqlValue obj, gqlValue from) {
+    gqlLink	link;
+
+    while (NULL != (link = from->members)) {
+	from->members = link->next;
+	link->next = NULL;
+	member_add(obj, link);
+    }
+    from->tail = NULL;
+    from->cnt = 0;
+    if (!from->arena) {
+	AGOO_FREE(from->index);
+    }
+    from->index = NULL;
+}
+
 gqlValue
 gql_object_get(gqlValue obj, const char *key) {
     if (NULL != obj && obj->type == &object_type) {
-	gqlLink	link = obj->members;
-
-	for (; NULL != link; link = link->next) {
+	gqlLink	link;
+
+	if (NULL != obj->index) {
+	    gqlIndex	index = obj->index;
+	    uint32_t	mask = (uint32_t)index->size - 1;
+	    uint32_t	i = key_hash(key) & mask;
+
+	    for (link = index->slots[i]; NULL != link; link = index->slots[i]) {
+		if (0 == strcmp(link->key, key)) {
+		    return link->value;
+		}
+		i = (i + 1) & mask;
+	    }
+	    return NULL;
+	}
+	for (link = obj->members; NULL != link; link = link->next) {
 	    if (0 == strcmp(link->key, key)) {
 		return link->value;
 	    }
@@ -1008,8 +1183,17 @@ gql_object_get(gqlValue obj, const char *key) {
 
 static gqlValue
 value_create(gqlType type) {
-    gqlValue	v = (gqlValue)AGOO_CALLOC(1, sizeof(struct _gqlValue));
+    gqlArena	arena = gql_arena_current();
+    gqlValue	v;
 
+    if (NULL != arena) {
+	if (NULL != (v = (gqlValue)gql_arena_alloc(arena, sizeof(struct _gqlValue)))) {
+	    memset(v, 0, sizeof(struct _gqlValue));
+	    v->arena = true;
+	}
+    } else {
+	v = (gqlValue)AGOO_CALLOC(1, sizeof(struct _gqlValue));
+    }
     if (NULL != v) {
 	v->type = type;
     }
@@ -1046,7 +1230,7 @@ gql_string_create(agooErr err, const char *str, int len) {
     if (NULL != (v = value_create(&gql_string_type))) {
 	if ((int)sizeof(v->str.a) <= len) {
 	    v->str.alloced = true;
-	    if (NULL == (v->str.ptr = AGOO_STRNDUP(str, len))) {
+	    if (NULL == (v->str.ptr = value_strndup(v, str, len))) {
 		AGOO_ERR_MEM(err, "strdup()");
 		return NULL;
 	    }
@@ -1072,7 +1256,7 @@ gql_token_create(agooErr err, const char *str, int len, gqlType type) {
     if (NULL != (v = value_create(type))) {
 	if ((int)sizeof(v->str.a) <= len) {
 	    v->str.alloced = true;
-	    if (NULL == (v->str.ptr = AGOO_STRNDUP(str, len))) {
+	    if (NULL == (v->str.ptr = value_strndup(v, str, len))) {
 		AGOO_ERR_MEM(err, "strdup()");
 		return NULL;
 	    }
@@ -1095,7 +1279,7 @@ gql_id_create(agooErr err, const char *str, int len) {
     if (NULL != (v = value_create(&gql_id_type))) {
 	if ((int)sizeof(v->str.a) <= len) {
 	    v->str.alloced = true;
-	    if (NULL == (v->str.ptr = AGOO_STRNDUP(str, len))) {
+	    if (NULL == (v->str.ptr = value_strndup(v, str, len))) {
 		AGOO_ERR_MEM(err, "strdup()");
 		return NULL;
 	    }
@@ -1118,7 +1302,7 @@ gql_var_create(agooErr err, const char *str, int len) {
     if (NULL != (v = value_create(&gql_var_type))) {
 	if ((int)sizeof(v->str.a) <= len) {
 	    v->str.alloced = true;
-	    if (NULL == (v->str.ptr = AGOO_STRNDUP(str, len))) {
+	    if (NULL == (v->str.ptr = value_strndup(v, str, len))) {
 		AGOO_ERR_MEM(err, "strdup()");
 		return NULL;
 	    }
@@ -1215,6 +1399,8 @@ gql_list_create(agooErr err, gqlType item_type) {
 
     if (NULL != v) {
 	v->members = NULL;
+	v->tail = NULL;
+	v->cnt = 0;
 	v->member_type = item_type;
     }
     return v;
@@ -1226,7 +1412,9 @@ gql_object_create(agooErr err) {
 
     if (NULL != v) {
 	v->members = NULL;
-	v->member_type = NULL;
+	v->tail = NULL;
+	v->cnt = 0;
+	v->index = NULL;
     }
     return v;
 }
@@ -1247,6 +1435,19 @@ gql_value_json(agooText text, gqlValue value, int indent, int depth) {
     return text;
 }
 
+// Same as gql_value_json() but the text is handed to the writer in pieces
+// as it grows. The last piece is returned.
+agooText
+gql_value_json_write(gqlWriter w, agooText text, gqlValue value, int indent, int depth) {
+    gqlWriter	prev = writer;
+
+    writer = w;
+    text = gql_value_json(text, value, indent, depth);
+    writer = prev;
+
+    return text;
+}
+
 agooText
 gql_value_sdl(agooText text, gqlValue value, int indent, int depth) {
     if (NULL == value->type || GQL_SCALAR != value->type->kind) {
@@ -1304,9 +1505,7 @@ convert_to_bool(agooErr err, gqlValue value) {
 	} else {
 	    agoo_err_set(err, AGOO_ERR_PARSE, "Can not coerce a String of '%s' into a Boolean value.", s);
 	}
-	if (value->str.alloced) {
-	    AGOO_FREE((char*)value->str.ptr);
-	}
+	string_destroy(value);
 	break;
     }
     default:
@@ -1346,9 +1545,7 @@ convert_to_int(agooErr err, gqlValue value) {
 	    agoo_err_set(err, ERANGE, "Can not coerce a %lld into an Int value. Out of range.", (long long)i);
 	} else {
 	    gql_int_set(value, (int32_t)i);
-	    if (value->str.alloced) {
-		AGOO_FREE((char*)value->str.ptr);
-	    }
+	    string_destroy(value);
 	}
 	break;
     }
@@ -1381,9 +1578,7 @@ convert_to_i64(agooErr err, gqlValue value) {
 	    agoo_err_set(err, ERANGE, "Can not coerce a '%s' into an I64 value.", s);
 	} else {
 	    gql_i64_set(value, (int64_t)i);
-	    if (value->str.alloced) {
-		AGOO_FREE((char*)value->str.ptr);
-	    }
+	    string_destroy(value);
 	}
 	break;
     }
@@ -1415,9 +1610,7 @@ convert_to_float(agooErr err, gqlValue value) {
 	    agoo_err_set(err, ERANGE, "Can not coerce a '%s' into a Float value.", s);
 	} else {
 	    gql_float_set(value, d);
-	    if (value->str.alloced) {
-		AGOO_FREE((char*)value->str.ptr);
-	    }
+	    string_destroy(value);
 	}
 	break;
     }
@@ -1530,9 +1723,7 @@ convert_to_time(agooErr err, gqlValue value) {
 	int64_t	nsecs = time_parse(err, gql_string_get(value), -1);
 
 	if (AGOO_ERR_OK == err->code) {
-	    if (value->str.alloced) {
-		AGOO_FREE((char*)value->str.ptr);
-	    }
+	    string_destroy(value);
 	    gql_time_set(value, nsecs);
 	}
 	break;
@@ -1552,7 +1743,7 @@ convert_to_uuid(agooErr err, gqlValue value) {
 	bool		alloced = value->str.alloced;
 
 	if (AGOO_ERR_OK == gql_uuid_str_set(err, value, s, 0)) {
-	    if (alloced) {
+	    if (alloced && !value->arena) {
 		AGOO_FREE((char*)s);
 	    }
 	}
@@ -1616,7 +1807,7 @@ gql_value_dup(agooErr err, gqlValue value) {
 	AGOO_ERR_MEM(err, "GraphQL Value");
 	return NULL;
     }
-    switch (value->type->scalar_kind) {
+    switch (GQL_ENUM == value->type->kind ? GQL_SCALAR_TOKEN : value->type->scalar_kind) {
     case GQL_SCALAR_BOOL:
 	dup->b = value->b;
 	break;
@@ -1633,9 +1824,10 @@ gql_value_dup(agooErr err, gqlValue value) {
     case GQL_SCALAR_TOKEN:
     case GQL_SCALAR_ID:
 	if (value->str.alloced) {
-	    if (NULL == (dup->str.ptr = strdup(value->str.ptr))) {
+	    dup->str.alloced = true;
+	    if (NULL == (dup->str.ptr = value_strndup(dup, value->str.ptr, strlen(value->str.ptr)))) {
 		AGOO_ERR_MEM(err, "strdup()");
-		AGOO_FREE(dup);
+		gql_value_destroy(dup);
 		dup = NULL;
 	    }
 	} else {
@@ -1649,6 +1841,37 @@ gql_value_dup(agooErr err, gqlValue value) {
 	dup->uuid.hi = value->uuid.hi;
 	dup->uuid.lo = value->uuid.lo;
 	break;
+    case GQL_SCALAR_LIST:
+    case GQL_SCALAR_OBJECT: {
+	gqlLink		link;
+	gqlValue	m;
+
+	dup->members = NULL;
+	dup->tail = NULL;
+	dup->cnt = 0;
+	if (GQL_SCALAR_LIST == value->type->scalar_kind) {
+	    dup->member_type = value->member_type;
+	} else {
+	    dup->index = NULL;
+	}
+	for (link = value->members; NULL != link; link = link->next) {
+	    if (NULL == (m = gql_value_dup(err, link->value))) {
+		gql_value_destroy(dup);
+		return NULL;
+	    }
+	    if (NULL == link->key) {
+		gql_list_append(err, dup, m);
+	    } else {
+		gql_object_set(err, dup, link->key, m);
+	    }
+	    if (AGOO_ERR_OK != err->code) {
+		gql_value_destroy(m);
+		gql_value_destroy(dup);
+		return NULL;
+	    }
+	}
+	break;
+    }
     default:
 	break;
     }
@@ -19,6 +19,7 @@ typedef struct _gqlLink {
 
 typedef struct _gqlValue {
     struct _gqlType		*type;
+    bool			arena; // allocated from a request arena
     union {
 	int32_t			i;
 	int64_t			i64;
@@ -42,11 +43,24 @@ typedef struct _gqlValue {
 	} uuid;
 	struct {
 	    struct _gqlLink	*members; // linked list for List and Object types
-	    struct _gqlType	*member_type;
+	    struct _gqlLink	*tail;    // last member for constant time appends
+	    int			cnt;      // number of members
+	    union {
+		struct _gqlType		*member_type; // List
+		struct _gqlIndex	*index;       // Object, built once large
+	    };
 	};
     };
 } *gqlValue;
 
+// A writer takes the JSON text of a large value in pieces. Once the text
+// reaches max bytes between members the flush function is called with it
+// and returns the text to continue with, which may be a new one.
+typedef struct _gqlWriter {
+    long		max;
+    agooText		(*flush)(struct _gqlWriter *w, agooText text);
+} *gqlWriter;
+
 extern int	gql_value_init(agooErr err);
 
 extern void	gql_value_destroy(gqlValue value);
@@ -75,6 +89,7 @@ extern int	gql_list_append(agooErr err, gqlValue list, gqlValue item);
 extern int	gql_list_preend(agooErr err, gqlValue list, gqlValue item);
 extern int	gql_object_set(agooErr err, gqlValue obj, const char *key, gqlValue item);
 extern gqlValue	gql_object_get(gqlValue obj, const char *key);
+extern void	gql_object_move(gqlValue obj, gqlValue from);
 
 extern void	gql_int_set(gqlValue value, int32_t i);
 extern void	gql_i64_set(gqlValue value, int64_t i);
@@ -92,6 +107,7 @@ extern void	gql_null_set(gqlValue value);
 extern const char*	gql_string_get(gqlValue value);
 
 extern agooText	gql_value_json(agooText text, gqlValue value, int indent, int depth);
+extern agooText	gql_value_json_write(gqlWriter w, agooText text, gqlValue value, int indent, int depth);
 extern agooText	gql_value_sdl(agooText text, gqlValue value, int indent, int depth);
 
 //extern agooText	gql_object_to_json(agooText text, gqlValue value, int indent, int depth);
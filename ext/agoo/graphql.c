@@ -1,10 +1,12 @@
 // Copyright (c) 2018, Peter Ohler, All rights reserved.
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "debug.h"
+#include "gqlcache.h"
 #include "graphql.h"
 #include "gqlintro.h"
 #include "gqlvalue.h"
@@ -24,6 +26,10 @@ typedef struct _slot {
 
 static Slot	buckets[BUCKET_SIZE];
 
+// Schema SDL for each combination of the with_desc and all flags.
+static agooText		sdl_cache[4] = { NULL, NULL, NULL, NULL };
+static pthread_mutex_t	sdl_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static uint8_t	name_chars[257] = "\
 \x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\
 \x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\
@@ -257,6 +263,23 @@ dir_destroy(gqlDir dir) {
     AGOO_FREE(dir);
 }
 
+// Results derived from the schema are dropped whenever it changes. This
+// must be called before any type is freed.
+static void
+schema_changed(void) {
+    int	i;
+
+    gql_intro_cache_clear();
+    pthread_mutex_lock(&sdl_lock);
+    for (i = 0; i < 4; i++) {
+	if (NULL != sdl_cache[i]) {
+	    agoo_text_release(sdl_cache[i]);
+	    sdl_cache[i] = NULL;
+	}
+    }
+    pthread_mutex_unlock(&sdl_lock);
+}
+
 gqlType
 gql_type_get(const char *name) {
     gqlType	type = NULL;
@@ -305,6 +328,7 @@ int
 gql_type_set(agooErr err, gqlType type) {
     uint64_t	h = calc_hash(type->name);
 
+    schema_changed();
     if (h <= 0) {
 	return agoo_err_set(err, AGOO_ERR_ARG, "%s is not a valid GraphQL type name.", type->name);
     } else {
@@ -333,6 +357,7 @@ static void
 type_remove(gqlType type) {
     uint64_t	h = calc_hash(type->name);
 
+    schema_changed();
     if (0 < h) {
 	Slot	*bucket = get_bucketp(h);
 	Slot	s;
@@ -436,6 +461,8 @@ gql_destroy(void) {
     int		i;
     gqlDir	dir;
 
+    gql_cache_clear();
+    schema_changed();
     for (i = BUCKET_SIZE; 0 < i; i--, sp++) {
 	s = *sp;
 
@@ -520,6 +547,7 @@ gql_type_field(agooErr		err,
 	       size_t		dlen) {
     gqlField	f = (gqlField)AGOO_MALLOC(sizeof(struct _gqlField));
 
+    schema_changed();
     if (NULL == f) {
 	AGOO_ERR_MEM(err, "GraphQL Field");
     } else {
@@ -749,6 +777,7 @@ gqlDir
 gql_directive_create(agooErr err, const char *name, const char *desc, size_t dlen) {
     gqlDir	dir = gql_directive_get(name);
 
+    schema_changed();
     if (NULL != dir) {
 	if (!dir->defined) {
 	    dir->defined = true;
@@ -1195,8 +1224,8 @@ type_cmp(const void *v0, const void *v1) {
     return t0->kind - t1->kind;
 }
 
-agooText
-gql_schema_sdl(agooText text, bool with_desc, bool all) {
+static agooText
+schema_sdl(agooText text, bool with_desc, bool all) {
     Slot	*bucket;
     Slot	s;
     gqlType	type;
@@ -1253,6 +1282,22 @@ gql_schema_sdl(agooText text, bool with_desc, bool all) {
     return text;
 }
 
+agooText
+gql_schema_sdl(agooText text, bool with_desc, bool all) {
+    int	i = (with_desc ? 1 : 0) | (all ? 2 : 0);
+
+    pthread_mutex_lock(&sdl_lock);
+    if (NULL == sdl_cache[i]) {
+	sdl_cache[i] = schema_sdl(agoo_text_allocate(4096), with_desc, all);
+    }
+    if (NULL != sdl_cache[i] && 0 < sdl_cache[i]->len) {
+	text = agoo_text_append(text, sdl_cache[i]->text, (int)sdl_cache[i]->len);
+    }
+    pthread_mutex_unlock(&sdl_lock);
+
+    return text;
+}
+
 gqlDirUse
 gql_dir_use_create(agooErr err, const char *name) {
     gqlDirUse	use;
@@ -1347,6 +1392,10 @@ gql_validate(agooErr err) {
     // check the directive us in specified locations only
     // set types if they are not already set or error out
 
+    // Arguments, enum values, and union members are added without
+    // clearing so clear once the load is done.
+    schema_changed();
+
     return AGOO_ERR_OK;
 }
 
@@ -1363,6 +1412,10 @@ gql_doc_create(agooErr err) {
 	doc->req = NULL;
 	doc->ctx = NULL;
 	doc->ctx_free = NULL;
+	doc->base = NULL;
+	doc->arena = NULL;
+	doc->cost = 0;
+	atomic_init(&doc->ref_cnt, 1);
     }
     return doc;
 }
@@ -1470,6 +1523,14 @@ gql_doc_destroy(gqlDoc doc) {
     gqlFrag	frag;
     gqlVar	var;
 
+    if (NULL != doc->base) {
+	if (doc->ops != doc->base->ops) { // a copy of just the one op struct
+	    AGOO_FREE(doc->ops);
+	}
+	gql_doc_release(doc->base);
+	doc->ops = NULL;
+	doc->frags = NULL;
+    }
     while (NULL != (op = doc->ops)) {
 	doc->ops = op->next;
 	gql_op_destroy(op);
@@ -1485,9 +1546,18 @@ gql_doc_destroy(gqlDoc doc) {
     if (NULL != doc->ctx_free) {
 	doc->ctx_free(doc->ctx);
     }
+    gql_arena_destroy(doc->arena);
     AGOO_FREE(doc);
 }
 
+// Drops a reference to a shared document and destroys it with the last.
+void
+gql_doc_release(gqlDoc doc) {
+    if (1 >= atomic_fetch_sub(&doc->ref_cnt, 1)) {
+	gql_doc_destroy(doc);
+    }
+}
+
 static agooText
 sel_sdl(agooText text, gqlSel sel, int depth) {
     int	indent = depth * 2;
@@ -1639,7 +1709,7 @@ gql_doc_sdl(gqlDoc doc, agooText text) {
     gqlFrag	frag;
 
     for (op = doc->ops; NULL != op; op = op->next) {
-	op_sdl(text, op);
+	text = op_sdl(text, op);
     }
     for (frag = doc->frags; NULL != frag; frag = frag->next) {
 	text = frag_sdl(text, frag);
@@ -7,7 +7,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "atomic.h"
 #include "err.h"
+#include "gqlarena.h"
 #include "gqlcobj.h"
 #include "gqleval.h"
 #include "text.h"
@@ -162,10 +164,12 @@ typedef struct _gqlSel {
     const char		*alias;
     const char		*name;
     gqlType		type; // set with validation
+    struct _gqlField	*field; // set with validation
     gqlDirUse		dir;
     gqlSelArg		args;
     struct _gqlSel	*sels;
     const char		*frag;
+    struct _gqlFrag	*spread; // fragment named by frag, set with validation
     struct _gqlFrag	*inline_frag;
 } *gqlSel;
 
@@ -200,6 +204,10 @@ typedef struct _gqlDoc {
     struct _agooReq	*req;
     void		*ctx;
     void		(*ctx_free)(void*);
+    struct _gqlDoc	*base; // shared parsed document the ops and frags belong to
+    gqlArena		arena; // request values, released with the document
+    long		cost; // set by gql_doc_cost_check()
+    atomic_int		ref_cnt;
 } *gqlDoc;
 
 extern int	gql_init(agooErr err);
@@ -278,6 +286,7 @@ extern agooText		gql_enum_to_text(agooText text, struct _gqlValue *value, int in
 
 extern gqlDoc		gql_doc_create(agooErr err);
 extern void		gql_doc_destroy(gqlDoc doc);
+extern void		gql_doc_release(gqlDoc doc);
 
 extern gqlOp		gql_op_create(agooErr err, const char *name, gqlOpKind kind);
 extern gqlFrag		gql_fragment_create(agooErr err, const char *name, gqlType on);
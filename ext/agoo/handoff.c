@@ -0,0 +1,441 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "atomic.h"
+#include "debug.h"
+#include "dtime.h"
+#include "log.h"
+#include "server.h"
+
+#include "handoff.h"
+
+// Each listener is sent as a fixed size record holding the bind id with the
+// socket attached. A record with an empty id ends the list.
+#define ID_SIZE		256
+// The descriptor number the new process finds its end of the pair at.
+#define HANDOFF_FD	3
+#define READY_BYTE	'R'
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
+extern char	**environ;
+
+static struct _agooHandoff {
+    char	**argv;
+    const int	*pids; // worker pids, the first is this process
+    int		pid_cnt;
+    double	timeout;
+    int		fd;    // in a new process, the end of the pair to report on
+    int		sock;  // in the old process, the end of the pair to wait on
+    pid_t	child;
+    atomic_int	busy;
+} ho = {
+    .argv = NULL,
+    .pids = NULL,
+    .pid_cnt = 0,
+    .timeout = 60.0,
+    .fd = -1,
+    .sock = -1,
+    .child = 0,
+    .busy = AGOO_ATOMIC_INT_INIT(0),
+};
+
+// Called in the main process once the workers have been forked. The argv is
+// the NULL terminated restart command and is owned by the handoff from then
+// on.
+int
+agoo_handoff_setup(agooErr err, char **argv, const int *pids, int pid_cnt, double timeout) {
+    if (NULL == argv || NULL == *argv) {
+	return agoo_err_set(err, AGOO_ERR_ARG, "The restart command can not be empty.");
+    }
+    ho.argv = argv;
+    ho.pids = pids;
+    ho.pid_cnt = pid_cnt;
+    ho.timeout = timeout;
+
+    return AGOO_ERR_OK;
+}
+
+// Returns the command line this process was started with, interpreter
+// options included, or NULL where /proc is not available.
+char**
+agoo_handoff_cmdline(void) {
+    char	buf[4096];
+    char	**argv;
+    char	*s;
+    char	*end;
+    FILE	*f;
+    size_t	len;
+    int		cnt = 0;
+
+    if (NULL == (f = fopen("/proc/self/cmdline", "r"))) {
+	return NULL;
+    }
+    len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    if (0 == len || sizeof(buf) - 1 == len) { // empty or too long to trust
+	return NULL;
+    }
+    buf[len] = '\0';
+    end = buf + len;
+    for (s = buf; s < end; s += strlen(s) + 1) {
+	cnt++;
+    }
+    if (NULL == (argv = (char**)AGOO_CALLOC(cnt + 1, sizeof(char*)))) {
+	return NULL;
+    }
+    for (cnt = 0, s = buf; s < end; s += strlen(s) + 1, cnt++) {
+	if (NULL == (argv[cnt] = AGOO_STRDUP(s))) {
+	    for (cnt--; 0 <= cnt; cnt--) {
+		AGOO_FREE(argv[cnt]);
+	    }
+	    AGOO_FREE(argv);
+	    return NULL;
+	}
+    }
+    return argv;
+}
+
+static bool
+send_rec(int sock, const char *id, int fd) {
+    char		buf[ID_SIZE];
+    struct iovec	iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+    struct msghdr	msg;
+    struct cmsghdr	*cm;
+    union {
+	struct cmsghdr	hdr;
+	char		space[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    ssize_t		cnt;
+
+    memset(buf, 0, sizeof(buf));
+    strncpy(buf, id, sizeof(buf) - 1);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (0 <= fd) {
+	memset(&ctl, 0, sizeof(ctl));
+	msg.msg_control = ctl.space;
+	msg.msg_controllen = sizeof(ctl.space);
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+    while (0 > (cnt = sendmsg(sock, &msg, MSG_NOSIGNAL)) && EINTR == errno) {
+    }
+    return (ssize_t)sizeof(buf) == cnt;
+}
+
+// Reads a record into id. Returns the socket sent with it, -1 if there was
+// none, or -2 on error.
+static int
+recv_rec(int sock, char *id) {
+    struct iovec	iov = { .iov_base = id, .iov_len = ID_SIZE };
+    struct msghdr	msg;
+    struct cmsghdr	*cm;
+    union {
+	struct cmsghdr	hdr;
+	char		space[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    ssize_t		cnt;
+    ssize_t		len;
+    int			fd = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.space;
+    msg.msg_controllen = sizeof(ctl.space);
+    while (0 > (cnt = recvmsg(sock, &msg, 0)) && EINTR == errno) {
+    }
+    if (0 >= cnt) {
+	return -2;
+    }
+    for (cm = CMSG_FIRSTHDR(&msg); NULL != cm; cm = CMSG_NXTHDR(&msg, cm)) {
+	if (SOL_SOCKET == cm->cmsg_level && SCM_RIGHTS == cm->cmsg_type) {
+	    memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+	}
+    }
+    // The socket arrives with the first byte so the rest of a record split
+    // across reads is plain data.
+    while (cnt < ID_SIZE) {
+	if (0 >= (len = read(sock, id + cnt, ID_SIZE - cnt))) {
+	    if (0 > len && EINTR == errno) {
+		continue;
+	    }
+	    if (0 <= fd) {
+		close(fd);
+	    }
+	    return -2;
+	}
+	cnt += len;
+    }
+    id[ID_SIZE - 1] = '\0';
+
+    return fd;
+}
+
+// Copies the environment with the handoff variable added. Only the array
+// and the new entry are allocated.
+static char**
+handoff_env(char *entry) {
+    char	**envp;
+    char	**ep;
+    int		cnt = 0;
+
+    for (ep = environ; NULL != *ep; ep++) {
+	cnt++;
+    }
+    if (NULL == (envp = (char**)AGOO_CALLOC(cnt + 2, sizeof(char*)))) {
+	return NULL;
+    }
+    cnt = 0;
+    for (ep = environ; NULL != *ep; ep++) {
+	if (0 != strncmp(*ep, AGOO_HANDOFF_ENV "=", sizeof(AGOO_HANDOFF_ENV))) {
+	    envp[cnt++] = *ep;
+	}
+    }
+    snprintf(entry, 32, "%s=%d", AGOO_HANDOFF_ENV, HANDOFF_FD);
+    envp[cnt] = entry;
+
+    return envp;
+}
+
+// The new process is started with posix_spawn so nothing runs in a forked
+// copy of this multi-threaded process. The child end of the pair is moved to
+// HANDOFF_FD and every other descriptor, especially the client connections,
+// is closed on exec.
+static int
+spawn_child(pid_t *pidp, int fd, int other, char **envp, long max_fd) {
+    posix_spawn_file_actions_t	fa;
+    posix_spawnattr_t		attr;
+    sigset_t			mask;
+    int				stat;
+
+#ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+    long	i;
+
+    for (i = HANDOFF_FD + 1; i < max_fd; i++) {
+	if (i != fd) {
+	    fcntl((int)i, F_SETFD, FD_CLOEXEC);
+	}
+    }
+#endif
+    posix_spawn_file_actions_init(&fa);
+    posix_spawnattr_init(&attr);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    posix_spawn_file_actions_addclose(&fa, other);
+    if (HANDOFF_FD != fd) {
+	posix_spawn_file_actions_adddup2(&fa, fd, HANDOFF_FD);
+    }
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+    posix_spawn_file_actions_addclosefrom_np(&fa, HANDOFF_FD + 1);
+#endif
+    stat = posix_spawnp(pidp, ho.argv[0], &fa, &attr, ho.argv, envp);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+
+    return stat;
+}
+
+static void
+abandon(const char *why) {
+    int	status;
+
+    agoo_log_cat(&agoo_error_cat, "New process %d %s. Restart abandoned, pid %d continues.", ho.child, why, getpid());
+    close(ho.sock);
+    ho.sock = -1;
+    kill(ho.child, SIGKILL);
+    waitpid(ho.child, &status, 0);
+    ho.child = 0;
+    atomic_store(&ho.busy, 0);
+}
+
+// Waits for the new process to report it is serving and then drains this
+// process and its workers.
+static void*
+wait_ready(void *x) {
+    struct pollfd	pa = { .fd = ho.sock, .events = POLLIN, .revents = 0 };
+    double		giveup = dtime() + ho.timeout;
+    char		c = '\0';
+    int			i;
+
+    while (0 > (i = poll(&pa, 1, (int)((giveup - dtime()) * 1000.0))) && EINTR == errno && dtime() < giveup) {
+    }
+    if (0 == i) {
+	abandon("did not report it was serving in time");
+	return NULL;
+    }
+    if (0 > i || 1 != read(ho.sock, &c, 1) || READY_BYTE != c) {
+	abandon("exited before it was serving");
+	return NULL;
+    }
+    close(ho.sock);
+    ho.sock = -1;
+    agoo_log_cat(&agoo_info_cat, "New process %d is serving. Draining pid %d.", ho.child, getpid());
+    for (i = 1; i < ho.pid_cnt; i++) {
+	if (0 < ho.pids[i]) {
+	    kill(ho.pids[i], SIGQUIT);
+	}
+    }
+    agoo_server_drain();
+
+    return NULL;
+}
+
+// Starts the restart command with the listening sockets. Called from the
+// listen thread.
+int
+agoo_handoff_restart(agooErr err) {
+    char	entry[32];
+    char	**envp;
+    int		pair[2];
+    int		stat;
+    long	max_fd = sysconf(_SC_OPEN_MAX);
+    pid_t	pid;
+    pthread_t	thread;
+    agooBind	b;
+
+    if (NULL == ho.argv) {
+	return agoo_err_set(err, AGOO_ERR_ARG, "Only the main process of a started server can restart.");
+    }
+    if (agoo_server.draining) {
+	return agoo_err_set(err, AGOO_ERR_IN_USE, "The server is already draining.");
+    }
+    if (0 != atomic_fetch_add(&ho.busy, 1)) {
+	return agoo_err_set(err, AGOO_ERR_IN_USE, "A restart is already in progress.");
+    }
+    if (0 > max_fd) {
+	max_fd = 1024;
+    }
+    if (NULL == (envp = handoff_env(entry))) {
+	atomic_store(&ho.busy, 0);
+	return AGOO_ERR_MEM(err, "Restart environment");
+    }
+    if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, pair)) {
+	AGOO_FREE(envp);
+	atomic_store(&ho.busy, 0);
+	return agoo_err_set(err, AGOO_ERR_NETWORK, "Failed to create the handoff socket pair. %s", strerror(errno));
+    }
+    if (0 != (stat = spawn_child(&pid, pair[1], pair[0], envp, max_fd))) {
+	close(pair[0]);
+	close(pair[1]);
+	AGOO_FREE(envp);
+	atomic_store(&ho.busy, 0);
+	return agoo_err_set(err, AGOO_ERR_THREAD, "Failed to start the new process. %s", strerror(stat));
+    }
+    AGOO_FREE(envp);
+    close(pair[1]);
+    ho.sock = pair[0];
+    ho.child = pid;
+    for (b = agoo_server.binds; NULL != b; b = b->next) {
+	if (0 < b->fd && !send_rec(ho.sock, b->id, b->fd)) {
+	    break;
+	}
+    }
+    if (NULL != b || !send_rec(ho.sock, "", -1)) {
+	abandon("could not be sent the listening sockets");
+	return agoo_err_set(err, AGOO_ERR_NETWORK, "Failed to send the listening sockets.");
+    }
+    agoo_log_cat(&agoo_info_cat, "Restarting with new process %d.", pid);
+    if (0 != (stat = pthread_create(&thread, NULL, wait_ready, NULL))) {
+	abandon("could not be waited on");
+	return agoo_err_set(err, AGOO_ERR_THREAD, "Failed to create the restart thread. %s", strerror(stat));
+    }
+    pthread_detach(thread);
+
+    return AGOO_ERR_OK;
+}
+
+// Called before listening. If this process was started by a restart the
+// listening sockets of the old process are read and given to the binds with
+// the same id. Binds without a match listen as usual and sockets without a
+// bind are closed.
+int
+agoo_handoff_take(agooErr err, agooBind binds) {
+    const char	*s = getenv(AGOO_HANDOFF_ENV);
+    char	id[ID_SIZE];
+    agooBind	b;
+    int		fd;
+    int		cnt = 0;
+
+    if (NULL == s) {
+	return AGOO_ERR_OK;
+    }
+    ho.fd = (int)strtol(s, NULL, 10);
+    // Workers and any later restart must not see it.
+    unsetenv(AGOO_HANDOFF_ENV);
+    while (true) {
+	if (-2 == (fd = recv_rec(ho.fd, id))) {
+	    agoo_log_cat(&agoo_warn_cat, "Failed to read the listening sockets of the old process. Binding the rest.");
+	    close(ho.fd);
+	    ho.fd = -1;
+	    break;
+	}
+	if ('\0' == *id) {
+	    break;
+	}
+	for (b = binds; NULL != b; b = b->next) {
+	    if (0 == b->fd && 0 == strcmp(b->id, id)) {
+		b->fd = fd;
+		cnt++;
+		break;
+	    }
+	}
+	if (NULL == b && 0 <= fd) {
+	    agoo_log_cat(&agoo_info_cat, "Closed the listener on %s from the old process, it is no longer bound.", id);
+	    close(fd);
+	}
+    }
+    agoo_log_cat(&agoo_info_cat, "Took over %d listening sockets from the old process.", cnt);
+
+    return AGOO_ERR_OK;
+}
+
+// Called once the server is started. The main process tells the old
+// process it is serving, workers just close their copy.
+void
+agoo_handoff_done(bool notify) {
+    char	c = READY_BYTE;
+
+    if (0 > ho.fd) {
+	return;
+    }
+    if (notify && 1 != write(ho.fd, &c, 1)) {
+	agoo_log_cat(&agoo_warn_cat, "Failed to tell the old process the restart is done. %s", strerror(errno));
+    }
+    close(ho.fd);
+    ho.fd = -1;
+}
+
+void
+agoo_handoff_cleanup(void) {
+    char	**ap;
+
+    if (NULL != ho.argv) {
+	for (ap = ho.argv; NULL != *ap; ap++) {
+	    AGOO_FREE(*ap);
+	}
+	AGOO_FREE(ho.argv);
+	ho.argv = NULL;
+    }
+}
@@ -0,0 +1,26 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#ifndef AGOO_HANDOFF_H
+#define AGOO_HANDOFF_H
+
+#include <stdbool.h>
+
+#include "bind.h"
+#include "err.h"
+
+// A running server restarts by starting a new copy of itself with the
+// restart command and passing it the listening sockets over a Unix socket
+// pair. Once the new process reports it is serving, the old processes stop
+// accepting and drain their connections before exiting so no connection is
+// refused during the switch.
+
+#define AGOO_HANDOFF_ENV	"AGOO_HANDOFF_FD"
+
+extern char**	agoo_handoff_cmdline(void);
+extern int	agoo_handoff_setup(agooErr err, char **argv, const int *pids, int pid_cnt, double timeout);
+extern int	agoo_handoff_restart(agooErr err);
+extern int	agoo_handoff_take(agooErr err, agooBind binds);
+extern void	agoo_handoff_done(bool notify);
+extern void	agoo_handoff_cleanup(void);
+
+#endif // AGOO_HANDOFF_H
@@ -1,16 +1,25 @@
 // Copyright 2016, 2018 by Peter Ohler, All Rights Reserved
 
+#include <dirent.h>
+#include <errno.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "debug.h"
 #include "dtime.h"
+#include "log.h"
 #include "page.h"
 
 #define PAGE_RECHECK_TIME       5.0
+#define PRELOAD_MAX_DEPTH       16
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS           MAP_ANON
+#endif
 
 #define MAX_KEY_UNIQ            9
 #define MAX_KEY_LEN             1024
@@ -53,6 +62,8 @@ typedef struct _cache {
     char                *root;
     agooGroup           groups;
     HeadRule            head_rules;
+    char                *region; // preloaded responses, read-only
+    size_t              rsize;
 } *Cache;
 
 typedef struct _mime {
@@ -128,6 +139,8 @@ static struct _cache    cache = {
     .root = NULL,
     .groups = NULL,
     .head_rules = NULL,
+    .region = NULL,
+    .rsize = 0,
 };
 
 static char
@@ -411,6 +424,11 @@ agoo_pages_cleanup(void) {
         AGOO_FREE(hr);
     }
     AGOO_FREE(cache.root);
+    if (NULL != cache.region) {
+        munmap(cache.region, cache.rsize);
+        cache.region = NULL;
+        cache.rsize = 0;
+    }
 }
 
 static const char*
@@ -989,3 +1007,127 @@ ERROR:
 
     return AGOO_ERR_MEM(err, "Header Rule");
 }
+
+// Reads the regular files under the directory into the cache as long as
+// the total stays under the limit.
+static void
+preload_dir(const char *dir, bool root, int depth, long max, long *totalp, int *cntp) {
+    char                path[1024];
+    const char          *sep = ('/' == dir[strlen(dir) - 1]) ? "" : "/";
+    DIR                 *d;
+    struct dirent       *de;
+    struct stat         fs;
+    agooPage            p;
+    int                 len;
+
+    if (PRELOAD_MAX_DEPTH < depth || NULL == (d = opendir(dir))) {
+        return;
+    }
+    while (NULL != (de = readdir(d))) {
+        if ('.' == *de->d_name) { // skips ., .., and hidden files
+            continue;
+        }
+        len = snprintf(path, sizeof(path), "%s%s%s", dir, sep, de->d_name);
+        if ((int)sizeof(path) <= len || 0 != stat(path, &fs)) {
+            continue;
+        }
+        if (S_ISDIR(fs.st_mode)) {
+            preload_dir(path, root, depth + 1, max, totalp, cntp);
+            continue;
+        }
+        if (!S_ISREG(fs.st_mode) || max < *totalp + (long)fs.st_size ||
+            NULL != (root ? cache_root_get(path, len) : cache_get(path, len))) {
+            continue;
+        }
+        if (NULL == (p = agoo_page_create(path))) {
+            break;
+        }
+        if (!update_contents(p) || NULL == p->resp ||
+            p == (root ? cache_root_set(path, len, p) : cache_set(path, len, p))) {
+            agoo_page_destroy(p);
+            continue;
+        }
+        *totalp += p->resp->len;
+        (*cntp)++;
+    }
+    closedir(d);
+}
+
+// Moves the responses of the pages in the buckets into the region. If the
+// region is NULL the space needed is returned without moving anything.
+static size_t
+pack_pages(Slot *buckets, char *region) {
+    Slot        *sp = buckets;
+    Slot        s;
+    agooText    t;
+    agooText    r;
+    size_t      size = 0;
+    size_t      span;
+    int         i;
+
+    for (i = PAGE_BUCKET_SIZE; 0 < i; i--, sp++) {
+        for (s = *sp; NULL != s; s = s->next) {
+            if (NULL == s->value || NULL == (r = s->value->resp) || r->pinned) {
+                continue;
+            }
+            span = (sizeof(struct _agooText) + r->len + 16) & ~(size_t)15;
+            if (NULL != region) {
+                t = (agooText)(region + size);
+                t->next = NULL;
+                t->len = r->len;
+                t->alen = r->len;
+                t->bin = r->bin;
+                t->pinned = true;
+                memcpy(t->text, r->text, r->len + 1);
+                s->value->resp = t;
+                agoo_text_release(r);
+            }
+            size += span;
+        }
+    }
+    return size;
+}
+
+// Called before forking. Reads the files under the root and the group
+// directories into the cache, up to max bytes, and then packs all cached
+// responses into one shared region that is made read-only so the workers
+// use the same memory instead of each reading its own copy. A file that
+// changes later is reread into memory private to the process.
+int
+agoo_pages_preload(agooErr err, long max) {
+    agooGroup   g;
+    agooDir     d;
+    long        total = 0;
+    int         cnt = 0;
+    size_t      size;
+    char        *region;
+
+    if (NULL != cache.region) {
+        return agoo_err_set(err, AGOO_ERR_IN_USE, "Pages have already been preloaded.");
+    }
+    if (NULL != cache.root) {
+        preload_dir(cache.root, true, 0, max, &total, &cnt);
+    }
+    for (g = cache.groups; NULL != g; g = g->next) {
+        for (d = g->dirs; NULL != d; d = d->next) {
+            preload_dir(d->path, false, 0, max, &total, &cnt);
+        }
+    }
+    if (0 == (size = pack_pages(cache.buckets, NULL) + pack_pages(cache.ruckets, NULL))) {
+        return AGOO_ERR_OK;
+    }
+    region = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == region) {
+        return agoo_err_set(err, AGOO_ERR_MEMORY, "Failed to map %lu bytes for preloaded pages. %s", (unsigned long)size, strerror(errno));
+    }
+    cache.region = region;
+    cache.rsize = size;
+    size = pack_pages(cache.buckets, region);
+    pack_pages(cache.ruckets, region + size);
+    if (0 != mprotect(region, cache.rsize, PROT_READ)) {
+        agoo_log_cat(&agoo_warn_cat, "Failed to protect preloaded pages. %s", strerror(errno));
+    }
+    agoo_log_cat(&agoo_info_cat, "Preloaded %d files into %lu shared bytes.", cnt, (unsigned long)cache.rsize);
+
+    return AGOO_ERR_OK;
+}
@@ -33,6 +33,7 @@ typedef struct _agooGroup {
 extern int		agoo_pages_init(agooErr err);
 extern int		agoo_pages_set_root(agooErr err, const char *root);
 extern void		agoo_pages_cleanup();
+extern int		agoo_pages_preload(agooErr err, long max);
 
 extern agooGroup	agoo_group_create(const char *path);
 extern agooDir		agoo_group_add(agooErr err, agooGroup g, const char *dir);
@@ -6,13 +6,14 @@
 
 #include "debug.h"
 #include "pub.h"
+#include "slab.h"
 #include "subject.h"
 #include "text.h"
 #include "upgraded.h"
 
 agooPub
 agoo_pub_close(agooUpgraded up) {
-    agooPub	p = (agooPub)AGOO_MALLOC(sizeof(struct _agooPub));
+    agooPub	p = (agooPub)agoo_slab_alloc(AGOO_SLAB_PUB, sizeof(struct _agooPub));
 
     if (NULL != p) {
 	p->next = NULL;
@@ -26,7 +27,7 @@ agoo_pub_close(agooUpgraded up) {
 
 agooPub
 agoo_pub_subscribe(agooUpgraded up, const char *subject, int slen) {
-    agooPub	p = (agooPub)AGOO_MALLOC(sizeof(struct _agooPub));
+    agooPub	p = (agooPub)agoo_slab_alloc(AGOO_SLAB_PUB, sizeof(struct _agooPub));
 
     if (NULL != p) {
 	p->next = NULL;
@@ -40,7 +41,7 @@ agoo_pub_subscribe(agooUpgraded up, const char *subject, int slen) {
 
 agooPub
 agoo_pub_unsubscribe(agooUpgraded up, const char *subject, int slen) {
-    agooPub	p = (agooPub)AGOO_MALLOC(sizeof(struct _agooPub));
+    agooPub	p = (agooPub)agoo_slab_alloc(AGOO_SLAB_PUB, sizeof(struct _agooPub));
 
     if (NULL != p) {
 	p->next = NULL;
@@ -58,7 +59,7 @@ agoo_pub_unsubscribe(agooUpgraded up, const char *subject, int slen) {
 
 agooPub
 agoo_pub_publish(const char *subject, int slen, const char *message, size_t mlen) {
-    agooPub	p = (agooPub)AGOO_MALLOC(sizeof(struct _agooPub));
+    agooPub	p = (agooPub)agoo_slab_alloc(AGOO_SLAB_PUB, sizeof(struct _agooPub));
 
     if (NULL != p) {
 	p->next = NULL;
@@ -75,7 +76,7 @@ agoo_pub_publish(const char *subject, int slen, const char *message, size_t mlen
 
 agooPub
 agoo_pub_write(agooUpgraded up, const char *message, size_t mlen, bool bin) {
-    agooPub	p = (agooPub)AGOO_MALLOC(sizeof(struct _agooPub));
+    agooPub	p = (agooPub)agoo_slab_alloc(AGOO_SLAB_PUB, sizeof(struct _agooPub));
 
     if (NULL != p) {
 	p->next = NULL;
@@ -93,7 +94,7 @@ agoo_pub_write(agooUpgraded up, const char *message, size_t mlen, bool bin) {
 
 agooPub
 agoo_pub_dup(agooPub src) {
-    agooPub	p = (agooPub)AGOO_MALLOC(sizeof(struct _agooPub));
+    agooPub	p = (agooPub)agoo_slab_alloc(AGOO_SLAB_PUB, sizeof(struct _agooPub));
 
     if (NULL != p) {
 	p->next = NULL;
@@ -126,5 +127,5 @@ agoo_pub_destroy(agooPub pub) {
     if (NULL != pub->up) {
 	agoo_upgraded_release(pub->up);
     }
-    AGOO_FREE(pub);
+    agoo_slab_free(pub);
 }
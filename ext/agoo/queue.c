@@ -48,6 +48,7 @@ agoo_queue_multi_init(agooErr err, agooQueue q, size_t qsize, bool multi_push, b
     atomic_init(&q->wait_state, 0);
     q->multi_push = multi_push;
     q->multi_pop = multi_pop;
+    q->spin = 0.0;
     // Create when/if needed.
     q->rsock = 0;
     q->wsock = 0;
@@ -96,9 +97,11 @@ agoo_queue_push(agooQueue q, agooQItem item) {
     if (q->multi_push) {
 	atomic_flag_clear(&q->push_lock);
     }
-    if (0 != q->wsock && WAITING == (long)atomic_load(&q->wait_state)) {
+    // Only the push that moves the state from waiting writes. Storing
+    // notified after the write could land after the popper had already
+    // woken and started waiting again, leaving it to sleep out the wait.
+    if (0 != q->wsock && WAITING == (long)atomic_exchange(&q->wait_state, NOTIFIED)) {
 	if (write(q->wsock, ".", 1)) {}
-	atomic_store(&q->wait_state, NOTIFIED);
     }
 }
 
@@ -134,6 +137,13 @@ agoo_queue_pop(agooQueue q, double timeout) {
     if (q->end <= next) {
 	next = q->q;
     }
+    // In busy poll mode spin for a while before falling back to the pipe.
+    if (0.0 < q->spin && 0.0 < timeout && atomic_load(&q->tail) == next) {
+	double	giveup = dtime() + q->spin;
+
+	while (atomic_load(&q->tail) == next && dtime() < giveup) {
+	}
+    }
     // If the next is the tail then wait for something to be appended.
     for (cnt = (int)(timeout / (double)WAIT_MSECS * 1000.0); atomic_load(&q->tail) == next; cnt--) {
 	struct pollfd	pa;
@@ -145,6 +155,12 @@ agoo_queue_pop(agooQueue q, double timeout) {
 	    return NULL;
 	}
 	pa.fd = agoo_queue_listen(q);
+	// An append between the check above and announcing the wait would not
+	// write to the pipe so look again before blocking.
+	if (atomic_load(&q->tail) != next) {
+	    agoo_queue_release(q);
+	    break;
+	}
 	pa.events = POLLIN;
 	pa.revents = 0;
 	if (0 < poll(&pa, 1, WAIT_MSECS)) {
@@ -21,6 +21,7 @@ typedef struct _agooQueue {
     atomic_flag		push_lock; // set to true when push in progress
     atomic_flag		pop_lock; // set to true when push in progress
     atomic_int		wait_state;
+    double		spin; // seconds a pop spins before blocking
     int			rsock;
     int			wsock;
 } *agooQueue;
@@ -1,5 +1,8 @@
 // Copyright (c) 2018, Peter Ohler, All rights reserved.
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,50 +16,121 @@
 #include <poll.h>
 #endif
 
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_EXT_ARG) && defined(IORING_POLL_UPDATE_EVENTS) && defined(IO_URING_OP_SUPPORTED)
+#define USE_IO_URING	1
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include "atomic.h"
 #include "debug.h"
 #include "dtime.h"
 #include "log.h"
 #include "ready.h"
+#include "slab.h"
 
 #define CHECK_FREQ		0.5
 // milliseconds
 #define MAX_WAIT		10
 
+// The timer wheel has four levels of 64 slots with a 10 millisecond tick
+// which covers about 46 hours.
+#define TICK			0.01
+#define WHEEL_BITS		6
+#define WHEEL_SIZE		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS		4
+
 #ifdef HAVE_SYS_EPOLL_H
 #define EPOLL_SIZE		100
 #else
 #define INITIAL_POLL_SIZE	1024
 #endif
 
-typedef struct _link {
-    struct _link	*next;
-    struct _link	*prev;
+#ifdef USE_IO_URING
+#define RING_ENTRIES		256
+// Completions of poll updates and removals are tagged in the low bit of the
+// user data so they can be skipped without looking at the link.
+#define RING_TAG		1ULL
+
+typedef struct _ring {
+    int			fd;
+    unsigned		*sq_head;
+    unsigned		*sq_tail;
+    unsigned		*sq_mask;
+    unsigned		*sq_array;
+    unsigned		sq_entries;
+    unsigned		tail;
+    struct io_uring_sqe	*sqes;
+    unsigned		*cq_head;
+    unsigned		*cq_tail;
+    unsigned		*cq_mask;
+    struct io_uring_cqe	*cqes;
+    void		*sq_ptr;
+    size_t		sq_len;
+    void		*cq_ptr;
+    size_t		cq_len;
+    size_t		sqe_len;
+} *Ring;
+#endif
+
+typedef struct _agooLink {
+    struct _agooLink	*next;
+    struct _agooLink	*prev;
     int			fd;
     void		*ctx;
     agooHandler		handler;
-#ifdef HAVE_SYS_EPOLL_H
-    uint32_t		events; // last events set
-#else
+    agooReadyIO		io; // last interest set
+    struct _agooLink	*tnext;
+    struct _agooLink	*tprev;
+    struct _agooLink	**slot; // NULL if not in the timer wheel
+    uint64_t		expires; // tick
+    struct _agooLink	*dnext;
+    atomic_flag		dirty; // set while on the ready dirty list
+#ifndef HAVE_SYS_EPOLL_H
     struct pollfd	*pp;
 #endif
+#ifdef USE_IO_URING
+    bool		armed; // a poll is outstanding in the ring
+    bool		removed; // freed when the outstanding poll completes
+#endif
 } *Link;
 
 struct _agooReady {
     Link	links;
     int		lcnt;
-    double	next_check;
+    Link	wheel[WHEEL_LEVELS][WHEEL_SIZE];
+    uint64_t	tick;
+    // Links that may have a new interest, marked from any thread.
+    _Atomic(Link)	dirty;
+    double	idle; // seconds spent waiting since the last agoo_ready_idle()
+    double	spin; // busy poll budget in seconds, 0 to always block
+    bool	hot; // the last wait found events
+    struct _agooPollStats	stats;
+    pthread_t	thread; // the thread that polls
+    int		wake_fds[2];
+    Link	wake;
 #ifdef HAVE_SYS_EPOLL_H
     int		epoll_fd;
+    struct epoll_event	events[EPOLL_SIZE];
 #else
     struct pollfd	*pa;
     struct pollfd	*pend;
+    nfds_t	pcnt;
+#endif
+#ifdef USE_IO_URING
+    Ring	ring; // NULL unless agoo_ready_io_uring() was called
+    Link	zombies;
 #endif
 };
 
 static Link
 link_create(agooErr err, int fd, void *ctx, agooHandler handler) {
-    // TBD use block allocator
-    Link	link = (Link)AGOO_MALLOC(sizeof(struct _link));
+    Link	link = (Link)agoo_slab_alloc(AGOO_SLAB_LINK, sizeof(struct _agooLink));
 
     if (NULL == link) {
 	AGOO_ERR_MEM(err, "Connection Link");
@@ -67,10 +141,331 @@ link_create(agooErr err, int fd, void *ctx, agooHandler handler) {
 	link->fd = fd;
 	link->ctx = ctx;
 	link->handler = handler;
+	link->tnext = NULL;
+	link->tprev = NULL;
+	link->slot = NULL;
+	link->expires = 0;
+	link->io = AGOO_READY_IN;
+	link->dnext = NULL;
+	agoo_atomic_flag_init(&link->dirty);
+#ifdef USE_IO_URING
+	link->armed = false;
+	link->removed = false;
+#endif
     }
     return link;
 }
 
+#ifdef USE_IO_URING
+static void
+ring_destroy(Ring ring) {
+    if (NULL != ring->sqes) {
+	munmap(ring->sqes, ring->sqe_len);
+    }
+    if (NULL != ring->cq_ptr && ring->cq_ptr != ring->sq_ptr) {
+	munmap(ring->cq_ptr, ring->cq_len);
+    }
+    if (NULL != ring->sq_ptr) {
+	munmap(ring->sq_ptr, ring->sq_len);
+    }
+    close(ring->fd);
+    AGOO_FREE(ring);
+}
+
+static void*
+ring_map(int fd, size_t len, off_t off) {
+    void	*ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, off);
+
+    return (MAP_FAILED == ptr) ? NULL : ptr;
+}
+
+static Ring
+ring_create(agooErr err) {
+    struct io_uring_params	p;
+    Ring			ring;
+
+    if (NULL == (ring = (Ring)AGOO_CALLOC(1, sizeof(struct _ring)))) {
+	AGOO_ERR_MEM(err, "io_uring");
+	return NULL;
+    }
+    memset(&p, 0, sizeof(p));
+    if (0 > (ring->fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p))) {
+	agoo_err_no(err, "io_uring setup failed");
+	AGOO_FREE(ring);
+	return NULL;
+    }
+    if (0 == (p.features & IORING_FEAT_EXT_ARG)) {
+	agoo_err_set(err, AGOO_ERR_IMPL, "io_uring does not support wait timeouts on this kernel.");
+	ring_destroy(ring);
+	return NULL;
+    }
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (0 != (p.features & IORING_FEAT_SINGLE_MMAP) && ring->sq_len < ring->cq_len) {
+	ring->sq_len = ring->cq_len;
+    }
+    ring->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (NULL == (ring->sq_ptr = ring_map(ring->fd, ring->sq_len, IORING_OFF_SQ_RING)) ||
+	NULL == (ring->cq_ptr = (0 != (p.features & IORING_FEAT_SINGLE_MMAP)) ?
+		 ring->sq_ptr : ring_map(ring->fd, ring->cq_len, IORING_OFF_CQ_RING)) ||
+	NULL == (ring->sqes = (struct io_uring_sqe*)ring_map(ring->fd, ring->sqe_len, IORING_OFF_SQES))) {
+	agoo_err_no(err, "io_uring map failed");
+	ring_destroy(ring);
+	return NULL;
+    }
+    ring->sq_head = (unsigned*)((char*)ring->sq_ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned*)((char*)ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)((char*)ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)((char*)ring->sq_ptr + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->tail = *ring->sq_tail;
+    ring->cq_head = (unsigned*)((char*)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned*)((char*)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)((char*)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ptr + p.cq_off.cqes);
+
+    return ring;
+}
+
+// Submits all queued entries and, if wait is not zero, waits up to wait
+// milliseconds for at least one completion. A single system call does both.
+static int
+ring_enter(Ring ring, int wait) {
+    struct __kernel_timespec		ts = {
+	.tv_sec = wait / 1000,
+	.tv_nsec = (wait % 1000) * 1000000L,
+    };
+    struct io_uring_getevents_arg	arg = {
+	.sigmask = 0,
+	.sigmask_sz = 0,
+	.ts = (uint64_t)(uintptr_t)&ts,
+    };
+    unsigned	submit = ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (0 == wait) {
+	return (int)syscall(__NR_io_uring_enter, ring->fd, submit, 0, 0, NULL, 0);
+    }
+    return (int)syscall(__NR_io_uring_enter, ring->fd, submit, 1,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+// Returns a cleared submission entry. Entries are only handed to the kernel
+// by ring_enter() so the tail can be advanced before the entry is filled in.
+static struct io_uring_sqe*
+ring_sqe(Ring ring) {
+    struct io_uring_sqe	*sqe;
+    unsigned		index;
+
+    if (ring->sq_entries <= ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) {
+	ring_enter(ring, 0);
+    }
+    index = ring->tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->tail++;
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+// The poll opcodes are checked with a probe but that does not cover the
+// flag used to update a poll in place, added in Linux 5.13. An update of a
+// poll that does not exist fails with ENOENT when the flag is understood
+// and EINVAL when it is not.
+static int
+ring_probe(agooErr err, Ring ring) {
+    struct io_uring_probe	*probe;
+    struct io_uring_cqe		*cqe;
+    struct io_uring_sqe		*sqe;
+    size_t			size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    unsigned			head;
+    int				res = 0;
+
+    if (NULL == (probe = (struct io_uring_probe*)AGOO_CALLOC(1, size))) {
+	return AGOO_ERR_MEM(err, "io_uring probe");
+    }
+    if (0 > syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) ||
+	probe->last_op < IORING_OP_POLL_REMOVE ||
+	0 == (probe->ops[IORING_OP_POLL_ADD].flags & IO_URING_OP_SUPPORTED) ||
+	0 == (probe->ops[IORING_OP_POLL_REMOVE].flags & IO_URING_OP_SUPPORTED)) {
+	AGOO_FREE(probe);
+	return agoo_err_set(err, AGOO_ERR_IMPL, "io_uring does not support polling on this kernel.");
+    }
+    AGOO_FREE(probe);
+
+    sqe = ring_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = RING_TAG; // never used by a link
+    sqe->len = IORING_POLL_UPDATE_EVENTS;
+    sqe->user_data = RING_TAG;
+    ring_enter(ring, 100);
+    head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+	return agoo_err_set(err, AGOO_ERR_IMPL, "io_uring poll update probe did not complete.");
+    }
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    if (-ENOENT != res) {
+	return agoo_err_set(err, AGOO_ERR_IMPL, "io_uring does not support poll updates on this kernel.");
+    }
+    return AGOO_ERR_OK;
+}
+
+// Polls are one-shot so a link is re-armed after each completion. That
+// matches the level triggered behavior the handlers expect since a socket
+// that is still readable completes the new poll immediately. An armed link
+// with a new interest has its poll updated in place.
+static void
+ring_arm(Ring ring, Link link, agooReadyIO io) {
+    struct io_uring_sqe	*sqe;
+    uint32_t		mask = 0;
+
+    if (link->armed && io == link->io) {
+	return;
+    }
+    switch (io) {
+    case AGOO_READY_IN:
+	mask = POLLIN;
+	break;
+    case AGOO_READY_OUT:
+	mask = POLLOUT;
+	break;
+    case AGOO_READY_BOTH:
+	mask = POLLIN | POLLOUT;
+	break;
+    case AGOO_READY_NONE:
+    default:
+	// still armed to pick up errors and hangups
+	break;
+    }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    mask = (mask << 16) | (mask >> 16);
+#endif
+    sqe = ring_sqe(ring);
+    sqe->poll32_events = mask;
+    if (link->armed) {
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)link;
+	sqe->len = IORING_POLL_UPDATE_EVENTS;
+	sqe->user_data = (uint64_t)(uintptr_t)link | RING_TAG;
+    } else {
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = link->fd;
+	sqe->user_data = (uint64_t)(uintptr_t)link;
+	link->armed = true;
+    }
+    link->io = io;
+}
+#endif
+
+static uint64_t
+time_tick(double t) {
+    return (0.0 < t) ? (uint64_t)(t / TICK) + 1 : 0;
+}
+
+static void
+wheel_unlink(Link link) {
+    if (NULL == link->slot) {
+	return;
+    }
+    if (NULL == link->tprev) {
+	*link->slot = link->tnext;
+    } else {
+	link->tprev->tnext = link->tnext;
+    }
+    if (NULL != link->tnext) {
+	link->tnext->tprev = link->tprev;
+    }
+    link->tnext = NULL;
+    link->tprev = NULL;
+    link->slot = NULL;
+}
+
+// The level is the highest group of bits that differ between the expiration
+// and the current tick so a slot is always ahead of the current position at
+// that level. Deadlines beyond the top level go in the next top level slot
+// and are placed again when that slot is cascaded.
+static void
+wheel_insert(agooReady ready, Link link) {
+    uint64_t	diff;
+    Link	*slot;
+    int		level = 0;
+
+    if (link->expires <= ready->tick) {
+	link->expires = ready->tick + 1;
+    }
+    for (diff = (link->expires ^ ready->tick) >> WHEEL_BITS; 0 != diff; diff >>= WHEEL_BITS) {
+	level++;
+    }
+    if (WHEEL_LEVELS <= level) {
+	level = WHEEL_LEVELS - 1;
+	slot = &ready->wheel[level][((ready->tick >> (WHEEL_BITS * level)) + 1) & WHEEL_MASK];
+    } else {
+	slot = &ready->wheel[level][(link->expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    }
+    link->slot = slot;
+    link->tprev = NULL;
+    link->tnext = *slot;
+    if (NULL != *slot) {
+	(*slot)->tprev = link;
+    }
+    *slot = link;
+}
+
+// Places the link in the timer wheel according to the handler deadline. If
+// retry is true and the deadline has already passed the link is checked
+// again after CHECK_FREQ instead of on the next tick.
+static void
+link_schedule(agooReady ready, Link link, double now, bool retry) {
+    double	when;
+    uint64_t	expires;
+
+    if (NULL == link->handler->check) {
+	return;
+    }
+    if (NULL == link->handler->deadline) {
+	when = now + CHECK_FREQ;
+    } else if ((when = link->handler->deadline(link->ctx)) <= now && retry) {
+	when = now + CHECK_FREQ;
+    }
+    expires = time_tick(when);
+    if (NULL != link->slot && expires == link->expires) {
+	return;
+    }
+    wheel_unlink(link);
+    link->expires = expires;
+    wheel_insert(ready, link);
+}
+
+static agooReadyIO
+wake_io(void *ctx) {
+    return AGOO_READY_IN;
+}
+
+static bool
+wake_read(agooReady ready, void *ctx) {
+    char	buf[64];
+
+    while (0 < read(ready->wake_fds[0], buf, sizeof(buf))) {
+    }
+    return true;
+}
+
+static struct _agooHandler	wake_handler = {
+    .io = wake_io,
+    .check = NULL,
+    .deadline = NULL,
+    .read = wake_read,
+    .write = NULL,
+    .error = NULL,
+    .destroy = NULL,
+};
+
+// Must be called from the thread that will call agoo_ready_go().
 agooReady
 agoo_ready_create(agooErr err) {
     agooReady	ready = (agooReady)AGOO_MALLOC(sizeof(struct _agooReady));
@@ -81,7 +476,19 @@ agoo_ready_create(agooErr err) {
 	//DEBUG_ALLOC(mem_???, c);
 	ready->links = NULL;
 	ready->lcnt = 0;
-	ready->next_check = dtime() + CHECK_FREQ;
+	memset(ready->wheel, 0, sizeof(ready->wheel));
+	ready->tick = time_tick(dtime());
+	atomic_init(&ready->dirty, NULL);
+	ready->idle = 0.0;
+	ready->spin = 0.0;
+	ready->hot = false;
+	memset(&ready->stats, 0, sizeof(ready->stats));
+	ready->thread = pthread_self();
+	ready->wake = NULL;
+#ifdef USE_IO_URING
+	ready->ring = NULL;
+	ready->zombies = NULL;
+#endif
 #ifdef HAVE_SYS_EPOLL_H
 	if (0 > (ready->epoll_fd = epoll_create(1))) {
 	    agoo_err_no(err, "epoll create failed");
@@ -96,26 +503,75 @@ agoo_ready_create(agooErr err) {
 	    memset(ready->pa, 0, size);
 	}
 #endif
+	// Other threads that mark a link dirty write to the wake pipe so the
+	// loop does not sit out the rest of its wait.
+	if (0 != pipe(ready->wake_fds)) {
+	    agoo_err_no(err, "wake pipe create failed");
+	    return NULL;
+	}
+	fcntl(ready->wake_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(ready->wake_fds[1], F_SETFL, O_NONBLOCK);
+	if (AGOO_ERR_OK != agoo_ready_add(err, ready, ready->wake_fds[0], &wake_handler, ready, &ready->wake)) {
+	    return NULL;
+	}
     }
     return ready;
 }
 
+// Switches the ready to io_uring. Must be called before any links are
+// added. If io_uring is not available an error is returned and the ready
+// continues to use epoll or poll. The ring only replaces the readiness wait
+// and interest changes. The handlers still read and write the sockets
+// directly.
+int
+agoo_ready_io_uring(agooErr err, agooReady ready) {
+#ifdef USE_IO_URING
+    if (ready->wake != ready->links || NULL != ready->wake->next) {
+	return agoo_err_set(err, AGOO_ERR_IN_USE, "io_uring must be selected before connections are added.");
+    }
+    if (NULL == ready->ring) {
+	if (NULL == (ready->ring = ring_create(err))) {
+	    return err->code;
+	}
+	if (AGOO_ERR_OK != ring_probe(err, ready->ring)) {
+	    ring_destroy(ready->ring);
+	    ready->ring = NULL;
+	    return err->code;
+	}
+    }
+    return AGOO_ERR_OK;
+#else
+    return agoo_err_set(err, AGOO_ERR_IMPL, "io_uring is not supported by this build.");
+#endif
+}
+
 void
 agoo_ready_destroy(agooReady ready) {
     Link	link;
 
+#ifdef USE_IO_URING
+    if (NULL != ready->ring) {
+	ring_destroy(ready->ring);
+    }
+    while (NULL != (link = ready->zombies)) {
+	ready->zombies = link->next;
+	agoo_slab_free(link);
+    }
+#endif
     while (NULL != (link = ready->links)) {
 	ready->links = link->next;
 	if (NULL != link->handler->destroy) {
 	    link->handler->destroy(link->ctx);
 	}
-	AGOO_FREE(link);
+	agoo_slab_free(link);
     }
 #ifdef HAVE_SYS_EPOLL_H
     close(ready->epoll_fd);
 #else
     AGOO_FREE(ready->pa);
 #endif
+    close(ready->wake_fds[0]);
+    close(ready->wake_fds[1]);
     AGOO_FREE(ready);
 }
 
@@ -124,24 +580,35 @@ agoo_ready_add(agooErr		err,
 	       agooReady	ready,
 	       int		fd,
 	       agooHandler	handler,
-	       void		*ctx) {
+	       void		*ctx,
+	       agooLink		*linkp) {
     Link	link;
 
     if (NULL == (link = link_create(err, fd, ctx, handler))) {
 	return err->code;
     }
+    if (NULL != linkp) {
+	*linkp = link;
+    }
     link->next = ready->links;
     if (NULL != ready->links) {
 	ready->links->prev = link;
     }
     ready->links = link;
     ready->lcnt++;
+    link_schedule(ready, link, dtime(), false);
 
+#ifdef USE_IO_URING
+    if (NULL != ready->ring) {
+	// armed when the dirty link is reconciled
+	agoo_ready_dirty(ready, link);
+	return AGOO_ERR_OK;
+    }
+#endif
 #ifdef HAVE_SYS_EPOLL_H
-    link->events = EPOLLIN;
     {
 	struct epoll_event	event = {
-	    .events = link->events,
+	    .events = EPOLLIN,
 	    .data = {
 		.ptr = link,
 	    },
@@ -168,9 +635,96 @@ agoo_ready_add(agooErr		err,
 	memset(ready->pa, 0, size);
     }
 #endif
+    agoo_ready_dirty(ready, link);
+
     return AGOO_ERR_OK;
 }
 
+// Returns true if the dirty list was empty.
+static bool
+dirty_push(agooReady ready, Link link) {
+    Link	head = (Link)atomic_load(&ready->dirty);
+
+    do {
+	link->dnext = head;
+    } while (!atomic_compare_exchange_weak(&ready->dirty, &head, link));
+
+    return NULL == head;
+}
+
+// Marks a link so its interest is reconciled on the next pass of
+// agoo_ready_go. Safe to call from any thread as long as the link has not
+// been removed.
+void
+agoo_ready_dirty(agooReady ready, agooLink link) {
+    if (!atomic_flag_test_and_set(&link->dirty) &&
+	dirty_push(ready, link) &&
+	!pthread_equal(pthread_self(), ready->thread)) {
+	if (write(ready->wake_fds[1], ".", 1)) {}
+    }
+}
+
+// Asks the handler for the current interest and updates the poller only if
+// it has changed.
+static void
+link_update(agooReady ready, Link link) {
+    agooReadyIO	io = link->handler->io(link->ctx);
+
+#ifdef USE_IO_URING
+    if (NULL != ready->ring) {
+	ring_arm(ready->ring, link, io);
+	return;
+    }
+#endif
+    if (io == link->io) {
+	return;
+    }
+    link->io = io;
+#ifdef HAVE_SYS_EPOLL_H
+    {
+	struct epoll_event	event = {
+	    .events = 0,
+	    .data = {
+		.ptr = link,
+	    },
+	};
+	switch (io) {
+	case AGOO_READY_IN:
+	    event.events = EPOLLIN;
+	    break;
+	case AGOO_READY_OUT:
+	    event.events = EPOLLOUT;
+	    break;
+	case AGOO_READY_BOTH:
+	    event.events = EPOLLIN | EPOLLOUT;
+	    break;
+	case AGOO_READY_NONE:
+	default:
+	    // ignore, either dead or closing
+	    break;
+	}
+	if (0 > epoll_ctl(ready->epoll_fd, EPOLL_CTL_MOD, link->fd, &event)) {
+	    agoo_log_cat(&agoo_error_cat, "epoll modify failed. %s", strerror(errno));
+	}
+    }
+#endif
+}
+
+// Takes a link off the dirty list. Only the ready thread pops from the list
+// so the whole list is taken and all but the link are pushed back.
+static void
+dirty_remove(agooReady ready, Link link) {
+    Link	dl = (Link)atomic_exchange(&ready->dirty, NULL);
+    Link	next;
+
+    for (; NULL != dl; dl = next) {
+	next = dl->dnext;
+	if (dl != link) {
+	    dirty_push(ready, dl);
+	}
+    }
+}
+
 static void
 ready_remove(agooReady ready, Link link) {
     if (NULL == link->prev) {
@@ -181,7 +735,12 @@ ready_remove(agooReady ready, Link link) {
     if (NULL != link->next) {
 	link->next->prev = link->prev;
     }
+    wheel_unlink(link);
+    ready->lcnt--;
 #ifdef HAVE_SYS_EPOLL_H
+#ifdef USE_IO_URING
+    if (NULL == ready->ring)
+#endif
     {
 	struct epoll_event	event = {
 	    .events = 0,
@@ -194,76 +753,290 @@ ready_remove(agooReady ready, Link link) {
 	}
     }
 #endif
+    // Destroying the context first guarantees no other thread is still
+    // marking the link dirty.
     if (NULL != link->handler->destroy) {
 	link->handler->destroy(link->ctx);
     }
-    AGOO_FREE(link);
-    ready->lcnt--;
+    if (atomic_flag_test_and_set(&link->dirty)) {
+	dirty_remove(ready, link);
+    }
+#ifdef USE_IO_URING
+    if (NULL != ready->ring && link->armed) {
+	// The kernel still refers to the link until the poll is cancelled.
+	struct io_uring_sqe	*sqe = ring_sqe(ready->ring);
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)link;
+	sqe->user_data = (uint64_t)(uintptr_t)link | RING_TAG;
+	link->removed = true;
+	link->prev = NULL;
+	link->next = ready->zombies;
+	if (NULL != ready->zombies) {
+	    ready->zombies->prev = link;
+	}
+	ready->zombies = link;
+
+	return;
+    }
+#endif
+    agoo_slab_free(link);
+}
+
+// Moves the links in a slot back into the wheel. Each lands at a lower level
+// or in level zero if it expires during the current tick.
+static void
+wheel_cascade(agooReady ready, int level) {
+    Link	*slot = &ready->wheel[level][(ready->tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    Link	link = *slot;
+    Link	next;
+
+    *slot = NULL;
+    for (; NULL != link; link = next) {
+	next = link->tnext;
+	link->slot = NULL;
+	wheel_insert(ready, link);
+    }
+}
+
+// Advances the wheel to the current time, calling check on each link as its
+// deadline is reached. Only expiring links are visited.
+static void
+wheel_advance(agooReady ready, double now) {
+    uint64_t	end = time_tick(now);
+    Link	link;
+    Link	next;
+    Link	*slot;
+    int		level;
+
+    while (ready->tick < end) {
+	ready->tick++;
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+	    if (0 != (ready->tick & ((1ULL << (WHEEL_BITS * level)) - 1))) {
+		break;
+	    }
+	    wheel_cascade(ready, level);
+	}
+	slot = &ready->wheel[0][ready->tick & WHEEL_MASK];
+	link = *slot;
+	*slot = NULL;
+	for (; NULL != link; link = next) {
+	    next = link->tnext;
+	    link->tnext = NULL;
+	    link->tprev = NULL;
+	    link->slot = NULL;
+	    if (link->handler->check(link->ctx, now)) {
+		ready_remove(ready, link);
+	    } else {
+		link_update(ready, link);
+		link_schedule(ready, link, now, true);
+	    }
+	}
+    }
 }
 
 static void
-ready_check_remove(agooReady ready, Link link) {
+ready_check_remove(agooReady ready, Link link, double now) {
     if (NULL == link->handler->check || link->handler->check(link->ctx, 0.0)) {
 	ready_remove(ready, link);
+    } else {
+	link_update(ready, link);
+	link_schedule(ready, link, now, true);
+    }
+}
+
+// Reconciles the interest of the links marked dirty since the last pass. The
+// list is taken in one exchange and the next link is read before a link is
+// cleared so a link marked again while the list is walked goes onto the new
+// list.
+static void
+ready_update_dirty(agooReady ready) {
+    Link	link;
+    Link	next;
+    double	now;
+
+    if (NULL == atomic_load(&ready->dirty)) {
+	return;
+    }
+    now = dtime();
+    for (link = (Link)atomic_exchange(&ready->dirty, NULL); NULL != link; link = next) {
+	next = link->dnext;
+	link->dnext = NULL;
+	atomic_flag_clear(&link->dirty);
+	link_update(ready, link);
+	// The change may also have moved the deadline, such as a connection
+	// marked dead.
+	link_schedule(ready, link, now, false);
+    }
+}
+
+// Waits for events with the backend wait function. In busy poll mode, and
+// only if the last wait found events, the backend is polled without
+// blocking until something turns up or the spin budget is used. Otherwise,
+// or after that, the loop parks in a blocking wait. Nothing is waited on if
+// another thread has marked a link dirty.
+static int
+ready_wait(agooReady ready, int (*wait)(agooReady ready, int timeout)) {
+    double	start = dtime();
+    double	now = start;
+    int		cnt = 0;
+
+    if (0.0 < ready->spin && ready->hot) {
+	double	giveup = start + ready->spin;
+
+	while (0 == (cnt = wait(ready, 0)) && NULL == atomic_load(&ready->dirty) && (now = dtime()) < giveup) {
+	}
+	now = dtime();
+	ready->stats.spin += now - start;
+	if (0 != cnt || NULL != atomic_load(&ready->dirty)) {
+	    ready->stats.spin_wakes++;
+	}
+    }
+    if (0 == cnt && NULL == atomic_load(&ready->dirty)) {
+	cnt = wait(ready, MAX_WAIT);
+	ready->stats.park += dtime() - now;
+	ready->stats.parks++;
+    }
+    ready->idle += dtime() - start;
+    ready->hot = (0 < cnt);
+
+    return cnt;
+}
+
+#ifdef USE_IO_URING
+static int
+ring_wait(agooReady ready, int timeout) {
+    Ring	ring = ready->ring;
+
+    if (0 > ring_enter(ring, timeout) && ETIME != errno && EINTR != errno && EBUSY != errno) {
+	return -1;
+    }
+    return (int)(__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) - *ring->cq_head);
+}
+
+static int
+ring_go(agooErr err, agooReady ready) {
+    Ring		ring = ready->ring;
+    struct io_uring_cqe	*cqe;
+    unsigned		head;
+    uint64_t		data;
+    int			res;
+    double		now;
+    Link		link;
+
+    res = ready_wait(ready, ring_wait);
+    now = dtime();
+    if (0 > res) {
+	agoo_err_no(err, "io_uring error.");
+	agoo_log_cat(&agoo_error_cat, "%s", err->msg);
+	return err->code;
+    }
+    head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+	cqe = &ring->cqes[head & *ring->cq_mask];
+	data = cqe->user_data;
+	res = cqe->res;
+	head++;
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	if (0 != (data & RING_TAG)) {
+	    continue;
+	}
+	link = (Link)(uintptr_t)data;
+	link->armed = false;
+	if (link->removed) {
+	    if (NULL == link->prev) {
+		ready->zombies = link->next;
+	    } else {
+		link->prev->next = link->next;
+	    }
+	    if (NULL != link->next) {
+		link->next->prev = link->prev;
+	    }
+	    agoo_slab_free(link);
+	    continue;
+	}
+	if (0 > res) {
+	    res = POLLERR;
+	}
+	if (0 != (res & POLLIN) && NULL != link->handler->read) {
+	    if (!link->handler->read(ready, link->ctx)) {
+		ready_check_remove(ready, link, now);
+		continue;
+	    }
+	}
+	if (0 != (res & POLLOUT) && NULL != link->handler->write) {
+	    if (!link->handler->write(link->ctx)) {
+		ready_check_remove(ready, link, now);
+		continue;
+	    }
+	}
+	if (0 != (res & (POLLERR | POLLHUP | POLLNVAL | POLLPRI))) {
+	    if (NULL != link->handler->error) {
+		link->handler->error(link->ctx);
+	    }
+	    ready_check_remove(ready, link, now);
+	    continue;
+	}
+	link_update(ready, link);
+	link_schedule(ready, link, now, false);
     }
+    return AGOO_ERR_OK;
+}
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+static int
+epoll_wait_events(agooReady ready, int timeout) {
+    return epoll_wait(ready->epoll_fd, ready->events, EPOLL_SIZE, timeout);
+}
+#else
+static int
+poll_links(agooReady ready, int timeout) {
+    return poll(ready->pa, ready->pcnt, timeout);
 }
+#endif
 
 int
 agoo_ready_go(agooErr err, agooReady ready) {
     double	now;
     Link	link;
-    Link	next;
 
+    ready_update_dirty(ready);
+#ifdef USE_IO_URING
+    if (NULL != ready->ring) {
+	int	code = ring_go(err, ready);
+
+	wheel_advance(ready, dtime());
+
+	return code;
+    }
+#endif
 #ifdef HAVE_SYS_EPOLL_H
-    struct epoll_event	events[EPOLL_SIZE];
     struct epoll_event	*ep;
     int			cnt;
 
-    for (link = ready->links; NULL != link; link = link->next) {
-	struct epoll_event	event = {
-	    .events = 0,
-	    .data = {
-		.ptr = link,
-	    },
-	};
-	switch (link->handler->io(link->ctx)) {
-	case AGOO_READY_IN:
-	    event.events = EPOLLIN;
-	    break;
-	case AGOO_READY_OUT:
-	    event.events = EPOLLOUT;
-	    break;
-	case AGOO_READY_BOTH:
-	    event.events = EPOLLIN | EPOLLOUT;
-	    break;
-	case AGOO_READY_NONE:
-	default:
-	    // ignore, either dead or closing
-	    break;
-	}
-	if (event.events != link->events) {
-	    if (0 > epoll_ctl(ready->epoll_fd, EPOLL_CTL_MOD, link->fd, &event)) {
-		agoo_err_no(err, "epoll modifiy failed");
-	    }
-	    link->events = event.events;
+    cnt = ready_wait(ready, epoll_wait_events);
+    now = dtime();
+    if (0 > cnt) {
+	if (EINTR == errno) {
+	    return AGOO_ERR_OK;
 	}
-    }
-    if (0 > (cnt = epoll_wait(ready->epoll_fd, events, sizeof(events) / sizeof(*events), MAX_WAIT))) {
 	agoo_err_no(err, "Polling error.");
 	agoo_log_cat(&agoo_error_cat, "%s", err->msg);
 	return err->code;
     }
-    for (ep = events; 0 < cnt; ep++, cnt--) {
+    for (ep = ready->events; 0 < cnt; ep++, cnt--) {
 	link = (Link)ep->data.ptr;
 	if (0 != (ep->events & EPOLLIN) && NULL != link->handler->read) {
 	    if (!link->handler->read(ready, link->ctx)) {
-		ready_check_remove(ready, link);
+		ready_check_remove(ready, link, now);
 		continue;
 	    }
 	}
 	if (0 != (ep->events & EPOLLOUT && NULL != link->handler->write)) {
 	    if (!link->handler->write(link->ctx)) {
-		ready_check_remove(ready, link);
+		ready_check_remove(ready, link, now);
 		continue;
 	    }
 	}
@@ -271,20 +1044,23 @@ agoo_ready_go(agooErr err, agooReady ready) {
 	    if (NULL != link->handler->error) {
 		link->handler->error(link->ctx);
 	    }
-	    ready_check_remove(ready, link);
+	    ready_check_remove(ready, link, now);
 	    continue;
 	}
+	link_update(ready, link);
+	link_schedule(ready, link, now, false);
     }
 #else
     struct pollfd	*pp;
+    Link		next;
     int			i;
 
-    // Setup the poll events.
+    // Setup the poll events from the last interest of each link.
     for (link = ready->links, pp = ready->pa; NULL != link; link = link->next, pp++) {
 	pp->fd = link->fd;
 	pp->revents = 0;
 	link->pp = pp;
-	switch (link->handler->io(link->ctx)) {
+	switch (link->io) {
 	case AGOO_READY_IN:
 	    pp->events = POLLIN;
 	    break;
@@ -302,8 +1078,11 @@ agoo_ready_go(agooErr err, agooReady ready) {
 	    break;
 	}
     }
-    if (0 > (i = poll(ready->pa, (nfds_t)(pp - ready->pa), MAX_WAIT))) {
-	if (EAGAIN == errno) {
+    ready->pcnt = (nfds_t)(pp - ready->pa);
+    i = ready_wait(ready, poll_links);
+    now = dtime();
+    if (0 > i) {
+	if (EAGAIN == errno || EINTR == errno) {
 	    return AGOO_ERR_OK;
 	}
 	agoo_err_no(err, "Polling error.");
@@ -319,13 +1098,13 @@ agoo_ready_go(agooErr err, agooReady ready) {
 	    pp = link->pp;
 	    if (0 != (pp->revents & POLLIN) && NULL != link->handler->read) {
 		if (!link->handler->read(ready, link->ctx)) {
-		    ready_check_remove(ready, link);
+		    ready_check_remove(ready, link, now);
 		    continue;
 		}
 	    }
 	    if (0 != (pp->revents & POLLOUT && NULL != link->handler->write)) {
 		if (!link->handler->write(link->ctx)) {
-		    ready_check_remove(ready, link);
+		    ready_check_remove(ready, link, now);
 		    continue;
 		}
 	    }
@@ -333,31 +1112,56 @@ agoo_ready_go(agooErr err, agooReady ready) {
 		if (NULL != link->handler->error) {
 		    link->handler->error(link->ctx);
 		}
-		ready_check_remove(ready, link);
+		ready_check_remove(ready, link, now);
 		continue;
 	    }
+	    link_update(ready, link);
+	    link_schedule(ready, link, now, false);
 	}
     }
 #endif
-    // Periodically check the connections to see if they are dead or not.
-    now = dtime();
-    if (ready->next_check <= now) {
-	for (link = ready->links; NULL != link; link = next) {
-	    next = link->next;
-	    if (NULL != link->handler->check && link->handler->check(link->ctx, now)) {
-		ready_remove(ready, link);
-	    }
-	}
-	ready->next_check = dtime() + CHECK_FREQ;
-    }
+    wheel_advance(ready, dtime());
+
     return AGOO_ERR_OK;
 }
 
+// Returns the seconds spent waiting for events since the last call. The
+// caller can compare that to the elapsed time to get the busy ratio.
+double
+agoo_ready_idle(agooReady ready) {
+    double	idle = ready->idle;
+
+    ready->idle = 0.0;
+
+    return idle;
+}
+
+// Sets the busy poll budget in seconds. Zero turns busy polling off.
+void
+agoo_ready_busy_poll(agooReady ready, double spin) {
+    ready->spin = spin;
+}
+
+// Adds the spin and park figures since the last call to the stats and
+// resets them.
 void
-agoo_ready_iterate(agooReady ready, void (*cb)(void *ctx, void *arg), void *arg) {
+agoo_ready_stats(agooReady ready, agooPollStats stats) {
+    stats->spin += ready->stats.spin;
+    stats->park += ready->stats.park;
+    stats->spin_wakes += ready->stats.spin_wakes;
+    stats->parks += ready->stats.parks;
+    memset(&ready->stats, 0, sizeof(ready->stats));
+}
+
+// Calls cb with the context of each link that has the handler, or of every
+// link if the handler is NULL.
+void
+agoo_ready_iterate(agooReady ready, agooHandler handler, void (*cb)(void *ctx, void *arg), void *arg) {
     Link	link;
 
     for (link = ready->links; NULL != link; link = link->next) {
-	cb(link->ctx, arg);
+	if (NULL == handler || handler == link->handler) {
+	    cb(link->ctx, arg);
+	}
     }
 }
@@ -18,10 +18,23 @@ typedef enum {
 
 typedef struct _agooReady	*agooReady;
 
+// Time a loop spent spinning on non-blocking polls and blocked waiting,
+// with the number of spins that found work and of blocking waits.
+typedef struct _agooPollStats {
+    double	spin;
+    double	park;
+    long	spin_wakes;
+    long	parks;
+} *agooPollStats;
+typedef struct _agooLink	*agooLink;
+
 typedef struct _agooHandler {
     agooReadyIO	(*io)(void *ctx);
     // return false to remove connection
     bool	(*check)(void *ctx, double now);
+    // Time check should next be called. A time already passed means the next
+    // tick. If NULL check is called every half second.
+    double	(*deadline)(void *ctx);
     bool	(*read)(agooReady ready, void *ctx);
     bool	(*write)(void *ctx);
     void	(*error)(void *ctx);
@@ -30,12 +43,18 @@ typedef struct _agooHandler {
 
 extern agooReady	agoo_ready_create(agooErr err);
 extern void		agoo_ready_destroy(agooReady ready);
+extern int		agoo_ready_io_uring(agooErr err, agooReady ready);
 extern int		agoo_ready_add(agooErr		err,
 				       agooReady	ready,
 				       int		fd,
 				       agooHandler	handler,
-				       void		*ctx);
+				       void		*ctx,
+				       agooLink		*linkp);
+extern void		agoo_ready_dirty(agooReady ready, agooLink link);
 extern int		agoo_ready_go(agooErr err, agooReady ready);
-extern void		agoo_ready_iterate(agooReady ready, void (*cb)(void *ctx, void *arg), void *arg);
+extern double		agoo_ready_idle(agooReady ready);
+extern void		agoo_ready_busy_poll(agooReady ready, double spin);
+extern void		agoo_ready_stats(agooReady ready, agooPollStats stats);
+extern void		agoo_ready_iterate(agooReady ready, agooHandler handler, void (*cb)(void *ctx, void *arg), void *arg);
 
 #endif // AGOO_READY_H
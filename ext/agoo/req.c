@@ -9,11 +9,18 @@
 #include "debug.h"
 #include "server.h"
 #include "req.h"
+#include "slab.h"
 
 agooReq
 agoo_req_create(size_t mlen) {
     size_t	size = mlen + sizeof(struct _agooReq) - 7;
-    agooReq	req = (agooReq)AGOO_MALLOC(size);
+    agooReq	req;
+
+    if (mlen <= AGOO_SLAB_REQ_SIZE) {
+	req = (agooReq)agoo_slab_alloc(AGOO_SLAB_REQ, AGOO_SLAB_REQ_SIZE + sizeof(struct _agooReq) - 7);
+    } else {
+	req = (agooReq)AGOO_MALLOC(size);
+    }
 
     if (NULL != req) {
 	memset(req, 0, size);
@@ -29,7 +36,11 @@ agoo_req_destroy(agooReq req) {
     if (NULL != req->hook && PUSH_HOOK == req->hook->type) {
 	AGOO_FREE(req->hook);
     }
-    AGOO_FREE(req);
+    if (req->mlen <= AGOO_SLAB_REQ_SIZE) {
+	agoo_slab_free(req);
+    } else {
+	AGOO_FREE(req);
+    }
 }
 
 const char*
@@ -7,34 +7,27 @@
 #include "con.h"
 #include "debug.h"
 #include "res.h"
+#include "slab.h"
 
 agooRes
 agoo_res_create(agooCon con) {
-    agooRes	res = NULL;
+    agooRes	res;
 
-    pthread_mutex_lock(&con->loop->lock);
-    if (NULL != (res = con->loop->res_head)) {
-	con->loop->res_head = res->next;
-	if (NULL == con->loop->res_head) {
-	    con->loop->res_tail = NULL;
-	}
-    }
-    pthread_mutex_unlock(&con->loop->lock);
-
-    if (NULL == res) {
-	if (NULL == (res = (agooRes)AGOO_MALLOC(sizeof(struct _agooRes)))) {
-	    return NULL;
-	}
+    if (NULL == (res = (agooRes)agoo_slab_alloc(AGOO_SLAB_RES, sizeof(struct _agooRes)))) {
+	return NULL;
     }
     res->next = NULL;
     res->message = NULL;
-    pthread_mutex_init(&res->lock, NULL);
+    atomic_init(&res->posted, NULL);
+    atomic_init(&res->final, 0);
     res->con = con;
     res->con_kind = AGOO_CON_HTTP;
-    res->final = false;
     res->close = false;
     res->ping = false;
     res->pong = false;
+    res->framed = false;
+    res->qlen = 0;
+    res->subject = 0;
 
     return res;
 }
@@ -42,47 +35,134 @@ agoo_res_create(agooCon con) {
 void
 agoo_res_destroy(agooRes res) {
     if (NULL != res) {
+	agooText	t = (agooText)atomic_load(&res->posted);
+	agooText	next;
+
 	if (NULL != res->message) {
 	    agoo_text_release(res->message);
 	}
-	res->next = NULL;
-	res->message = NULL;
-	pthread_mutex_lock(&res->con->loop->lock);
-	if (NULL == res->con->loop->res_tail) {
-	    res->con->loop->res_head = res;
-	} else {
-	    res->con->loop->res_tail->next = res;
+	for (; NULL != t; t = next) {
+	    next = t->next;
+	    agoo_text_release(t);
+	}
+	agoo_slab_free(res);
+    }
+}
+
+// A pinned text may be in read-only memory, such as a preloaded page, so
+// it is replaced by a private copy before it is linked to another text.
+static agooText
+unpin(agooText t) {
+    agooText	copy;
+
+    if (!t->pinned) {
+	return t;
+    }
+    if (NULL == (copy = agoo_text_dup(t))) {
+	return NULL;
+    }
+    copy->bin = t->bin;
+    agoo_text_ref(copy);
+
+    return copy;
+}
+
+static void
+message_append(agooRes res, agooText t) {
+    if (NULL == res->message) {
+	res->message = t;
+    } else {
+	agooText	*endp = &res->message;
+	agooText	end;
+
+	for (; NULL != (*endp)->next; endp = &(*endp)->next) {
+	}
+	if (NULL == (end = unpin(*endp))) {
+	    for (; NULL != t; t = end) {
+		end = t->next;
+		agoo_text_release(t);
+	    }
+	    return;
 	}
-	res->con->loop->res_tail = res;
-	pthread_mutex_unlock(&res->con->loop->lock);
+	*endp = end;
+	end->next = t;
     }
 }
 
+// Sets the final message from the connection loop thread, or from any
+// thread before the response is visible to the connection loop. Since the
+// text is not modified it can be shared by many responses.
+void
+agoo_res_message_set(agooRes res, agooText t) {
+    if (agoo_res_final(res)) {
+	return;
+    }
+    if (NULL != t) {
+	agoo_text_ref(t);
+	message_append(res, t);
+    }
+    atomic_store(&res->final, 1);
+}
+
+// Pushes a message onto the posted stack with a single compare and swap
+// that is uncontended in practice. The text is used as the stack link so it
+// must not be shared with other responses.
+static void
+message_post(agooRes res, agooText t) {
+    agooText	head = (agooText)atomic_load(&res->posted);
+
+    if (NULL == (t = unpin(t))) {
+	return;
+    }
+    do {
+	t->next = head;
+    } while (!atomic_compare_exchange_weak(&res->posted, &head, t));
+}
+
+// Called from an eval thread to hand off the final message. The hold on
+// the connection keeps the connection loop from closing it until it has been
+// marked dirty since the response may be written and destroyed as soon as
+// it is final.
 void
 agoo_res_message_push(agooRes res, agooText t) {
+    agooCon	c = res->con;
+
+    if (agoo_res_final(res)) {
+	return;
+    }
+    atomic_fetch_add(&c->hold, 1);
     if (NULL != t) {
 	agoo_text_ref(t);
+	message_post(res, t);
     }
-    pthread_mutex_lock(&res->lock);
-    if (!res->final) {
-	if (NULL == res->message) {
-	    res->message = t;
-	} else {
-	    agooText	end = res->message;
+    atomic_store(&res->final, 1);
+    agoo_con_dirty(c);
+    atomic_fetch_sub(&c->hold, 1);
+}
 
-	    for (; NULL != end->next; end = end->next) {
-	    }
-	    end->next = t;
-	}
-	res->final = true;
+// Adds part of a response from an eval thread. It is written as soon as
+// the connection loop gets to it while the rest is still being built. The
+// response is completed with agoo_res_message_push().
+void
+agoo_res_message_add(agooRes res, agooText t) {
+    agooCon	c = res->con;
+
+    if (agoo_res_final(res)) {
+	agoo_text_release(t);
+	return;
     }
-    pthread_mutex_unlock(&res->lock);
+    atomic_fetch_add(&c->hold, 1);
+    agoo_text_ref(t);
+    message_post(res, t);
+    agoo_con_dirty(c);
+    atomic_fetch_sub(&c->hold, 1);
 }
 
 static const char	early_103[] = "HTTP/1.1 103 Early Hints\r\n";
 
 void
 agoo_res_add_early(agooRes res, agooEarly early) {
+    agooCon	c = res->con;
     agooText	t = agoo_text_allocate(1024);
 
     t = agoo_text_append(t, early_103, sizeof(early_103) - 1);
@@ -93,46 +173,51 @@ agoo_res_add_early(agooRes res, agooEarly early) {
     }
     t = agoo_text_append(t, "\r\n", 2);
 
-    pthread_mutex_lock(&res->lock);
-    if (!res->final) {
-	if (NULL == res->message) {
-	    res->message = t;
-	} else {
-	    agooText	end = res->message;
+    if (agoo_res_final(res)) {
+	agoo_text_release(t);
+	return;
+    }
+    atomic_fetch_add(&c->hold, 1);
+    message_post(res, t);
+    agoo_con_dirty(c);
+    atomic_fetch_sub(&c->hold, 1);
+}
 
-	    for (; NULL != end->next; end = end->next) {
-	    }
-	    end->next = t;
-	}
-	res->final = false;
+// Moves posted messages, oldest first, onto the end of the message list.
+// Only called from the connection loop thread.
+static void
+message_take(agooRes res) {
+    agooText	t;
+    agooText	next;
+    agooText	list = NULL;
+
+    if (NULL == atomic_load(&res->posted)) {
+	return;
     }
-    pthread_mutex_unlock(&res->lock);
+    for (t = (agooText)atomic_exchange(&res->posted, NULL); NULL != t; t = next) {
+	next = t->next;
+	t->next = list;
+	list = t;
+    }
+    message_append(res, list);
 }
 
 agooText
 agoo_res_message_peek(agooRes res) {
-    agooText	t;
-
-    pthread_mutex_lock(&res->lock);
-    t = res->message;
-    pthread_mutex_unlock(&res->lock);
+    message_take(res);
 
-    return t;
+    return res->message;
 }
 
 agooText
 agoo_res_message_next(agooRes res) {
-    agooText	t;
-
-    pthread_mutex_lock(&res->lock);
     if (NULL != res->message) {
 	agooText	t2 = res->message;
 
 	res->message = t2->next;
 	agoo_text_release(t2);
     }
-    t = res->message;
-    pthread_mutex_unlock(&res->lock);
+    message_take(res);
 
-    return t;
+    return res->message;
 }
@@ -5,6 +5,7 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "atomic.h"
 #include "con.h"
@@ -16,21 +17,31 @@ struct _agooCon;
 typedef struct _agooRes {
     struct _agooRes	*next;
     struct _agooCon	*con;
-    volatile agooText	message;
-    pthread_mutex_t	lock; // a lock around message changes
-    volatile bool	final;
+    agooText		message; // only touched by the connection loop
+    _Atomic(agooText)	posted; // pushed from other threads, newest first
+    atomic_int		final;
     agooConKind		con_kind;
     bool		close;
     bool		ping;
     bool		pong;
+    bool		framed; // message expanded for WebSocket or SSE
+    long		qlen; // bytes counted against the push queue limit
+    uint64_t		subject; // hash of the publish subject or 0
 } *agooRes;
 
 extern agooRes		agoo_res_create(struct _agooCon *con);
 extern void		agoo_res_destroy(agooRes res);
 
+extern void		agoo_res_message_set(agooRes res, agooText t);
 extern void		agoo_res_message_push(agooRes res, agooText t);
+extern void		agoo_res_message_add(agooRes res, agooText t);
 extern void		agoo_res_add_early(agooRes res, agooEarly early);
 extern agooText		agoo_res_message_peek(agooRes res);
 extern agooText		agoo_res_message_next(agooRes res);
 
+static inline bool
+agoo_res_final(agooRes res) {
+    return 0 != (long)atomic_load(&res->final);
+}
+
 #endif // AGOO_RES_H
@@ -8,6 +8,7 @@
 
 #include "debug.h"
 #include "err.h"
+#include "gqlarena.h"
 #include "gqleval.h"
 #include "gqlintro.h"
 #include "gqlvalue.h"
@@ -23,6 +24,31 @@ typedef struct _eval {
     gqlValue	value;
 } *Eval;
 
+// A root field resolved in its own thread.
+typedef struct _part {
+    struct _agooErr	err;
+    gqlDoc		doc;
+    gqlRef		target;
+    gqlField		field;
+    gqlSel		sel;
+    gqlValue		result;
+    gqlArena		arena;
+    VALUE		thread;
+    int			depth;
+} *Part;
+
+// The threads started for one parallel evaluation.
+typedef struct _parts {
+    Part	parts;
+    VALUE	threads;
+    int		cnt;
+    bool	done;
+} *Parts;
+
+// Above this many root fields a query is resolved sequentially so a single
+// request can not start an unbounded number of threads.
+#define GQL_PARALLEL_MAX	8
+
 typedef struct _typeClass {
     gqlType	type;
     const char	*classname;
@@ -98,18 +124,18 @@ make_ruby_use(agooErr    err,
 
 static VALUE
 rescue_error(VALUE x, VALUE ignore) {
-    Eval		eval = (Eval)x;
+    agooErr		err = (agooErr)x;
     volatile VALUE	info = rb_errinfo();
     volatile VALUE	msg = rb_funcall(info, rb_intern("message"), 0);
     const char		*classname = rb_obj_classname(info);
     const char		*ms = rb_string_value_ptr(&msg);
 
-    agoo_err_set(eval->err, AGOO_ERR_EVAL, "%s: %s", classname, ms);
+    agoo_err_set(err, AGOO_ERR_EVAL, "%s: %s", classname, ms);
     if (rb_respond_to(info, rb_intern("code"))) {
 	VALUE	code = rb_funcall(info, rb_intern("code"), 0);
 
 	if (RUBY_T_FIXNUM == rb_type(code)) {
-	    eval->err->code = -FIX2INT(code);
+	    err->code = -FIX2INT(code);
 	}
     }
     return Qfalse;
@@ -126,7 +152,7 @@ call_eval(VALUE x) {
 
 static void*
 protect_eval(void *x) {
-    rb_rescue2(call_eval, (VALUE)x, rescue_error, (VALUE)x, rb_eException, (VALUE)0);
+    rb_rescue2(call_eval, (VALUE)x, rescue_error, (VALUE)((Eval)x)->err, rb_eException, (VALUE)0);
 
     return NULL;
 }
@@ -429,15 +455,450 @@ make_plan(gqlSel sel) {
     return Qnil;
 }
 
+static VALUE
+req_value(gqlDoc doc) {
+    volatile VALUE	rreq;
+
+    if (NULL == doc->ctx) {
+	rreq = request_wrap(doc->req);
+	doc->ctx = (void*)rreq;
+    } else {
+	rreq = (VALUE)doc->ctx;
+    }
+    return rreq;
+}
+
+// Returns the selection arguments as a Hash or Qundef on error.
+static VALUE
+sel_args(agooErr err, gqlDoc doc, gqlField field, gqlSel sel) {
+    volatile VALUE	rargs = rb_hash_new();
+    gqlSelArg		sa;
+    gqlValue		v;
+
+    for (sa = sel->args; NULL != sa; sa = sa->next) {
+	if (NULL == (v = gql_sel_arg_value(doc, sa))) {
+	    v = gql_null_create(err);
+	}
+	if (NULL != field) {
+	    gqlArg	fa;
+
+	    for (fa = field->args; NULL != fa; fa = fa->next) {
+		if (0 == strcmp(sa->name, fa->name)) {
+		    if (v->type != fa->type && GQL_SCALAR_VAR != v->type->scalar_kind) {
+			if (AGOO_ERR_OK != gql_value_convert(err, v, fa->type)) {
+			    return Qundef;
+			}
+		    }
+		    break;
+		}
+	    }
+	}
+	rb_hash_aset(rargs, rb_str_new_cstr(sa->name), gval_to_ruby(v));
+    }
+    return rargs;
+}
+
+// Calls the method for the field on a target. Returns Qundef on error.
+static VALUE
+call_field(agooErr err, gqlDoc doc, VALUE obj, gqlField field, gqlSel sel) {
+    volatile VALUE	rargs;
+    ID			method = rb_intern(sel->name);
+    int			arity = rb_obj_method_arity(obj, method);
+
+    if (0 == arity) {
+	return rb_funcall(obj, method, 0);
+    }
+    if (Qundef == (rargs = sel_args(err, doc, field, sel))) {
+	return Qundef;
+    }
+    if (-1 == arity || 1 == arity) {
+	return rb_funcall(obj, method, 1, rargs);
+    }
+    if (-2 == arity || 2 == arity) {
+	return rb_funcall(obj, method, 2, rargs, req_value(doc));
+    }
+    return rb_funcall(obj, method, 3, rargs, req_value(doc), make_plan(sel));
+}
+
+// If all the targets are of the same class and that class has a
+// <field>_batch class method then it is called once with all the targets
+// and must return an Array of results in the same order. Qundef is
+// returned if there is no batch method.
+static VALUE
+call_batch(agooErr err, gqlDoc doc, VALUE targets, gqlField field, gqlSel sel) {
+    volatile VALUE	children;
+    volatile VALUE	rargs;
+    VALUE		clas = rb_obj_class(rb_ary_entry(targets, 0));
+    int			cnt = (int)RARRAY_LEN(targets);
+    char		name[256];
+    ID			method;
+    int			arity;
+    int			i;
+
+    if ((int)sizeof(name) <= snprintf(name, sizeof(name), "%s_batch", sel->name)) {
+	return Qundef;
+    }
+    method = rb_intern(name);
+    if (!rb_respond_to(clas, method)) {
+	return Qundef;
+    }
+    for (i = 1; i < cnt; i++) {
+	if (clas != rb_obj_class(rb_ary_entry(targets, i))) {
+	    return Qundef;
+	}
+    }
+    arity = rb_obj_method_arity(clas, method);
+    if (1 == arity) {
+	children = rb_funcall(clas, method, 1, targets);
+    } else {
+	if (Qundef == (rargs = sel_args(err, doc, field, sel))) {
+	    return Qundef;
+	}
+	if (-1 == arity || -2 == arity || 2 == arity) {
+	    children = rb_funcall(clas, method, 2, targets, rargs);
+	} else {
+	    children = rb_funcall(clas, method, 3, targets, rargs, req_value(doc));
+	}
+    }
+    rb_check_type(children, RUBY_T_ARRAY);
+    if (cnt != RARRAY_LEN(children)) {
+	agoo_err_set(err, AGOO_ERR_EVAL, "%s.%s returned %ld results for %d targets.",
+		     rb_class2name(clas), name, RARRAY_LEN(children), cnt);
+	return Qundef;
+    }
+    return children;
+}
+
+static int	eval_batch(agooErr err, gqlDoc doc, VALUE targets, gqlField field, gqlSel sels, gqlValue *results, int depth);
+
+static int
+resolve(agooErr err, gqlDoc doc, gqlRef target, gqlField field, gqlSel sel, gqlValue result, int depth);
+
+// Evaluates a fragment for the targets it applies to.
+static int
+eval_frag(agooErr err, gqlDoc doc, VALUE targets, gqlField field, gqlFrag frag, gqlValue *results, int depth) {
+    volatile VALUE	sub = rb_ary_new();
+    VALUE		tmp = 0;
+    gqlValue		*subres;
+    int			cnt = (int)RARRAY_LEN(targets);
+    int			scnt = 0;
+    int			i;
+
+    subres = ALLOCV_N(gqlValue, tmp, cnt);
+    for (i = 0; i < cnt; i++) {
+	VALUE	t = rb_ary_entry(targets, i);
+
+	if (gql_frag_include(doc, frag, (gqlRef)t)) {
+	    rb_ary_push(sub, t);
+	    subres[scnt++] = results[i];
+	}
+    }
+    if (0 < scnt && AGOO_ERR_OK != eval_batch(err, doc, sub, field, frag->sels, subres, depth)) {
+	return err->code;
+    }
+    ALLOCV_END(tmp);
+
+    return AGOO_ERR_OK;
+}
+
+// Resolves one field on all the targets then evaluates the selections on
+// all the children together so sibling objects are resolved breadth first.
+static int
+eval_field(agooErr err, gqlDoc doc, VALUE targets, gqlField field, gqlSel sel, gqlValue *results, int depth) {
+    volatile VALUE	children = Qundef;
+    volatile VALUE	flat;
+    VALUE		tmp = 0;
+    gqlValue		*cos;
+    const char		*key = sel->name;
+    int			cnt = (int)RARRAY_LEN(targets);
+    int			fcnt = 0;
+    int			i;
+
+    if ('_' == *key && '_' == key[1]) {
+	for (i = 0; i < cnt; i++) {
+	    if (AGOO_ERR_OK != resolve(err, doc, (gqlRef)rb_ary_entry(targets, i), field, sel, results[i], depth)) {
+		return err->code;
+	    }
+	}
+	return AGOO_ERR_OK;
+    }
+    children = call_batch(err, doc, targets, field, sel);
+    if (AGOO_ERR_OK != err->code) {
+	return err->code;
+    }
+    if (Qundef == children) {
+	children = rb_ary_new_capa(cnt);
+	for (i = 0; i < cnt; i++) {
+	    volatile VALUE	child = call_field(err, doc, rb_ary_entry(targets, i), field, sel);
+
+	    if (Qundef == child) {
+		return err->code;
+	    }
+	    rb_ary_push(children, child);
+	}
+    }
+    if (NULL != sel->alias) {
+	key = sel->alias;
+    }
+    if (NULL != sel->type && GQL_LIST == sel->type->kind) {
+	bool	objs = NULL != sel->type->base && GQL_SCALAR != sel->type->base->kind;
+
+	for (i = 0; i < cnt; i++) {
+	    VALUE	child = rb_ary_entry(children, i);
+
+	    rb_check_type(child, RUBY_T_ARRAY);
+	    fcnt += (int)RARRAY_LEN(child);
+	}
+	flat = rb_ary_new_capa(fcnt);
+	cos = ALLOCV_N(gqlValue, tmp, fcnt);
+	fcnt = 0;
+	for (i = 0; i < cnt; i++) {
+	    VALUE	child = rb_ary_entry(children, i);
+	    int		ccnt = (int)RARRAY_LEN(child);
+	    gqlValue	list;
+	    gqlValue	co;
+	    int		j;
+
+	    if (NULL == (list = gql_list_create(err, NULL)) ||
+		AGOO_ERR_OK != gql_object_set(err, results[i], key, list)) {
+		return err->code;
+	    }
+	    for (j = 0; j < ccnt; j++) {
+		if (objs) {
+		    if (NULL == (co = gql_object_create(err)) ||
+			AGOO_ERR_OK != gql_list_append(err, list, co)) {
+			return err->code;
+		    }
+		    rb_ary_push(flat, rb_ary_entry(child, j));
+		    cos[fcnt++] = co;
+		} else if (NULL == (co = coerce(err, (gqlRef)rb_ary_entry(child, j), sel->type->base)) ||
+			   AGOO_ERR_OK != gql_list_append(err, list, co)) {
+		    return err->code;
+		}
+	    }
+	}
+	if (0 < fcnt) {
+	    struct _gqlField	cf;
+
+	    memset(&cf, 0, sizeof(cf));
+	    cf.type = sel->type->base;
+	    if (AGOO_ERR_OK != eval_batch(err, doc, flat, &cf, sel->sels, cos, depth + 1)) {
+		return err->code;
+	    }
+	}
+	ALLOCV_END(tmp);
+    } else if (NULL == sel->sels) {
+	for (i = 0; i < cnt; i++) {
+	    gqlValue	cv;
+
+	    if (NULL == (cv = coerce(err, (gqlRef)rb_ary_entry(children, i), sel->type)) ||
+		AGOO_ERR_OK != gql_object_set(err, results[i], key, cv)) {
+		return err->code;
+	    }
+	}
+    } else {
+	cos = ALLOCV_N(gqlValue, tmp, cnt);
+	for (i = 0; i < cnt; i++) {
+	    if (NULL == (cos[i] = gql_object_create(err)) ||
+		AGOO_ERR_OK != gql_object_set(err, results[i], key, cos[i])) {
+		return err->code;
+	    }
+	}
+	if (AGOO_ERR_OK != eval_batch(err, doc, children, field, sel->sels, cos, depth + 1)) {
+	    return err->code;
+	}
+	ALLOCV_END(tmp);
+    }
+    return AGOO_ERR_OK;
+}
+
+// The breadth first version of gql_eval_sels for a list of targets with a
+// result object for each.
+static int
+eval_batch(agooErr err, gqlDoc doc, VALUE targets, gqlField field, gqlSel sels, gqlValue *results, int depth) {
+    gqlSel	sel;
+    gqlField	sf = NULL;
+
+    if (GQL_MAX_DEPTH < depth) {
+	return agoo_err_set(err, AGOO_ERR_EVAL, "Maximum resolve depth of %d exceeded.", GQL_MAX_DEPTH);
+    }
+    depth++;
+
+    for (sel = sels; NULL != sel; sel = sel->next) {
+	sf = gql_sel_field(field, sel);
+	if (NULL != sel->inline_frag) {
+	    if (AGOO_ERR_OK != eval_frag(err, doc, targets, sf, sel->inline_frag, results, depth)) {
+		return err->code;
+	    }
+	} else if (NULL != sel->frag) {
+	    gqlFrag	frag = gql_sel_frag(doc, sel);
+
+	    if (NULL != frag && AGOO_ERR_OK != eval_frag(err, doc, targets, sf, frag, results, depth)) {
+		return err->code;
+	    }
+	} else if (AGOO_ERR_OK != eval_field(err, doc, targets, sf, sel, results, depth)) {
+	    return err->code;
+	}
+    }
+    return AGOO_ERR_OK;
+}
+
+static VALUE
+call_part(VALUE x) {
+    Part	part = (Part)(void*)x;
+
+    resolve(&part->err, part->doc, part->target, part->field, part->sel, part->result, part->depth);
+
+    return Qnil;
+}
+
+static VALUE
+part_thread(void *x) {
+    Part	part = (Part)x;
+    gqlArena	prev = gql_arena_use(part->arena);
+
+    rb_rescue2(call_part, (VALUE)x, rescue_error, (VALUE)&part->err, rb_eException, (VALUE)0);
+    gql_arena_use(prev);
+
+    return Qnil;
+}
+
+static bool
+parallel_sels(gqlSel sels) {
+    gqlSel	sel;
+    int		cnt = 0;
+
+    for (sel = sels; NULL != sel; sel = sel->next) {
+	// Introspection switches the document resolve functions while it
+	// runs so it is not run next to other fields.
+	if (NULL == sel->name || NULL != sel->frag || NULL != sel->inline_frag ||
+	    ('_' == *sel->name && '_' == sel->name[1])) {
+	    return false;
+	}
+	cnt++;
+    }
+    return 1 < cnt && cnt <= GQL_PARALLEL_MAX;
+}
+
+static VALUE
+run_parts(VALUE x) {
+    Parts	pa = (Parts)(void*)x;
+    Part	p;
+    int		i;
+
+    for (p = pa->parts, i = 0; i < pa->cnt && NULL != p->result; p++, i++) {
+	p->thread = rb_thread_create(part_thread, p);
+	rb_ary_push(pa->threads, p->thread);
+    }
+    for (p = pa->parts, i = 0; i < pa->cnt; p++, i++) {
+	if (Qnil != p->thread) {
+	    rb_funcall(p->thread, rb_intern("join"), 0);
+	}
+    }
+    pa->done = true;
+
+    return Qnil;
+}
+
+static VALUE
+stop_part(VALUE thread) {
+    rb_funcall(thread, rb_intern("kill"), 0);
+    rb_funcall(thread, rb_intern("join"), 0);
+
+    return Qnil;
+}
+
+// If the join was interrupted or a thread could not be started the threads
+// may still be using the parts so each is killed and joined before the
+// results are destroyed.
+static VALUE
+stop_parts(VALUE x) {
+    Parts	pa = (Parts)(void*)x;
+    Part	p;
+    int		i;
+    int		state;
+
+    if (pa->done) {
+	return Qnil;
+    }
+    for (p = pa->parts, i = 0; i < pa->cnt; p++, i++) {
+	if (Qnil != p->thread) {
+	    rb_protect(stop_part, p->thread, &state);
+	}
+    }
+    for (p = pa->parts, i = 0; i < pa->cnt; p++, i++) {
+	if (NULL != p->result) {
+	    gql_value_destroy(p->result);
+	    p->result = NULL;
+	}
+    }
+    return Qnil;
+}
+
+// Resolves each root field in a thread of its own so a query takes as long
+// as the slowest field instead of the sum of all of them when resolvers
+// wait on I/O. The GVL is held by one thread at a time so the arena is
+// shared. Results are merged in selection order. The threads are always
+// joined before the parts are released, even when the join is interrupted.
+static int
+eval_parallel(agooErr err, gqlDoc doc, gqlRef target, gqlField field, gqlSel sels, gqlValue result, int depth) {
+    volatile VALUE	threads = rb_ary_new();
+    VALUE		tmp = 0;
+    struct _parts	pa;
+    Part		p;
+    gqlSel		sel;
+    int			cnt = 0;
+    int			i;
+
+    for (sel = sels; NULL != sel; sel = sel->next) {
+	cnt++;
+    }
+    pa.parts = ALLOCV_N(struct _part, tmp, cnt);
+    pa.threads = threads;
+    pa.cnt = cnt;
+    pa.done = false;
+    memset(pa.parts, 0, sizeof(struct _part) * cnt);
+    for (p = pa.parts, i = 0; i < cnt; p++, i++) {
+	p->thread = Qnil;
+    }
+    if (NULL != doc->req) {
+	req_value(doc);
+    }
+    for (p = pa.parts, sel = sels; NULL != sel; p++, sel = sel->next) {
+	if (NULL == (p->result = gql_object_create(err))) {
+	    break;
+	}
+	p->doc = doc;
+	p->target = target;
+	p->field = gql_sel_field(field, sel);
+	p->sel = sel;
+	p->arena = gql_arena_current();
+	p->depth = depth;
+    }
+    rb_ensure(run_parts, (VALUE)&pa, stop_parts, (VALUE)&pa);
+
+    for (p = pa.parts, i = 0; i < cnt; p++, i++) {
+	if (AGOO_ERR_OK == err->code && AGOO_ERR_OK != p->err.code) {
+	    agoo_err_set(err, p->err.code, "%s", p->err.msg);
+	}
+	if (NULL != p->result) {
+	    if (AGOO_ERR_OK == err->code) {
+		gql_object_move(result, p->result);
+	    }
+	    gql_value_destroy(p->result);
+	}
+    }
+    ALLOCV_END(tmp);
+
+    return err->code;
+}
+
 static int
 resolve(agooErr err, gqlDoc doc, gqlRef target, gqlField field, gqlSel sel, gqlValue result, int depth) {
     volatile VALUE	child;
-    volatile VALUE	rreq = Qnil;
     VALUE		obj = (VALUE)target;
     int			d2 = depth + 1;
     const char		*key = sel->name;
-    ID			method;
-    int			arity;
 
     if ('_' == *key && '_' == key[1]) {
 	if (0 == strcmp("__typename", key)) {
@@ -457,55 +918,8 @@ resolve(agooErr err, gqlDoc doc, gqlRef target, gqlField field, gqlSel sel, gqlV
 	    return agoo_err_set(err, AGOO_ERR_EVAL, "Not a valid operation on the root object.");
 	}
     }
-    method = rb_intern(sel->name);
-    arity = rb_obj_method_arity(obj, method);
-    if (0 == arity) {
-	child = rb_funcall(obj, method, 0);
-    } else {
-	volatile VALUE	rargs = rb_hash_new();
-	gqlSelArg	sa;
-	gqlValue	v;
-
-	for (sa = sel->args; NULL != sa; sa = sa->next) {
-	    if (NULL != sa->var) {
-		v = sa->var->value;
-	    } else {
-		v = sa->value;
-	    }
-	    if (NULL == v) {
-		v = gql_null_create(err);
-	    }
-	    if (NULL != field) {
-		gqlArg	fa;
-
-		for (fa = field->args; NULL != fa; fa = fa->next) {
-		    if (0 == strcmp(sa->name, fa->name)) {
-			if (v->type != fa->type && GQL_SCALAR_VAR != v->type->scalar_kind) {
-			    if (AGOO_ERR_OK != gql_value_convert(err, v, fa->type)) {
-				return err->code;
-			    }
-			}
-			break;
-		    }
-		}
-	    }
-	    rb_hash_aset(rargs, rb_str_new_cstr(sa->name), gval_to_ruby(v));
-	}
-	if (-1 == arity || 1 == arity) {
-	    child = rb_funcall(obj, method, 1, rargs);
-	} else {
-	    if (NULL == doc->ctx) {
-		rreq = request_wrap(doc->req);
-		doc->ctx = (void*)rreq;
-	    } else {
-		rreq = (VALUE)doc->ctx;
-	    }
-	    if (-2 == arity || 2 == arity) {
-		child = rb_funcall(obj, method, 2, rargs, rreq);
-	    } else {
-		child = rb_funcall(obj, method, 3, rargs, rreq, make_plan(sel));
-	    }
-	}
+    if (Qundef == (child = call_field(err, doc, obj, field, sel))) {
+	return err->code;
     }
     if (GQL_SUBSCRIPTION == doc->op->kind && RUBY_T_STRING == rb_type(child)) {
 	gqlValue	c;
@@ -520,7 +934,10 @@ resolve(agooErr err, gqlDoc doc, gqlRef target, gqlField field, gqlSel sel, gqlV
 	key = sel->alias;
     }
     if (NULL != sel->type && GQL_LIST == sel->type->kind) {
+	VALUE		tmp = 0;
+	gqlValue	*cos = NULL;
 	gqlValue	list;
+	bool		objs = NULL != sel->type->base && GQL_SCALAR != sel->type->base->kind;
 	int		cnt;
 	int		i;
 
@@ -529,22 +946,18 @@ resolve(agooErr err, gqlDoc doc, gqlRef target, gqlField field, gqlSel sel, gqlV
 	    return err->code;
 	}
 	cnt = (int)RARRAY_LEN(child);
+	if (objs) {
+	    cos = ALLOCV_N(gqlValue, tmp, cnt);
+	}
 	for (i = 0; i < cnt; i++) {
 	    gqlValue	co;
 
-	    if (NULL != sel->type->base && GQL_SCALAR != sel->type->base->kind) {
-		struct _gqlField	cf;
-
+	    if (objs) {
 		if (NULL == (co = gql_object_create(err)) ||
 		    AGOO_ERR_OK != gql_list_append(err, list, co)) {
 		    return err->code;
 		}
-		memset(&cf, 0, sizeof(cf));
-		cf.type = sel->type->base;
-
-		if (AGOO_ERR_OK != gql_eval_sels(err, doc, (gqlRef)rb_ary_entry(child, i), &cf, sel->sels, co, d2)) {
-		    return err->code;
-		}
+		cos[i] = co;
 	    } else {
 		if (NULL == (co = coerce(err, (gqlRef)rb_ary_entry(child, i), sel->type->base)) ||
 		    AGOO_ERR_OK != gql_list_append(err, list, co)) {
@@ -552,6 +965,21 @@ resolve(agooErr err, gqlDoc doc, gqlRef target, gqlField field, gqlSel sel, gqlV
 		}
 	    }
 	}
+	// The members of a list are evaluated together so that fields with
+	// batch resolvers are called once for all of them.
+	if (objs && 0 < cnt) {
+	    struct _gqlField	cf;
+
+	    memset(&cf, 0, sizeof(cf));
+	    cf.type = sel->type->base;
+
+	    if (AGOO_ERR_OK != eval_batch(err, doc, child, &cf, sel->sels, cos, d2)) {
+		return err->code;
+	    }
+	}
+	if (objs) {
+	    ALLOCV_END(tmp);
+	}
 	if (AGOO_ERR_OK != gql_object_set(err, result, key, list)) {
 	    return err->code;
 	}
@@ -571,6 +999,9 @@ resolve(agooErr err, gqlDoc doc, gqlRef target, gqlField field, gqlSel sel, gqlV
 	    AGOO_ERR_OK != gql_object_set(err, result, key, co)) {
 	    return err->code;
 	}
+	if (0 == depth && gql_parallel && GQL_QUERY == doc->op->kind && parallel_sels(sel->sels)) {
+	    return eval_parallel(err, doc, (gqlRef)child, field, sel->sels, co, d2 + 1);
+	}
 	if (AGOO_ERR_OK != gql_eval_sels(err, doc, (gqlRef)child, field, sel->sels, co, d2)) {
 	    return err->code;
 	}
@@ -659,6 +1090,13 @@ rescue_yield(VALUE x) {
  * validate the Ruby class as a way to verify the class implements the methods
  * described by the GraphQL type. The association is also use for resolving
  * @skip and @include directives.
+ *
+ * The members of a list are resolved a field at a time. If the class of the
+ * members has a class method named for the field with a __batch_ suffix,
+ * such as _author_batch_ for _author_, that method is called once with an
+ * Array of all the members, the field arguments, and the request, and must
+ * return an Array of results in the same order. Lists nested under those
+ * members are resolved together as well.
  */
 static VALUE
 graphql_schema(VALUE self, VALUE root) {
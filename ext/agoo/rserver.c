@@ -11,18 +11,24 @@
 #include <ruby/thread.h>
 #include <ruby/encoding.h>
 
+#include "affinity.h"
 #include "atomic.h"
 #include "bind.h"
+#include "bus.h"
 #include "con.h"
 #include "debug.h"
 #include "domain.h"
 #include "dtime.h"
 #include "err.h"
+#include "gqlcache.h"
+#include "gqlcost.h"
 #include "graphql.h"
+#include "handoff.h"
 #include "http.h"
 #include "log.h"
 #include "page.h"
 #include "pub.h"
+#include "ready.h"
 #include "request.h"
 #include "res.h"
 #include "response.h"
@@ -35,6 +41,8 @@
 #include "upgraded.h"
 #include "websocket.h"
 
+#define PRELOAD_DEFAULT_MAX	(64 * 1024 * 1024)
+
 extern void   agoo_shutdown();
 extern sig_atomic_t agoo_stop;
 
@@ -64,6 +72,7 @@ static ID to_i_id;
 static const char err500[] = "HTTP/1.1 500 Internal Server Error\r\n";
 
 static double poll_timeout = 0.1;
+static _Thread_local bool eval_thread = false;
 struct _rServer the_rserver = {};
 
 static void
@@ -86,6 +95,70 @@ server_mark(void *ptr) {
     pthread_mutex_unlock(&agoo_server.up_lock);
 }
 
+// Sets a CPU list from either a String such as "0-3,8" or an Array of
+// Integers.
+static void
+cpus_option(VALUE v, const char *name, int (*set)(agooErr err, const int *cpus, int cnt)) {
+    struct _agooErr err = AGOO_ERR_INIT;
+    int             *cpus = NULL;
+    int             cnt = 0;
+
+    switch (rb_type(v)) {
+    case RUBY_T_STRING:
+        if (AGOO_ERR_OK != agoo_affinity_parse(&err, StringValuePtr(v), &cpus, &cnt)) {
+            rb_raise(rb_eArgError, "%s", err.msg);
+        }
+        break;
+    case RUBY_T_ARRAY: {
+        int i;
+
+        cnt = (int)RARRAY_LEN(v);
+        if (0 < cnt && NULL == (cpus = (int*)AGOO_MALLOC(sizeof(int) * cnt))) {
+            rb_raise(rb_eNoMemError, "Failed to allocate memory for a CPU list.");
+        }
+        for (i = 0; i < cnt; i++) {
+            if (0 > (cpus[i] = NUM2INT(rb_ary_entry(v, i)))) {
+                AGOO_FREE(cpus);
+                rb_raise(rb_eArgError, "%s CPUs can not be negative.", name);
+            }
+        }
+        break;
+    }
+    default:
+        rb_raise(rb_eArgError, "%s must be a String or an Array of Integers.", name);
+        break;
+    }
+    if (AGOO_ERR_OK != set(&err, cpus, cnt)) {
+        AGOO_FREE(cpus);
+        rb_raise(rb_eNoMemError, "%s", err.msg);
+    }
+    AGOO_FREE(cpus);
+}
+
+// Copies an Array of Strings to a NULL terminated argv for the restart
+// command.
+static char**
+restart_argv(VALUE cmd) {
+    char    **argv;
+    long    cnt = RARRAY_LEN(cmd);
+    long    i;
+
+    if (0 == cnt) {
+        rb_raise(rb_eArgError, "restart_command can not be empty.");
+    }
+    if (NULL == (argv = (char**)AGOO_CALLOC(cnt + 1, sizeof(char*)))) {
+        rb_raise(rb_eNoMemError, "Failed to allocate memory for the restart command.");
+    }
+    for (i = 0; i < cnt; i++) {
+        VALUE   v = rb_obj_as_string(rb_ary_entry(cmd, i));
+
+        if (NULL == (argv[i] = AGOO_STRDUP(StringValueCStr(v)))) {
+            rb_raise(rb_eNoMemError, "Failed to allocate memory for the restart command.");
+        }
+    }
+    return argv;
+}
+
 static void
 url_bind(VALUE rurl) {
     struct _agooErr err = AGOO_ERR_INIT;
@@ -104,9 +177,14 @@ configure(agooErr err, int port, const char *root, VALUE options) {
     }
     agoo_server.thread_cnt = 0;
     the_rserver.worker_cnt = 1;
+    the_rserver.loop_max = 0;
+    the_rserver.restart_argv = NULL;
+    the_rserver.restart_timeout = 60.0;
+    the_rserver.preload = 0;
     the_rserver.forker = Qnil;
     the_rserver.uses = NULL;
     atomic_init(&agoo_server.running, 0);
+    atomic_init(&agoo_server.eval_running, 0);
     agoo_server.listen_thread = 0;
     agoo_server.con_loops = NULL;
     agoo_server.root_first = false;
@@ -162,9 +240,107 @@ configure(agooErr err, int port, const char *root, VALUE options) {
                 rb_raise(rb_eArgError, "max_push_pending must be between 0 and 1000.");
             }
         }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("max_push_bytes"))))) {
+            long    mpb = NUM2LONG(v);
+
+            if (0 <= mpb) {
+                agoo_server.max_push_bytes = mpb;
+            } else {
+                rb_raise(rb_eArgError, "max_push_bytes must be 0 or greater.");
+            }
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("push_policy"))))) {
+            if (ID2SYM(rb_intern("drop_newest")) == v) {
+                agoo_server.push_policy = AGOO_PUSH_DROP_NEWEST;
+            } else if (ID2SYM(rb_intern("drop_oldest")) == v) {
+                agoo_server.push_policy = AGOO_PUSH_DROP_OLDEST;
+            } else if (ID2SYM(rb_intern("coalesce")) == v) {
+                agoo_server.push_policy = AGOO_PUSH_COALESCE;
+            } else if (ID2SYM(rb_intern("disconnect")) == v) {
+                agoo_server.push_policy = AGOO_PUSH_DISCONNECT;
+            } else {
+                rb_raise(rb_eArgError, "push_policy must be one of :drop_newest, :drop_oldest, :coalesce, or :disconnect.");
+            }
+        }
         if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("pedantic"))))) {
             agoo_server.pedantic = (Qtrue == v);
         }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("max_io_loops"))))) {
+            int mil = FIX2INT(v);
+
+            if (0 < mil) {
+                the_rserver.loop_max = mil;
+            } else {
+                rb_raise(rb_eArgError, "max_io_loops must be greater than 0.");
+            }
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("io_uring"))))) {
+            agoo_server.io_uring = (Qtrue == v);
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("busy_poll"))))) {
+            double  spin = NUM2DBL(v);
+
+            if (0.0 <= spin && spin < 1.0) {
+                agoo_server.busy_poll = spin;
+            } else {
+                rb_raise(rb_eArgError, "busy_poll must be at least 0 and less than a second.");
+            }
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("so_busy_poll"))))) {
+            int usec = NUM2INT(v);
+
+            if (0 <= usec) {
+                agoo_server.so_busy_poll = usec;
+            } else {
+                rb_raise(rb_eArgError, "so_busy_poll must be 0 or greater.");
+            }
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("drain_timeout"))))) {
+            double  secs = NUM2DBL(v);
+
+            if (0.0 <= secs) {
+                agoo_server.drain_timeout = secs;
+            } else {
+                rb_raise(rb_eArgError, "drain_timeout must be 0 or greater.");
+            }
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("restart_timeout"))))) {
+            double  secs = NUM2DBL(v);
+
+            if (0.0 < secs) {
+                the_rserver.restart_timeout = secs;
+            } else {
+                rb_raise(rb_eArgError, "restart_timeout must be greater than 0.");
+            }
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("restart_command"))))) {
+            rb_check_type(v, T_ARRAY);
+            the_rserver.restart_argv = restart_argv(v);
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("preload"))))) {
+            if (Qtrue == v) {
+                the_rserver.preload = PRELOAD_DEFAULT_MAX;
+            } else if (Qfalse == v) {
+                the_rserver.preload = 0;
+            } else {
+                long    max = NUM2LONG(v);
+
+                if (0 <= max) {
+                    the_rserver.preload = max;
+                } else {
+                    rb_raise(rb_eArgError, "preload must be true, false, or a byte limit of 0 or more.");
+                }
+            }
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("io_cpus"))))) {
+            cpus_option(v, "io_cpus", agoo_affinity_set_loops);
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("eval_cpus"))))) {
+            cpus_option(v, "eval_cpus", agoo_affinity_set_evals);
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("numa"))))) {
+            agoo_affinity_set_numa(Qtrue == v);
+        }
         if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("root_first"))))) {
             agoo_server.root_first = (Qtrue == v);
         }
@@ -257,6 +433,30 @@ configure(agooErr err, int port, const char *root, VALUE options) {
             options_hook->next = agoo_server.hooks;
             agoo_server.hooks = head;
         }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("graphql_cache"))))) {
+            int max = FIX2INT(v);
+
+            if (0 <= max) {
+                gql_cache_set_max(max);
+            } else {
+                rb_raise(rb_eArgError, "graphql_cache must be 0 or greater.");
+            }
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("graphql_chunked"))))) {
+            gql_chunked = (Qtrue == v);
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("graphql_parallel"))))) {
+            gql_parallel = (Qtrue == v);
+        }
+        if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("graphql_max_cost"))))) {
+            long    max = NUM2LONG(v);
+
+            if (0 <= max) {
+                gql_max_cost = max;
+            } else {
+                rb_raise(rb_eArgError, "graphql_max_cost must be 0 or greater.");
+            }
+        }
         if (Qnil != (v = rb_hash_lookup(options, ID2SYM(rb_intern("quiet"))))) {
             if (Qtrue == v) {
                 agoo_info_cat.on = false;
@@ -313,8 +513,42 @@ configure(agooErr err, int port, const char *root, VALUE options) {
  *
  *   - *:graphql* [_String_] path to GraphQL endpoint if support for GraphQL is desired.
  *
+ *   - *:graphql_cache* [_Integer_] maximum number of parsed and validated GraphQL documents to keep, keyed by the SHA-256 of the query. The same hash is used for Automatic Persisted Queries so clients may send just the hash in the _persistedQuery_ extension once a query is known. Zero disables the cache. Default is 256.
+ *
+ *   - *:graphql_chunked* [_true_|_false_] if true GraphQL results larger than 64K are sent with chunked transfer encoding as they are written instead of being held until the Content-Length is known. Default is false.
+ *
+ *   - *:graphql_parallel* [_true_|_false_] if true the root fields of a GraphQL query, never a mutation, are each resolved in a Ruby thread of their own and the results merged in selection order. Queries with more than 8 root fields are resolved sequentially. Helps queries with several fields that each wait on I/O. Default is false.
+ *
+ *   - *:graphql_max_cost* [_Integer_] GraphQL queries with an estimated cost over the maximum are rejected before anything is resolved. Each field costs 1, or the value of a @cost(value: Int) directive on the field, times the sizes of the lists it is under. A list size is the first, last, or limit argument of the field, the size of a @cost(size: Int) directive, or 10. A zero means no limit. Default is 0.
+ *
  *   - *:max_push_pending* [_Integer_] maximum number or outstanding push messages, less than 1000.
  *
+ *   - *:max_push_bytes* [_Integer_] maximum number of bytes of push messages queued for a single connection. Zero, the default, is no limit.
+ *
+ *   - *:push_policy* [_Symbol_] what to do when a push message would exceed _:max_push_bytes_. One of _:drop_newest_ (the default) to discard the new message, _:drop_oldest_ to discard queued messages to make room, _:coalesce_ to replace a queued message on the same subject with the new one, or _:disconnect_ to close the slow connection.
+ *
+ *   - *:max_io_loops* [_Integer_] maximum number of connection loop threads in each process. Loops are added as connections and load grow and parked again when idle. The default is half the CPU count divided among the workers.
+ *
+ *   - *:io_uring* [_true_|_false_] if true the connection loops use io_uring instead of epoll for readiness when the extension was built with io_uring support and the kernel allows it. Only the readiness waits and interest changes go through the ring. Each read and write is still its own system call so the per-request system call count is not reduced. A warning is logged and epoll is used if io_uring is not available.
+ *
+ *   - *:busy_poll* [_Float_] seconds a connection loop keeps polling without blocking after finding work, and an eval thread spins on the request queue, before parking. Zero, the default, always blocks. Trades CPU for lower latency under sustained load. See _poll_stats_.
+ *
+ *   - *:so_busy_poll* [_Integer_] microseconds to set as SO_BUSY_POLL on accepted sockets so the kernel polls the NIC on reads. Raising it above the net.core.busy_read sysctl requires CAP_NET_ADMIN.
+ *
+ *   - *:drain_timeout* [_Float_] seconds a process being replaced by a restart, or sent SIGQUIT, keeps serving its open connections after it stops accepting. Connections are closed as soon as they have nothing in flight. Default is 10.
+ *
+ *   - *:restart_timeout* [_Float_] seconds to wait for the new process of a restart to start serving before giving up and killing it. Default is 60.
+ *
+ *   - *:restart_command* [_Array_] command to start the new process of a restart. Defaults to the command line the process was started with. See _restart_.
+ *
+ *   - *:preload* [_true_|_false_|_Integer_] if not false the files under the root and the path group directories are read before the workers are forked into one read-only region shared by all workers, so the first requests do not wait on disk reads and each worker does not keep its own copy. An Integer is the limit on the bytes read, true is a limit of 64MB. A file that changes later is reread by the worker that notices.
+ *
+ *   - *:io_cpus* [_String_|_Array_] CPUs to pin the connection loops to, either a list such as "0-3,8" or an Array of Integers. Loop n is pinned to the nth CPU so listing the CPUs that handle the NIC receive queues in queue order keeps each connection on the CPU its packets arrive on. New connections favor the loop pinned to the CPU that received them.
+ *
+ *   - *:eval_cpus* [_String_|_Array_] CPUs to pin the Ruby eval threads to, one per thread in turn.
+ *
+ *   - *:numa* [_true_|_false_] if true and there are multiple workers, each worker and the memory it allocates is bound to a NUMA node in turn. The _:io_cpus_ and _:eval_cpus_ lists are narrowed to the CPUs of the node.
+ *
  *   - *:ssl_cert* [_String_] filepath to the SSL certificate file.
  *
  *   - *:ssl_key* [_String_] filepath to the SSL private key file.
@@ -380,7 +614,6 @@ rescue_error(VALUE x, VALUE ignore) {
 
         req->res->close = true;
         agoo_res_message_push(req->res, message);
-        agoo_queue_wakeup(&agoo_server.con_queue);
     } else {
 /*
   volatile VALUE  bt = rb_funcall(info, rb_intern("backtrace"), 0);
@@ -408,7 +641,6 @@ handle_base_inner(VALUE x) {
     }
     DATA_PTR(rr) = NULL;
     agoo_res_message_push(req->res, response_text(rres));
-    agoo_queue_wakeup(&agoo_server.con_queue);
 
     return Qfalse;
 }
@@ -502,7 +734,6 @@ handle_rack_inner(VALUE x) {
     }
     res = rb_funcall((VALUE)req->hook->handler, call_id, 1, env);
     if (req->res->con->hijacked) {
-        agoo_queue_wakeup(&agoo_server.con_queue);
         return Qfalse;
     }
     rb_check_type(res, T_ARRAY);
@@ -605,7 +836,6 @@ handle_rack_inner(VALUE x) {
             rupgraded_create(req->res->con, handler, request_env(req, Qnil));
             t = agoo_sse_upgrade(req, t);
             agoo_res_message_push(req->res, t);
-            agoo_queue_wakeup(&agoo_server.con_queue);
             return Qfalse;
         default:
             break;
@@ -636,7 +866,6 @@ handle_rack_inner(VALUE x) {
         }
     }
     agoo_res_message_push(req->res, t);
-    agoo_queue_wakeup(&agoo_server.con_queue);
 
     return Qfalse;
 }
@@ -662,7 +891,6 @@ handle_wab_inner(VALUE x) {
     }
     DATA_PTR(rr) = NULL;
     agoo_res_message_push(req->res, response_text(rres));
-    agoo_queue_wakeup(&agoo_server.con_queue);
 
     return Qfalse;
 }
@@ -681,12 +909,12 @@ handle_push_inner(VALUE x) {
     switch (req->method) {
     case AGOO_ON_MSG:
         if (req->up->on_msg && NULL != req->hook) {
-            rb_funcall((VALUE)req->hook->handler, on_message_id, 2, (VALUE)req->up->wrap, rb_str_new(req->msg, req->mlen));
+            rb_funcall((VALUE)req->hook->handler, on_message_id, 2, (VALUE)req->up->wrap, rb_str_new(req->body.start, req->body.len));
         }
         break;
     case AGOO_ON_BIN:
         if (req->up->on_msg && NULL != req->hook) {
-            volatile VALUE  rstr = rb_str_new(req->msg, req->mlen);
+            volatile VALUE  rstr = rb_str_new(req->body.start, req->body.len);
 
             rb_enc_associate(rstr, rb_ascii8bit_encoding());
             rb_funcall((VALUE)req->hook->handler, on_message_id, 2, (VALUE)req->up->wrap, rstr);
@@ -767,7 +995,6 @@ handle_protected(agooReq req, bool gvi) {
         break;
     case FUNC_HOOK:
         req->hook->func(req);
-        agoo_queue_wakeup(&agoo_server.con_queue);
         break;
     default: {
         char    buf[256];
@@ -776,30 +1003,37 @@ handle_protected(agooReq req, bool gvi) {
 
         req->res->close = true;
         agoo_res_message_push(req->res, message);
-        agoo_queue_wakeup(&agoo_server.con_queue);
         break;
     }
     }
 }
 
+// The eval_running count is incremented when the thread is created so a
+// thread that has not started yet is waited on as well. A shutdown from
+// this thread is started after it is done with the queue.
 static void*
 process_loop(void *ptr) {
     agooReq req;
+    bool    stop = false;
 
+    eval_thread = true;
+    agoo_affinity_eval();
     atomic_fetch_add(&agoo_server.running, 1);
     while (agoo_server.active) {
         if (NULL != (req = (agooReq)agoo_queue_pop(&agoo_server.eval_queue, poll_timeout))) {
             handle_protected(req, true);
             agoo_req_destroy(req);
         }
-        if (agoo_stop) {
-            agoo_shutdown();
+        if (agoo_stop || agoo_server.drained) {
+            stop = true;
             break;
         }
-        agoo_queue_wakeup(&agoo_server.con_queue); // TBD remove if it doesn't speed up the response time
     }
     atomic_fetch_sub(&agoo_server.running, 1);
-
+    atomic_fetch_sub(&agoo_server.eval_running, 1);
+    if (stop) {
+        agoo_shutdown();
+    }
     return NULL;
 }
 
@@ -824,6 +1058,7 @@ rserver_start(VALUE self) {
     VALUE   *vp;
     int     i;
     int     pid;
+    int     windex = 0;
     double    giveup;
     struct _agooErr err = AGOO_ERR_INIT;
     VALUE   agoo = rb_const_get_at(rb_cObject, rb_intern("Agoo"));
@@ -834,7 +1069,9 @@ rserver_start(VALUE self) {
 
     // If workers then set the loop_max based on the expected number of
     // threads per worker.
-    if (1 < the_rserver.worker_cnt) {
+    if (0 < the_rserver.loop_max) {
+        agoo_server.loop_max = the_rserver.loop_max;
+    } else if (1 < the_rserver.worker_cnt) {
         agoo_server.loop_max /= the_rserver.worker_cnt;
         if (agoo_server.loop_max < 1) {
             agoo_server.loop_max = 1;
@@ -843,6 +1080,12 @@ rserver_start(VALUE self) {
     if (AGOO_ERR_OK != setup_listen(&err)) {
         rb_raise(rb_eIOError, "%s", err.msg);
     }
+    if (0 < the_rserver.preload && AGOO_ERR_OK != agoo_pages_preload(&err, the_rserver.preload)) {
+        rb_raise(rb_eIOError, "%s", err.msg);
+    }
+    if (AGOO_ERR_OK != agoo_bus_setup(&err, the_rserver.worker_cnt)) {
+        rb_raise(rb_eIOError, "%s", err.msg);
+    }
     if (1 < the_rserver.worker_cnt && the_rserver.forker != Qnil) {
         ID      before = rb_intern("before");
 
@@ -865,17 +1108,44 @@ rserver_start(VALUE self) {
             if (AGOO_ERR_OK != agoo_log_start(&err, true)) {
                 rb_raise(rb_eStandardError, "%s", err.msg);
             }
+            agoo_bus_attach(i);
+            windex = i;
             break;
         } else {
             the_rserver.worker_pids[i] = pid;
         }
     }
+    if (getpid() == *the_rserver.worker_pids) {
+        agoo_bus_attach(0);
+        if (NULL == the_rserver.restart_argv &&
+            NULL == (the_rserver.restart_argv = agoo_handoff_cmdline())) {
+            VALUE   cmd = rb_ary_new();
+
+            if (rb_const_defined(rb_cObject, rb_intern("RbConfig"))) {
+                rb_ary_push(cmd, rb_funcall(rb_const_get(rb_cObject, rb_intern("RbConfig")), rb_intern("ruby"), 0));
+            } else {
+                rb_ary_push(cmd, rb_str_new_cstr("ruby"));
+            }
+            rb_ary_push(cmd, rb_gv_get("$0"));
+            rb_ary_concat(cmd, rb_get_argv());
+            the_rserver.restart_argv = restart_argv(cmd);
+        }
+        if (AGOO_ERR_OK != agoo_handoff_setup(&err, the_rserver.restart_argv, the_rserver.worker_pids, the_rserver.worker_cnt, the_rserver.restart_timeout)) {
+            rb_raise(rb_eArgError, "%s", err.msg);
+        }
+        the_rserver.restart_argv = NULL; // owned by the handoff now
+    }
+    if (1 < the_rserver.worker_cnt && AGOO_ERR_OK != agoo_affinity_worker(&err, windex)) {
+        rb_raise(rb_eStandardError, "%s", err.msg);
+    }
     if (1 < the_rserver.worker_cnt && the_rserver.forker != Qnil && rb_respond_to(the_rserver.forker, after)) {
         rb_funcall(the_rserver.forker, after, 0);
     }
+    agoo_server.eval_queue.spin = agoo_server.busy_poll;
     if (AGOO_ERR_OK != agoo_server_start(&err, "Agoo", StringValuePtr(v))) {
         rb_raise(rb_eStandardError, "%s", err.msg);
     }
+    agoo_handoff_done(0 == windex);
     if (0 >= agoo_server.thread_cnt) {
         agooReq req;
 
@@ -886,7 +1156,7 @@ rserver_start(VALUE self) {
             } else {
                 rb_thread_schedule();
             }
-            if (agoo_stop) {
+            if (agoo_stop || agoo_server.drained) {
                 agoo_shutdown();
                 break;
             }
@@ -896,6 +1166,7 @@ rserver_start(VALUE self) {
             rb_raise(rb_eNoMemError, "Failed to allocate memory for the thread pool.");
         }
         for (i = agoo_server.thread_cnt, vp = the_rserver.eval_threads; 0 < i; i--, vp++) {
+            atomic_fetch_add(&agoo_server.eval_running, 1);
             *vp = rb_thread_create(wrap_process_loop, NULL);
         }
         *vp = Qnil;
@@ -917,20 +1188,32 @@ rserver_start(VALUE self) {
     return Qnil;
 }
 
+static void*
+wait_runners(void *x) {
+    double  timeout = dtime() + 2.0;
+
+    while (dtime() < timeout) {
+        if (0 >= (long)atomic_load(&agoo_server.eval_running)) {
+            break;
+        }
+        dsleep(0.02);
+    }
+    return NULL;
+}
+
 static void
 stop_runners(void) {
     // The preferred method of waiting for the ruby threads would be either a
     // join or even a kill but since we may not have the gvl here that would
-    // cause a segfault. Instead we set a timeout and wait for the running
-    // counter to drop to zero.
+    // cause a segfault. Instead we set a timeout and wait for the eval
+    // threads to leave the eval queue. An eval thread may be waiting for the
+    // gvl to finish a request so the gvl is released while waiting unless
+    // this is an eval thread, which does not hold it.
     if (NULL != the_rserver.eval_threads) {
-        double  timeout = dtime() + 2.0;
-
-        while (dtime() < timeout) {
-            if (0 >= (long)atomic_load(&agoo_server.running)) {
-                break;
-            }
-            dsleep(0.02);
+        if (eval_thread) {
+            wait_runners(NULL);
+        } else {
+            rb_thread_call_without_gvl(wait_runners, NULL, RUBY_UBF_IO, NULL);
         }
         AGOO_FREE(the_rserver.eval_threads);
         the_rserver.eval_threads = NULL;
@@ -954,8 +1237,23 @@ rserver_shutdown(VALUE self) {
             int exit_cnt = 1;
             int j;
 
+            if (agoo_server.draining) {
+                // Draining workers exit on their own once their connections
+                // have closed so they are given until the drain deadline.
+                while (exit_cnt < the_rserver.worker_cnt && dtime() < agoo_server.drain_deadline + 1.0) {
+                    for (i = 1; i < the_rserver.worker_cnt; i++) {
+                        if (0 < the_rserver.worker_pids[i] && 0 < waitpid(the_rserver.worker_pids[i], &status, WNOHANG)) {
+                            the_rserver.worker_pids[i] = 0;
+                            exit_cnt++;
+                        }
+                    }
+                    dsleep(0.1);
+                }
+            }
             for (i = 1; i < the_rserver.worker_cnt; i++) {
-                kill(the_rserver.worker_pids[i], SIGKILL);
+                if (0 < the_rserver.worker_pids[i]) {
+                    kill(the_rserver.worker_pids[i], SIGKILL);
+                }
             }
             for (j = 0; j < 20; j++) {
                 for (i = 1; i < the_rserver.worker_cnt; i++) {
@@ -1292,6 +1590,60 @@ use(int argc, VALUE *argv, VALUE self) {
     return Qnil;
 }
 
+/* Document-method: restart
+ *
+ * call-seq: restart()
+ *
+ * Restarts the server without refusing connections, the same as sending
+ * SIGUSR2 to the main process. A new process is started with the
+ * _:restart_command_ and handed the listening sockets. Once it is serving,
+ * this process and its workers stop accepting, close each connection when it
+ * has nothing in flight, and exit when all are closed or the
+ * _:drain_timeout_ has passed. If the new process does not start serving
+ * within the _:restart_timeout_ it is killed and this process carries on.
+ */
+static VALUE
+restart(VALUE self) {
+    agoo_server.restart = 1;
+
+    return Qnil;
+}
+
+/* Document-method: push_dropped
+ *
+ * call-seq: push_dropped()
+ *
+ * Returns the total number of push messages that were dropped or replaced
+ * because a connection exceeded the _:max_push_bytes_ limit.
+ */
+static VALUE
+push_dropped(VALUE self) {
+    return INT2NUM(atomic_load(&agoo_server.push_dropped));
+}
+
+/* Document-method: poll_stats
+ *
+ * call-seq: poll_stats()
+ *
+ * Returns a Hash of the time the connection loops spent spinning and
+ * parked. The _spin_ and _park_ values are seconds, _spin_wakes_ is the
+ * number of spins that found work, and _parks_ the number of blocking
+ * waits. The totals are updated by each loop about once a second.
+ */
+static VALUE
+poll_stats(VALUE self) {
+    struct _agooPollStats   stats;
+    volatile VALUE          h = rb_hash_new();
+
+    agoo_conloop_poll_stats(&stats);
+    rb_hash_aset(h, ID2SYM(rb_intern("spin")), rb_float_new(stats.spin));
+    rb_hash_aset(h, ID2SYM(rb_intern("park")), rb_float_new(stats.park));
+    rb_hash_aset(h, ID2SYM(rb_intern("spin_wakes")), LONG2NUM(stats.spin_wakes));
+    rb_hash_aset(h, ID2SYM(rb_intern("parks")), LONG2NUM(stats.parks));
+
+    return h;
+}
+
 static size_t
 server_size(const void *ptr) {
     return sizeof(struct _agooServer);
@@ -1331,6 +1683,9 @@ server_init(VALUE mod) {
     rb_define_module_function(server_mod, "use", use, -1);
 
     rb_define_module_function(server_mod, "rack_early_hints", rack_early_hints, 1);
+    rb_define_module_function(server_mod, "restart", restart, 0);
+    rb_define_module_function(server_mod, "push_dropped", push_dropped, 0);
+    rb_define_module_function(server_mod, "poll_stats", poll_stats, 0);
 
     call_id = rb_intern("call");
     each_id = rb_intern("each");
@@ -17,6 +17,10 @@ typedef struct _rUse {
 typedef struct _rServer {
     int		worker_cnt;
     int		worker_pids[MAX_WORKERS];
+    int		loop_max; // 0 to size from the CPU count
+    char	**restart_argv; // NULL to rerun the current script
+    double	restart_timeout;
+    long	preload; // bytes of static pages to read before forking, 0 for none
     VALUE	*eval_threads; // Qnil terminated
 		VALUE	forker;
     RUse	uses;
@@ -173,6 +173,26 @@ rup_pending(VALUE self) {
     return INT2NUM(pending);
 }
 
+/* Document-method: dropped
+ *
+ * call-seq: dropped()
+ *
+ * Returns the number of push messages to the connection that were dropped or
+ * replaced because the _:max_push_bytes_ limit was reached. If the
+ * connection is closed then -1 is returned.
+ */
+static VALUE
+rup_dropped(VALUE self) {
+    agooUpgraded	up = get_upgraded(self);
+    int			dropped = -1;
+
+    if (NULL != up) {
+	dropped = agoo_upgraded_dropped(up);
+	atomic_fetch_sub(&up->ref_cnt, 1);
+    }
+    return INT2NUM(dropped);
+}
+
 /* Document-method: open?
  *
  * call-seq: open?()
@@ -307,6 +327,7 @@ upgraded_init(VALUE mod) {
     rb_define_method(upgraded_class, "unsubscribe", rup_unsubscribe, -1);
     rb_define_method(upgraded_class, "close", rup_close, 0);
     rb_define_method(upgraded_class, "pending", rup_pending, 0);
+    rb_define_method(upgraded_class, "dropped", rup_dropped, 0);
     rb_define_method(upgraded_class, "protocol", rup_protocol, 0);
     rb_define_method(upgraded_class, "publish", ragoo_publish, 2);
     rb_define_method(upgraded_class, "open?", rup_open, 0);
@@ -5,6 +5,8 @@
 
 #include "debug.h"
 #include "doc.h"
+#include "gqlarena.h"
+#include "gqlcache.h"
 #include "gqlvalue.h"
 #include "graphql.h"
 #include "sdl.h"
@@ -405,6 +407,7 @@ make_dir_arg(agooErr err, agooDoc doc, gqlDir dir) {
 	}
 	doc->cur++;
     } else if ('=' == *doc->cur) {
+	doc->cur++;
 	if (NULL == (dv = agoo_doc_read_value(err, doc, type))) {
 	    return err->code;
 	}
@@ -507,6 +510,7 @@ make_field_arg(agooErr err, agooDoc doc, gqlField field) {
 
     switch (*doc->cur) {
     case '=':
+	doc->cur++;
 	if (NULL == (dval = agoo_doc_read_value(err, doc, type))) {
 	    return err->code;
 	}
@@ -876,14 +880,16 @@ extend(agooErr err, agooDoc doc) {
     return AGOO_ERR_OK;
 }
 
-int
-sdl_parse(agooErr err, const char *str, int len) {
+static int
+parse_schema(agooErr err, const char *str, int len) {
     struct _agooDoc	doc;
     const char		*desc = NULL;
     size_t		dlen = 0;
     bool		extend_next = false;
 
     agoo_doc_init(&doc, str, len);
+    // Cached documents were validated against the old types.
+    gql_cache_clear();
 
     while (doc.cur < doc.end) {
 	agoo_doc_next_token(&doc);
@@ -1030,15 +1036,22 @@ make_sel_arg(agooErr err, agooDoc doc, gqlDoc gdoc, gqlOp op, gqlSel sel) {
 		break;
 	    }
 	}
-	if (NULL == var || NULL == var->value) {
+	if (NULL == var) {
 	    for (var = gdoc->vars; NULL != var; var = var->next) {
 		if (0 == strcmp(var_name, var->name)) {
 		    break;
 		}
 	    }
 	}
+	// Values are looked up by name when evaluated so a variable not
+	// declared by the operation is recorded with no type and must be
+	// provided with the request.
 	if (NULL == var) {
-	    return agoo_doc_err(doc, err, "variable $%s not defined for operation or document", var_name);
+	    if (NULL == (var = gql_op_var_create(err, var_name, NULL, NULL))) {
+		return err->code;
+	    }
+	    var->next = gdoc->vars;
+	    gdoc->vars = var;
 	}
     } else if (NULL == (value = agoo_doc_read_value(err, doc, NULL))) {
 	return err->code;
@@ -1160,9 +1173,11 @@ sel_create(agooErr err, const char *alias, const char *name, const char *frag) {
 	    }
 	}
 	sel->type = NULL;
+	sel->field = NULL;
 	sel->dir = NULL;
     	sel->args = NULL;
 	sel->sels = NULL;
+	sel->spread = NULL;
 	sel->inline_frag = NULL;
     }
     return sel;
@@ -1345,7 +1360,7 @@ make_sel(agooErr err, agooDoc doc, gqlDoc gdoc, gqlOp op, gqlSel *parentp) {
 }
 
 static gqlType
-lookup_field_type(gqlType type, const char *field, bool qroot) {
+lookup_field_type(gqlType type, const char *field, bool qroot, gqlField *fp) {
     gqlType	ftype = NULL;
 
     switch (type->kind) {
@@ -1358,6 +1373,9 @@ lookup_field_type(gqlType type, const char *field, bool qroot) {
 	for (f = type->fields; NULL != f; f = f->next) {
 	    if (0 == strcmp(field, f->name)) {
 		ftype = f->type;
+		if (NULL != fp) {
+		    *fp = f;
+		}
 		break;
 	    }
 	}
@@ -1376,7 +1394,7 @@ lookup_field_type(gqlType type, const char *field, bool qroot) {
     }
     case GQL_LIST:
     case GQL_NON_NULL:
-	ftype = lookup_field_type(type->base, field, false);
+	ftype = lookup_field_type(type->base, field, false, fp);
 	break;
     case GQL_UNION: // Can not be used directly for query type determinations.
     default:
@@ -1388,7 +1406,7 @@ lookup_field_type(gqlType type, const char *field, bool qroot) {
 static bool
 has_all_fields(gqlType type, gqlSel sel) {
     for (; NULL != sel; sel = sel->next) {
-	if (NULL == lookup_field_type(type, sel->name, false)) {
+	if (NULL == lookup_field_type(type, sel->name, false, NULL)) {
 	    return false;
 	}
     }
@@ -1471,9 +1489,9 @@ make_op(agooErr err, agooDoc doc, gqlDoc gdoc, gqlOpKind kind) {
     }
     if (0 < nlen) {
 	gqlType	schema = gql_root_type();
-	gqlType	type = lookup_field_type(schema, kind_str, false);
+	gqlType	type = lookup_field_type(schema, kind_str, false, NULL);
 
-	if ((NULL != lookup_field_type(type, name, false)) &&
+	if ((NULL != lookup_field_type(type, name, false, NULL)) &&
 	    !has_all_fields(type, op->sels)) {
 
 	    gqlSel	wrap = sel_create(err, NULL, name, NULL);
@@ -1562,8 +1580,10 @@ make_fragment(agooErr err, agooDoc doc, gqlDoc gdoc) {
     return AGOO_ERR_OK;
 }
 
+// Sets the type and field of each selection and links fragment spreads to
+// their fragments so evaluation does not have to look them up by name.
 static int
-sel_set_type(agooErr err, gqlType type, gqlSel sels, bool qroot) {
+sel_set_type(agooErr err, gqlDoc doc, gqlType type, gqlSel sels, bool qroot) {
     gqlSel	sel;
 
     for (sel = sels; NULL != sel; sel = sel->next) {
@@ -1575,17 +1595,26 @@ sel_set_type(agooErr err, gqlType type, gqlSel sels, bool qroot) {
 		if (NULL != sel->inline_frag->on) {
 		    ftype = sel->inline_frag->on;
 		}
-		if (AGOO_ERR_OK != sel_set_type(err, ftype, sel->inline_frag->sels, false)) {
+		if (AGOO_ERR_OK != sel_set_type(err, doc, ftype, sel->inline_frag->sels, false)) {
 		    return err->code;
 		}
+	    } else if (NULL != sel->frag) {
+		gqlFrag	frag;
+
+		for (frag = doc->frags; NULL != frag; frag = frag->next) {
+		    if (NULL != frag->name && 0 == strcmp(frag->name, sel->frag)) {
+			sel->spread = frag;
+			break;
+		    }
+		}
 	    }
 	} else {
-	    if (NULL == (sel->type = lookup_field_type(type, sel->name, qroot))) {
+	    if (NULL == (sel->type = lookup_field_type(type, sel->name, qroot, &sel->field))) {
 		return agoo_err_set(err, AGOO_ERR_EVAL, "Failed to determine the type for %s in %s.", sel->name, type->name);
 	    }
 	}
 	if (NULL != sel->sels) {
-	    if (AGOO_ERR_OK != sel_set_type(err, sel->type, sel->sels, false)) {
+	    if (AGOO_ERR_OK != sel_set_type(err, doc, sel->type, sel->sels, false)) {
 		return err->code;
 	    }
 	}
@@ -1605,7 +1634,16 @@ validate_doc(agooErr err, gqlDoc doc) {
 	return agoo_err_set(err, AGOO_ERR_EVAL, "No root (schema) type defined.");
     }
     for (frag = doc->frags; NULL != frag; frag = frag->next) {
-	if (AGOO_ERR_OK != sel_set_type(err, frag->on, frag->sels, false)) {
+	if (NULL != frag->name) {
+	    gqlFrag	f2 = frag->next;
+
+	    for (; NULL != f2; f2 = f2->next) {
+		if (NULL != f2->name && 0 == strcmp(f2->name, frag->name)) {
+		    return agoo_err_set(err, AGOO_ERR_EVAL, "Multiple fragments named '%s'.", frag->name);
+		}
+	    }
+	}
+	if (AGOO_ERR_OK != sel_set_type(err, doc, frag->on, frag->sels, false)) {
 	    return err->code;
 	}
     }
@@ -1632,13 +1670,13 @@ validate_doc(agooErr err, gqlDoc doc) {
     for (op = doc->ops; NULL != op; op = op->next) {
 	switch (op->kind) {
 	case GQL_QUERY:
-	    type = lookup_field_type(schema, query_str, false);
+	    type = lookup_field_type(schema, query_str, false, NULL);
 	    break;
 	case GQL_MUTATION:
-	    type = lookup_field_type(schema, mutation_str, false);
+	    type = lookup_field_type(schema, mutation_str, false, NULL);
 	    break;
 	case GQL_SUBSCRIPTION:
-	    type = lookup_field_type(schema, subscription_str, false);
+	    type = lookup_field_type(schema, subscription_str, false, NULL);
 	    break;
 	default:
 	    break;
@@ -1646,15 +1684,27 @@ validate_doc(agooErr err, gqlDoc doc) {
 	if (NULL == type) {
 	    return agoo_err_set(err, AGOO_ERR_EVAL, "Not a supported operation type.");
 	}
-	if (AGOO_ERR_OK != sel_set_type(err, type, op->sels, GQL_QUERY == op->kind)) {
+	if (AGOO_ERR_OK != sel_set_type(err, doc, type, op->sels, GQL_QUERY == op->kind)) {
 	    return err->code;
 	}
     }
     return AGOO_ERR_OK;
 }
 
-gqlDoc
-sdl_parse_doc(agooErr err, const char *str, int len, gqlVar vars, gqlOpKind default_kind) {
+// Schemas and parsed documents outlive a request so they are never
+// allocated from a request arena.
+int
+sdl_parse(agooErr err, const char *str, int len) {
+    gqlArena	prev = gql_arena_use(NULL);
+    int		code = parse_schema(err, str, len);
+
+    gql_arena_use(prev);
+
+    return code;
+}
+
+static gqlDoc
+parse_doc(agooErr err, const char *str, int len, gqlVar vars, gqlOpKind default_kind) {
     struct _agooDoc	doc;
     gqlDoc		gdoc = NULL;
 
@@ -1700,3 +1750,13 @@ DONE:
     }
     return gdoc;
 }
+
+gqlDoc
+sdl_parse_doc(agooErr err, const char *str, int len, gqlVar vars, gqlOpKind default_kind) {
+    gqlArena	prev = gql_arena_use(NULL);
+    gqlDoc	doc = parse_doc(err, str, len, vars, default_kind);
+
+    gql_arena_use(prev);
+
+    return doc;
+}
@@ -9,12 +9,16 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "affinity.h"
+#include "bus.h"
 #include "con.h"
+#include "debug.h"
 #include "domain.h"
 #include "dtime.h"
 #include "gqlsub.h"
 #include "gqlvalue.h"
 #include "graphql.h"
+#include "handoff.h"
 #include "http.h"
 #include "hook.h"
 #include "log.h"
@@ -26,7 +30,15 @@
 
 #include "server.h"
 
-#define LOOP_UP   100
+// A loop is added when the active loops average more than LOOP_UP
+// connections or a busy ratio over LOOP_BUSY_UP per mille. One is parked
+// after LOOP_IDLE_CHECKS checks in a row where the rest could easily carry
+// the load.
+#define LOOP_UP			100
+#define LOOP_BUSY_UP		700
+#define LOOP_BUSY_DOWN		200
+#define LOOP_IDLE_CHECKS	5
+#define LOOP_CHECK_SECS		1.0
 
 struct _agooServer  agoo_server = {false};
 
@@ -39,9 +51,12 @@ agoo_server_setup(agooErr err) {
     agoo_server.up_list = NULL;
     agoo_server.gsub_list = NULL;
     agoo_server.max_push_pending = 32;
+    agoo_server.max_push_bytes = 0;
+    agoo_server.push_policy = AGOO_PUSH_DROP_NEWEST;
+    atomic_init(&agoo_server.push_dropped, 0);
+    agoo_server.drain_timeout = 10.0;
 
     if (AGOO_ERR_OK != agoo_pages_init(err) ||
-        AGOO_ERR_OK != agoo_queue_multi_init(err, &agoo_server.con_queue, 1024, false, true) ||
         AGOO_ERR_OK != agoo_queue_multi_init(err, &agoo_server.eval_queue, 1024, true, true)) {
         return err->code;
     }
@@ -94,15 +109,104 @@ agoo_server_ssl_init(agooErr err, const char *cert_pem, const char *key_pem) {
 }
 
 static void
-add_con_loop() {
+add_con_loop(void) {
     struct _agooErr err = AGOO_ERR_INIT;
-    agooConLoop   loop = agoo_conloop_create(&err, 0);
+    agooConLoop   loop = agoo_conloop_create(&err, agoo_server.loop_cnt);
 
-    if (NULL != loop) {
-        loop->next = agoo_server.con_loops;
-        agoo_server.con_loops = loop;
-        agoo_server.loop_cnt++;
+    if (NULL == loop) {
+        agoo_log_cat(&agoo_error_cat, "Failed to add a connection loop. %s", err.msg);
+        return;
     }
+    loop->next = agoo_server.con_loops;
+    agoo_server.con_loops = loop;
+    agoo_server.loop_cnt++;
+}
+
+// Called periodically from the listen thread, the only thread that changes
+// the set of loops once started. Loops are never removed from the list
+// since other threads walk it. Instead a loop is parked so it takes no new
+// connections and sleeps once its existing connections have closed. A
+// parked loop is the first choice when more are needed.
+static void
+scale_con_loops(void) {
+    static int  idle_checks = 0;
+    agooConLoop loop;
+    agooConLoop parked = NULL;
+    agooConLoop idlest = NULL;
+    long        active = 0;
+    long        load = 0;
+    long        cons = 0;
+
+    for (loop = agoo_server.con_loops; NULL != loop; loop = loop->next) {
+        if (loop->parked) {
+            parked = loop;
+            continue;
+        }
+        active++;
+        load += (long)atomic_load(&loop->load);
+        cons += (long)atomic_load(&loop->con_cnt);
+        if (NULL == idlest || (long)atomic_load(&loop->con_cnt) < (long)atomic_load(&idlest->con_cnt)) {
+            idlest = loop;
+        }
+    }
+    if (active < agoo_server.loop_max && (LOOP_BUSY_UP * active < load || LOOP_UP * active < cons)) {
+        idle_checks = 0;
+        if (NULL != parked) {
+            parked->parked = false;
+            // The loop may be waiting out its park so wake it to take
+            // connections right away.
+            agoo_queue_wakeup(&parked->con_queue);
+            agoo_log_cat(&agoo_info_cat, "Connection loop %d resumed with %ld active.", parked->id, active + 1);
+        } else {
+            add_con_loop();
+            agoo_log_cat(&agoo_info_cat, "Connection loop added with %ld active.", active + 1);
+        }
+    } else if (1 < active && LOOP_BUSY_DOWN * (active - 1) > load && LOOP_UP * (active - 1) / 2 > cons) {
+        if (LOOP_IDLE_CHECKS <= ++idle_checks) {
+            idle_checks = 0;
+            idlest->parked = true;
+            agoo_log_cat(&agoo_info_cat, "Connection loop %d parked with %ld active.", idlest->id, active - 1);
+        }
+    } else {
+        idle_checks = 0;
+    }
+}
+
+// Hands a new connection to the active loop with the lowest load score, the
+// number of connections weighted by how busy the loop has been. A shared
+// queue would let whichever loop woke first take a whole burst. When loops
+// are pinned, the loop on the CPU that received the connection is used
+// unless its score is more than twice the lowest.
+static void
+assign_con(agooCon con) {
+    agooConLoop loop;
+    agooConLoop best = NULL;
+    agooConLoop local = NULL;
+    long        score;
+    long        best_score = 0;
+    long        local_score = 0;
+    int         cpu = agoo_affinity_incoming_cpu(con->sock);
+
+    for (loop = agoo_server.con_loops; NULL != loop; loop = loop->next) {
+        if (loop->parked) {
+            continue;
+        }
+        score = ((long)atomic_load(&loop->con_cnt) + 1) * (1000 + (long)atomic_load(&loop->load));
+        if (NULL == best || score < best_score) {
+            best = loop;
+            best_score = score;
+        }
+        if (0 <= cpu && cpu == agoo_affinity_loop_cpu(loop->id) && (NULL == local || score < local_score)) {
+            local = loop;
+            local_score = score;
+        }
+    }
+    if (NULL != local && local_score <= best_score * 2) {
+        best = local;
+    }
+    atomic_fetch_add(&agoo_server.con_cnt, 1);
+    atomic_fetch_add(&best->con_cnt, 1);
+    agoo_queue_push(&best->con_queue, (void*)con);
 }
 
 static void*
@@ -119,6 +223,7 @@ listen_loop(void *x) {
     int     i;
     uint64_t    cnt = 0;
     agooBind    b;
+    double      next_check = dtime() + LOOP_CHECK_SECS;
 
     for (b = agoo_server.binds, p = pa; NULL != b; b = b->next, p++, pcnt++) {
         p->fd = b->fd;
@@ -129,13 +234,42 @@ listen_loop(void *x) {
     atomic_fetch_add(&agoo_server.running, 1);
     while (agoo_server.active) {
         if (0 > (i = poll(pa, pcnt, 200))) {
-            if (EAGAIN == errno) {
+            if (EAGAIN == errno || EINTR == errno) {
                 continue;
             }
             agoo_log_cat(&agoo_error_cat, "Server polling error. %s.", strerror(errno));
             // Either a signal or something bad like out of memory. Might as well exit.
             break;
         }
+        if (next_check <= dtime()) {
+            scale_con_loops();
+            next_check = dtime() + LOOP_CHECK_SECS;
+        }
+        if (agoo_server.restart) {
+            agoo_server.restart = 0;
+            if (AGOO_ERR_OK != agoo_handoff_restart(&err)) {
+                agoo_log_cat(&agoo_error_cat, "Restart of pid %d failed. %s", getpid(), err.msg);
+                agoo_err_clear(&err);
+            }
+        }
+        if (agoo_server.drain) {
+            agoo_server.drain = 0;
+            agoo_server_drain();
+        }
+        if (agoo_server.draining) {
+            if (0 < pcnt) {
+                for (b = agoo_server.binds; NULL != b; b = b->next) {
+                    agoo_bind_close(b);
+                }
+                pcnt = 0;
+                agoo_log_cat(&agoo_info_cat, "Server with pid %d stopped accepting, draining %ld connections.",
+                             getpid(), (long)atomic_load(&agoo_server.con_cnt));
+            }
+            if (0 >= (long)atomic_load(&agoo_server.con_cnt) || agoo_server.drain_deadline <= dtime()) {
+                agoo_server.drained = true;
+            }
+            continue;
+        }
         if (0 == i) { // nothing to read
             continue;
         }
@@ -149,7 +283,6 @@ listen_loop(void *x) {
                     cnt--;
                     agoo_err_clear(&err);
                 } else {
-                    // int con_cnt;
 #ifdef OSX_OS
                     setsockopt(client_sock, SOL_SOCKET, SO_NOSIGPIPE, &optval, sizeof(optval));
 #endif
@@ -160,16 +293,16 @@ listen_loop(void *x) {
                     //fcntl(client_sock, F_SETFL, FNDELAY);
                     setsockopt(client_sock, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval));
                     setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+#ifdef SO_BUSY_POLL
+                    if (0 < agoo_server.so_busy_poll &&
+                        0 != setsockopt(client_sock, SOL_SOCKET, SO_BUSY_POLL, &agoo_server.so_busy_poll, sizeof(agoo_server.so_busy_poll))) {
+                        agoo_log_cat(&agoo_warn_cat, "Failed to set SO_BUSY_POLL, turning it off. %s.", strerror(errno));
+                        agoo_server.so_busy_poll = 0;
+                    }
+#endif
                     agoo_log_cat(&agoo_con_cat, "Server with pid %d accepted connection %llu on %s [%d] from %s",
                                  getpid(), (unsigned long long)cnt, b->id, con->sock, con->remote);
-
-		    /* TBD
-		       con_cnt = atomic_fetch_add(&agoo_server.con_cnt, 1);
-		       if (agoo_server.loop_max > agoo_server.loop_cnt && agoo_server.loop_cnt * LOOP_UP < con_cnt) {
-		       add_con_loop();
-		       }
-		    */
-                    agoo_queue_push(&agoo_server.con_queue, (void*)con);
+                    assign_con(con);
                 }
             }
             if (0 != (p->revents & (POLLERR | POLLHUP | POLLNVAL))) {
@@ -197,22 +330,22 @@ agoo_server_start(agooErr err, const char *app_name, const char *version) {
     int   xcnt = 0;
     int   stat;
 
+    // Start with a single connection loop. The listen thread adds more, up
+    // to loop_max, as the load grows and parks them again when it drops.
+    if (NULL == (agoo_server.con_loops = agoo_conloop_create(err, 0))) {
+        return err->code;
+    }
+    agoo_server.loop_cnt = 1;
+    xcnt++;
     if (0 != (stat = pthread_create(&agoo_server.listen_thread, NULL, listen_loop, NULL))) {
         return agoo_err_set(err, stat, "Failed to create server listener thread. %s", strerror(stat));
     }
     xcnt++;
-    agoo_server.con_loops = agoo_conloop_create(err, 0);
-    agoo_server.loop_cnt = 1;
-    xcnt++;
-
-    // If the eval thread count is 1 that implies the eval load is low so
-    // might as well create the maximum number of con threads as is
-    // reasonable.
-    if (1 >= agoo_server.thread_cnt) {
-        while (agoo_server.loop_cnt < agoo_server.loop_max) {
-            add_con_loop();
-            xcnt++;
+    if (agoo_bus_active()) {
+        if (AGOO_ERR_OK != agoo_bus_start(err)) {
+            return err->code;
         }
+        xcnt++;
     }
     giveup = dtime() + 1.0;
     while (dtime() < giveup) {
@@ -231,11 +364,27 @@ agoo_server_start(agooErr err, const char *app_name, const char *version) {
     return AGOO_ERR_OK;
 }
 
+// Stops accepting and closes connections as they go idle. The server is
+// marked drained once all are closed or the drain timeout has passed.
+void
+agoo_server_drain(void) {
+    if (!agoo_server.draining) {
+        agoo_server.drain_deadline = dtime() + agoo_server.drain_timeout;
+        agoo_server.draining = true;
+    }
+}
+
 int
 setup_listen(agooErr err) {
     agooBind  b;
 
+    if (AGOO_ERR_OK != agoo_handoff_take(err, agoo_server.binds)) {
+        return err->code;
+    }
     for (b = agoo_server.binds; NULL != b; b = b->next) {
+        if (0 != b->fd) { // taken over from the process being replaced
+            continue;
+        }
         if (AGOO_ERR_OK != agoo_bind_listen(err, b)) {
             return err->code;
         }
@@ -249,45 +398,54 @@ void
 agoo_server_shutdown(const char *app_name, void (*stop)()) {
     if (agoo_server.inited) {
         agooConLoop loop;
+        double      giveup = dtime() + 1.0;
 
         agoo_log_cat(&agoo_info_cat, "%s with pid %d shutting down.", app_name, getpid());
         agoo_server.inited = false;
         if (agoo_server.active) {
-            double  giveup = dtime() + 1.0;
-
             agoo_server.active = false;
             pthread_detach(agoo_server.listen_thread);
             for (loop = agoo_server.con_loops; NULL != loop; loop = loop->next) {
                 pthread_detach(loop->thread);
             }
-            while (0 < (long)atomic_load(&agoo_server.running)) {
-                dsleep(0.1);
-                if (giveup < dtime()) {
-                    break;
-                }
-            }
-            if (NULL != stop) {
-                stop();
-            }
-            while (NULL != agoo_server.hooks) {
-                agooHook  h = agoo_server.hooks;
-
-                agoo_server.hooks = h->next;
-                agoo_hook_destroy(h);
+        }
+        // Active may have already been cleared by an exit handler so the
+        // threads are waited on and stopped either way.
+        while (0 < (long)atomic_load(&agoo_server.running)) {
+            dsleep(0.1);
+            if (giveup < dtime()) {
+                break;
             }
         }
+        if (NULL != stop) {
+            stop();
+        }
+        agoo_bus_shutdown();
+        agoo_affinity_cleanup();
+        agoo_handoff_cleanup();
+        while (NULL != agoo_server.hooks) {
+            agooHook  h = agoo_server.hooks;
+
+            agoo_server.hooks = h->next;
+            agoo_hook_destroy(h);
+        }
         while (NULL != agoo_server.binds) {
             agooBind  b = agoo_server.binds;
 
             agoo_server.binds = b->next;
             agoo_bind_destroy(b);
         }
-        agoo_queue_cleanup(&agoo_server.con_queue);
         while (NULL != (loop = agoo_server.con_loops)) {
             agoo_server.con_loops = loop->next;
             agoo_conloop_destroy(loop);
         }
-        agoo_queue_cleanup(&agoo_server.eval_queue);
+        // An eval thread still waiting on the queue would use it after it
+        // was freed so it is left as is if any have not exited.
+        if (0 >= (long)atomic_load(&agoo_server.eval_running)) {
+            agoo_queue_cleanup(&agoo_server.eval_queue);
+        } else {
+            agoo_log_cat(&agoo_warn_cat, "Eval threads did not exit before shutdown.");
+        }
 
         agoo_pages_cleanup();
         agoo_http_cleanup();
@@ -373,8 +531,18 @@ agoo_server_add_func_hook(agooErr err,
     return AGOO_ERR_OK;
 }
 
+// Publishes to all the connection loops in this process and, if there are
+// forked workers, to the loops in the other processes as well.
 void
 agoo_server_publish(struct _agooPub *pub) {
+    if (agoo_bus_active()) {
+        agoo_bus_send(pub);
+    }
+    agoo_server_publish_local(pub);
+}
+
+void
+agoo_server_publish_local(struct _agooPub *pub) {
     agooConLoop loop;
 
     for (loop = agoo_server.con_loops; NULL != loop; loop = loop->next) {
@@ -407,6 +575,7 @@ agoo_server_del_gsub(gqlSub sub) {
             } else {
                 prev->next = s->next;
             }
+            break;
         }
         prev = s;
     }
@@ -434,6 +603,12 @@ subject_check(const char *pattern, const char *subject) {
     return '\0' == *pattern && '\0' == *subject;
 }
 
+typedef struct _gpubSub {
+    gqlSub      sub;
+    agooText    text;
+    bool        lead; // first of the subscriptions sharing the text
+} *gpubSub;
+
 static agooText
 gpub_eval(agooErr err, gqlDoc query, gqlRef event) {
     agooText  t = NULL;
@@ -456,6 +631,7 @@ gpub_eval(agooErr err, gqlDoc query, gqlRef event) {
         }
         if (NULL == (t = agoo_text_allocate(1024))) {
             AGOO_ERR_MEM(err, "Text");
+            gql_value_destroy(result);
             return NULL;
         }
         t = gql_value_json(t, result, 0, 0);
@@ -464,10 +640,70 @@ gpub_eval(agooErr err, gqlDoc query, gqlRef event) {
     return t;
 }
 
+// Subscriptions with the same key are evaluated once and share the
+// text. An open addressed table of indices into subs finds the first of
+// each group. The first error is returned but the other groups are still
+// evaluated.
+static void
+gpub_eval_groups(agooErr err, gpubSub subs, int cnt, gqlRef event) {
+    int     size = 16;
+    int     mask;
+    int     *slots;
+    int     i;
+    int     k;
+
+    while (size < cnt * 2) {
+        size *= 2;
+    }
+    mask = size - 1;
+    if (NULL == (slots = (int*)AGOO_MALLOC(sizeof(int) * size))) {
+        AGOO_ERR_MEM(err, "GraphQL publish");
+        return;
+    }
+    memset(slots, 0xFF, sizeof(int) * size);
+    for (i = 0; i < cnt; i++) {
+        gqlSub  sub = subs[i].sub;
+        gqlSub  s;
+
+        for (k = (int)(sub->hash & mask); 0 <= slots[k]; k = (k + 1) & mask) {
+            s = subs[slots[k]].sub;
+            if (s->hash == sub->hash && 0 == strcmp(s->key, sub->key)) {
+                break;
+            }
+        }
+        if (0 <= slots[k]) {
+            subs[i].text = subs[slots[k]].text;
+        } else {
+            struct _agooErr e = AGOO_ERR_INIT;
+
+            slots[k] = i;
+            subs[i].lead = true;
+            if (NULL == (subs[i].text = gpub_eval(&e, sub->query, event))) {
+                if (AGOO_ERR_OK == err->code) {
+                    *err = e;
+                }
+            } else {
+                // Held until all the responses have their own reference.
+                agoo_text_ref(subs[i].text);
+            }
+        }
+    }
+    AGOO_FREE(slots);
+}
+
+// Only the matching subscriptions are collected while the lock is held so
+// new subscriptions and WebSocket upgrades are not blocked by the
+// evaluation. The hold count on each connection keeps it, and the
+// subscription that belongs to it, from being destroyed until the result
+// has been posted.
 int
 agoo_server_gpublish(agooErr err, const char *subject, gqlRef event) {
+    gpubSub subs = NULL;
     gqlSub  sub;
     gqlType type;
+    int     cnt = 0;
+    int     max = 0;
+    int     i;
 
     if (NULL == gql_type_func || NULL == (type = gql_type_func(event))) {
         return agoo_err_set(err, AGOO_ERR_TYPE, "Not able to determine the type for a GraphQL publish.");
@@ -475,22 +711,49 @@ agoo_server_gpublish(agooErr err, const char *subject, gqlRef event) {
     pthread_mutex_lock(&agoo_server.up_lock);
     for (sub = agoo_server.gsub_list; NULL != sub; sub = sub->next) {
         if (subject_check(sub->subject, subject)) {
-            agooRes res;
-            agooText  t;
+            if (max <= cnt) {
+                gpubSub s;
 
-            if (NULL == (res = agoo_res_create(sub->con))) {
-                AGOO_ERR_MEM(err, "Response");
-                break;
-            }
-            if (NULL == (t = gpub_eval(err, sub->query, event))) {
-                break;
+                max = (0 == max) ? 16 : max * 2;
+                if (NULL == (s = (gpubSub)AGOO_REALLOC(subs, sizeof(struct _gpubSub) * max))) {
+                    AGOO_ERR_MEM(err, "GraphQL publish");
+                    break;
+                }
+                subs = s;
             }
-            res->con_kind = AGOO_CON_ANY;
-            agoo_res_message_push(res, t);
-            agoo_con_res_append(sub->con, res);
+            atomic_fetch_add(&sub->con->hold, 1);
+            subs[cnt].sub = sub;
+            subs[cnt].text = NULL;
+            subs[cnt].lead = false;
+            cnt++;
         }
     }
     pthread_mutex_unlock(&agoo_server.up_lock);
 
+    if (0 < cnt && AGOO_ERR_OK == err->code) {
+        gpub_eval_groups(err, subs, cnt, event);
+    }
+    for (i = 0; i < cnt; i++) {
+        agooCon c = subs[i].sub->con;
+        agooRes res;
+
+        if (NULL != subs[i].text) {
+            if (NULL == (res = agoo_res_create(c))) {
+                AGOO_ERR_MEM(err, "Response");
+            } else {
+                res->con_kind = AGOO_CON_ANY;
+                agoo_res_message_set(res, subs[i].text);
+                agoo_con_push_post(c, res, subject);
+            }
+        }
+        atomic_fetch_sub(&c->hold, 1);
+    }
+    for (i = 0; i < cnt; i++) {
+        if (subs[i].lead && NULL != subs[i].text) {
+            agoo_text_release(subs[i].text);
+        }
+    }
+    AGOO_FREE(subs);
+
     return err->code;
 }
@@ -4,6 +4,7 @@
 #define AGOO_SERVER_H
 
 #include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 
 #ifdef HAVE_OPENSSL_SSL_H
@@ -27,6 +28,15 @@ struct _agooUpgraded;
 struct _gqlSub;
 struct _gqlValue;
 
+// What to do when a push connection's queue of unsent messages would exceed
+// the max_push_bytes limit.
+typedef enum {
+    AGOO_PUSH_DROP_NEWEST	= 'N',
+    AGOO_PUSH_DROP_OLDEST	= 'O',
+    AGOO_PUSH_COALESCE		= 'C',
+    AGOO_PUSH_DISCONNECT	= 'D',
+} agooPushPolicy;
+
 typedef struct _agooServer {
     volatile bool		inited;
     volatile bool		active;
@@ -35,8 +45,16 @@ typedef struct _agooServer {
     bool			root_first;
     bool			rack_early_hints;
     bool			tls;
+    bool			io_uring;
+    double			busy_poll; // spin budget in seconds, 0 for off
+    int				so_busy_poll; // microseconds, 0 for off
+    volatile sig_atomic_t	restart; // set by a signal to start a restart
+    volatile sig_atomic_t	drain; // set by a signal to drain and exit
+    volatile bool		draining;
+    volatile bool		drained; // all closed or out of time
+    double			drain_timeout;
+    double			drain_deadline;
     pthread_t			listen_thread;
-    struct _agooQueue		con_queue;
     agooHook			hooks;
     agooHook			hook404;
     agooBind			binds;
@@ -52,6 +70,9 @@ typedef struct _agooServer {
     struct _gqlSub		*gsub_list;
     pthread_mutex_t		up_lock;
     int				max_push_pending;
+    long			max_push_bytes; // per connection, 0 for no limit
+    agooPushPolicy		push_policy;
+    atomic_int			push_dropped;
     void			*env_nil_value;
     void			*ctx_nil_value;
 
@@ -61,6 +82,8 @@ typedef struct _agooServer {
     // A count of the running threads from the wrapper or the server managed
     // threads.
     atomic_int			running;
+    // Eval threads that have been started and not yet left the eval queue.
+    atomic_int			eval_running;
 } *agooServer;
 
 extern int	agoo_server_setup(agooErr err);
@@ -70,6 +93,7 @@ extern int	agoo_server_ssl_init(agooErr err, const char *cert_pem, const char *k
 
 extern int	setup_listen(agooErr err);
 extern int	agoo_server_start(agooErr err, const char *app_name, const char *version);
+extern void	agoo_server_drain(void);
 
 extern void	agoo_server_add_upgraded(struct _agooUpgraded *up);
 extern int	agoo_server_add_func_hook(agooErr	err,
@@ -80,6 +104,7 @@ extern int	agoo_server_add_func_hook(agooErr	err,
 					  bool		quick);
 
 extern void	agoo_server_publish(struct _agooPub *pub);
+extern void	agoo_server_publish_local(struct _agooPub *pub);
 
 extern void	agoo_server_add_gsub(struct _gqlSub *sub);
 extern void	agoo_server_del_gsub(struct _gqlSub *sub);
@@ -0,0 +1,123 @@
+// A straight implementation of SHA-256 as described in FIPS 180-4. It is
+// endian independent.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sha256.h"
+
+typedef struct {
+    uint32_t    h[8];
+    uint64_t    count; // bytes processed
+    uint8_t     buffer[64];
+} Ctx;
+
+static const uint32_t   k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ror(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+#define ch(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define maj(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define S0(x)       (ror(x, 2) ^ ror(x, 13) ^ ror(x, 22))
+#define S1(x)       (ror(x, 6) ^ ror(x, 11) ^ ror(x, 25))
+#define s0(x)       (ror(x, 7) ^ ror(x, 18) ^ ((x) >> 3))
+#define s1(x)       (ror(x, 17) ^ ror(x, 19) ^ ((x) >> 10))
+
+// Transform a 512 bit block.
+static void
+transform(Ctx *ctx, const uint8_t *block) {
+    uint32_t    w[64];
+    uint32_t    a = ctx->h[0];
+    uint32_t    b = ctx->h[1];
+    uint32_t    c = ctx->h[2];
+    uint32_t    d = ctx->h[3];
+    uint32_t    e = ctx->h[4];
+    uint32_t    f = ctx->h[5];
+    uint32_t    g = ctx->h[6];
+    uint32_t    h = ctx->h[7];
+    uint32_t    t1;
+    uint32_t    t2;
+    int         i;
+
+    for (i = 0; i < 16; i++, block += 4) {
+        w[i] = ((uint32_t)block[0] << 24) | ((uint32_t)block[1] << 16) | ((uint32_t)block[2] << 8) | (uint32_t)block[3];
+    }
+    for (; i < 64; i++) {
+        w[i] = s1(w[i - 2]) + w[i - 7] + s0(w[i - 15]) + w[i - 16];
+    }
+    for (i = 0; i < 64; i++) {
+        t1 = h + S1(e) + ch(e, f, g) + k[i] + w[i];
+        t2 = S0(a) + maj(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    ctx->h[0] += a;
+    ctx->h[1] += b;
+    ctx->h[2] += c;
+    ctx->h[3] += d;
+    ctx->h[4] += e;
+    ctx->h[5] += f;
+    ctx->h[6] += g;
+    ctx->h[7] += h;
+}
+
+static void
+update(Ctx *ctx, const uint8_t *data, size_t len) {
+    size_t      used = (size_t)(ctx->count & 0x3F);
+    size_t      cnt;
+
+    ctx->count += len;
+    while (0 < len) {
+        cnt = 64 - used;
+        if (len < cnt) {
+            cnt = len;
+        }
+        memcpy(ctx->buffer + used, data, cnt);
+        used += cnt;
+        data += cnt;
+        len -= cnt;
+        if (64 == used) {
+            transform(ctx, ctx->buffer);
+            used = 0;
+        }
+    }
+}
+
+void
+sha256(const uint8_t *data, size_t len, uint8_t *digest) {
+    Ctx         ctx = {
+        .h = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+        .count = 0,
+    };
+    uint8_t     pad[72];
+    uint64_t    bits;
+    size_t      plen;
+    int         i;
+
+    update(&ctx, data, len);
+    bits = ctx.count * 8;
+    plen = (size_t)(64 - ((ctx.count + 8) & 0x3F));
+    memset(pad, 0, sizeof(pad));
+    *pad = 0x80;
+    for (i = 0; i < 8; i++) {
+        pad[plen + i] = (uint8_t)(bits >> (56 - i * 8));
+    }
+    update(&ctx, pad, plen + 8);
+    for (i = 0; i < 32; i++) {
+        digest[i] = (uint8_t)(ctx.h[i >> 2] >> (24 - (i & 3) * 8));
+    }
+}
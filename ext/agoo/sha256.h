@@ -0,0 +1,11 @@
+#ifndef AGOO_SHA256_H
+#define AGOO_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+extern void sha256(const uint8_t *data, size_t len, uint8_t *digest);
+
+#endif // AGOO_SHA256_H
@@ -0,0 +1,161 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+#include "debug.h"
+
+#include "slab.h"
+
+// Number of objects carved from each block of memory added to a slab.
+#define BLOCK_CNT	64
+
+// The header is kept while the object is in use so a free from any thread
+// can find the owning slab.
+typedef struct _slot {
+    struct _agooSlab	*slab;
+    struct _slot	*next;
+} *Slot;
+
+typedef struct _agooSlab {
+    struct _agooSlab	*next; // on the orphan list
+    Slot		free; // only touched by the owning thread
+    _Atomic(Slot)	remote;
+    size_t		size;
+    agooSlabKind	kind;
+} *agooSlab;
+
+// Slabs are never released since objects from a slab can outlive the
+// thread that created it. When a thread exits its slabs are put on an
+// orphan list. Frees from other threads keep going to the remote list of
+// an orphan and the next thread that needs a slab of that kind adopts it
+// along with everything that has been freed.
+static _Thread_local agooSlab	slabs[AGOO_SLAB_KIND_CNT];
+
+static agooSlab		orphans[AGOO_SLAB_KIND_CNT];
+static pthread_mutex_t	orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t	slab_key;
+static pthread_once_t	slab_once = PTHREAD_ONCE_INIT;
+
+// Called on thread exit.
+static void
+slab_orphan(void *ignore) {
+    agooSlab	slab;
+    int		kind;
+
+    pthread_mutex_lock(&orphan_lock);
+    for (kind = 0; kind < AGOO_SLAB_KIND_CNT; kind++) {
+	if (NULL != (slab = slabs[kind])) {
+	    slabs[kind] = NULL;
+	    slab->next = orphans[kind];
+	    orphans[kind] = slab;
+	}
+    }
+    pthread_mutex_unlock(&orphan_lock);
+}
+
+static void
+slab_key_create(void) {
+    pthread_key_create(&slab_key, slab_orphan);
+}
+
+static agooSlab
+slab_adopt(agooSlabKind kind) {
+    agooSlab	slab;
+
+    pthread_mutex_lock(&orphan_lock);
+    if (NULL != (slab = orphans[kind])) {
+	orphans[kind] = slab->next;
+	slab->next = NULL;
+    }
+    pthread_mutex_unlock(&orphan_lock);
+
+    return slab;
+}
+
+static agooSlab
+slab_create(agooSlabKind kind, size_t size) {
+    agooSlab	slab;
+
+    if (NULL == (slab = (agooSlab)AGOO_MALLOC(sizeof(struct _agooSlab)))) {
+	return NULL;
+    }
+    slab->next = NULL;
+    slab->free = NULL;
+    slab->kind = kind;
+    atomic_init(&slab->remote, NULL);
+    // Keep every object aligned to 16 bytes.
+    slab->size = (sizeof(struct _slot) + size + 15) & ~(size_t)15;
+
+    return slab;
+}
+
+static bool
+slab_grow(agooSlab slab) {
+    char	*block;
+    Slot	slot;
+    int		i;
+
+    if (NULL == (block = (char*)AGOO_MALLOC(slab->size * BLOCK_CNT))) {
+	return false;
+    }
+    for (i = BLOCK_CNT - 1; 0 <= i; i--) {
+	slot = (Slot)(block + slab->size * i);
+	slot->slab = slab;
+	slot->next = slab->free;
+	slab->free = slot;
+    }
+    return true;
+}
+
+void*
+agoo_slab_alloc(agooSlabKind kind, size_t size) {
+    agooSlab	slab = slabs[kind];
+    Slot	slot;
+
+    if (NULL == slab) {
+	pthread_once(&slab_once, slab_key_create);
+	if (NULL == (slab = slab_adopt(kind)) && NULL == (slab = slab_create(kind, size))) {
+	    return NULL;
+	}
+	slabs[kind] = slab;
+	// Any non-NULL value so slab_orphan is called when the thread exits.
+	pthread_setspecific(slab_key, (void*)slabs);
+    }
+    if (NULL == slab->free) {
+	slab->free = (Slot)atomic_exchange(&slab->remote, NULL);
+	if (NULL == slab->free && !slab_grow(slab)) {
+	    return NULL;
+	}
+    }
+    slot = slab->free;
+    slab->free = slot->next;
+    slot->next = NULL;
+
+    return (void*)(slot + 1);
+}
+
+void
+agoo_slab_free(void *ptr) {
+    Slot	slot;
+    agooSlab	slab;
+
+    if (NULL == ptr) {
+	return;
+    }
+    slot = (Slot)ptr - 1;
+    slab = slot->slab;
+    if (slab == slabs[slab->kind]) {
+	slot->next = slab->free;
+	slab->free = slot;
+    } else {
+	Slot	head = (Slot)atomic_load(&slab->remote);
+
+	do {
+	    slot->next = head;
+	} while (!atomic_compare_exchange_weak(&slab->remote, &head, slot));
+    }
+}
@@ -0,0 +1,29 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#ifndef AGOO_SLAB_H
+#define AGOO_SLAB_H
+
+#include <stddef.h>
+
+// Requests with a body that fits are taken from the request slab.
+#define AGOO_SLAB_REQ_SIZE	2048
+
+typedef enum {
+    AGOO_SLAB_CON	= 0,
+    AGOO_SLAB_LINK,
+    AGOO_SLAB_RES,
+    AGOO_SLAB_PUB,
+    AGOO_SLAB_REQ,
+    AGOO_SLAB_KIND_CNT
+} agooSlabKind;
+
+// Fixed size objects are allocated from a slab owned by the calling
+// thread. Freeing on the owning thread is a push on a local list while a
+// free from any other thread is returned through a lock-free remote list
+// that the owner takes back in one exchange. The slabs of a thread that
+// exits are adopted by the next thread that allocates the same kind. The
+// size must be the same for every allocation of a kind.
+extern void*	agoo_slab_alloc(agooSlabKind kind, size_t size);
+extern void	agoo_slab_free(void *ptr);
+
+#endif // AGOO_SLAB_H
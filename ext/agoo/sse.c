@@ -2,12 +2,16 @@
 
 #include <stdlib.h>
 
+#include "con.h"
+#include "log.h"
 #include "req.h"
+#include "res.h"
 #include "sse.h"
 #include "text.h"
 
 static const char	prefix[] = "event: msg\ndata: ";
 static const char	suffix[] = "\n\n";
+static const char	heartbeat[] = ":\n\n";
 static const char	up[] = "HTTP/1.1 200 OK\r\n\
 Content-Type: text/event-stream\r\n\
 Cache-Control: no-cache\r\n\
@@ -26,3 +30,19 @@ agoo_sse_expand(agooText t) {
     t = agoo_text_prepend(t, prefix, sizeof(prefix) - 1);
     return agoo_text_append(t, suffix, sizeof(suffix) - 1);
 }
+
+// Queues an SSE comment to keep an idle connection and any proxies from
+// timing out. The comment is already framed so it is written as is.
+void
+agoo_sse_heartbeat(agooCon c) {
+    agooRes	res;
+
+    if (NULL == (res = agoo_res_create(c))) {
+	agoo_log_cat(&agoo_error_cat, "Memory allocation of response failed on connection %llu.", (unsigned long long)c->id);
+    } else {
+	res->con_kind = AGOO_CON_SSE;
+	res->framed = true;
+	agoo_res_message_set(res, agoo_text_create(heartbeat, sizeof(heartbeat) - 1));
+	agoo_con_res_append(c, res);
+    }
+}
@@ -3,10 +3,12 @@
 #ifndef AGOO_SSE_H
 #define AGOO_SSE_H
 
+struct _agooCon;
 struct _agooReq;
 struct _agooText;
 
 extern struct _agooText*	agoo_sse_upgrade(struct _agooReq *req, struct _agooText *t);
 extern struct _agooText*	agoo_sse_expand(struct _agooText *t);
+extern void			agoo_sse_heartbeat(struct _agooCon *c);
 
 #endif // AGOO_SSE_H
@@ -52,6 +52,7 @@ agoo_text_create(const char *str, int len) {
 	t->len = len;
 	t->alen = alen;
 	t->bin = false;
+	t->pinned = false;
 	atomic_init(&t->ref_cnt, 0);
 	memcpy(t->text, str, len);
 	t->text[len] = '\0';
@@ -69,6 +70,7 @@ agoo_text_dup(agooText t0) {
 	    t->len = t0->len;
 	    t->alen = t0->alen;
 	    t->bin = false;
+	    t->pinned = false;
 	    atomic_init(&t->ref_cnt, 0);
 	    memcpy(t->text, t0->text, t0->len + 1);
 	}
@@ -86,6 +88,7 @@ agoo_text_allocate(int len) {
 	t->len = 0;
 	t->alen = alen;
 	t->bin = false;
+	t->pinned = false;
 	atomic_init(&t->ref_cnt, 0);
 	*t->text = '\0';
     }
@@ -94,16 +97,44 @@ agoo_text_allocate(int len) {
 
 void
 agoo_text_ref(agooText t) {
-    atomic_fetch_add(&t->ref_cnt, 1);
+    if (!t->pinned) {
+	atomic_fetch_add(&t->ref_cnt, 1);
+    }
 }
 
 void
 agoo_text_release(agooText t) {
-    if (1 >= atomic_fetch_sub(&t->ref_cnt, 1)) {
+    if (!t->pinned && 1 >= atomic_fetch_sub(&t->ref_cnt, 1)) {
 	AGOO_FREE(t);
     }
 }
 
+// Grows the text to hold new_len bytes. A pinned text may be in read-only
+// memory so it is copied instead and the copy carries the reference the
+// caller held on the original.
+static agooText
+text_grow(agooText t, long new_len) {
+    size_t	size = sizeof(struct _agooText) - AGOO_TEXT_MIN_SIZE + new_len + 1;
+    agooText	t2;
+
+    if (!t->pinned) {
+	if (NULL != (t = (agooText)AGOO_REALLOC(t, size))) {
+	    t->alen = new_len;
+	}
+	return t;
+    }
+    if (NULL != (t2 = (agooText)AGOO_MALLOC(size))) {
+	t2->next = NULL;
+	t2->len = t->len;
+	t2->alen = new_len;
+	t2->bin = t->bin;
+	t2->pinned = false;
+	atomic_init(&t2->ref_cnt, 1);
+	memcpy(t2->text, t->text, t->len + 1);
+    }
+    return t2;
+}
+
 agooText
 agoo_text_append(agooText t, const char *s, int len) {
     if (NULL == t) {
@@ -113,13 +144,9 @@ agoo_text_append(agooText t, const char *s, int len) {
 	len = (int)strlen(s);
     }
     if (t->alen <= t->len + len) {
-	long	new_len = t->alen + len + t->alen / 2;
-	size_t	size = sizeof(struct _agooText) - AGOO_TEXT_MIN_SIZE + new_len + 1;
-
-	if (NULL == (t = (agooText)AGOO_REALLOC(t, size))) {
+	if (NULL == (t = text_grow(t, t->alen + len + t->alen / 2))) {
 	    return NULL;
 	}
-	t->alen = new_len;
     }
     memcpy(t->text + t->len, s, len);
     t->len += len;
@@ -134,13 +161,9 @@ agoo_text_append_char(agooText t, const char c) {
 	return NULL;
     }
     if (t->alen <= t->len + 1) {
-	long	new_len = t->alen + 1 + t->alen / 2;
-	size_t	size = sizeof(struct _agooText) - AGOO_TEXT_MIN_SIZE + new_len + 1;
-
-	if (NULL == (t = (agooText)AGOO_REALLOC(t, size))) {
+	if (NULL == (t = text_grow(t, t->alen + 1 + t->alen / 2))) {
 	    return NULL;
 	}
-	t->alen = new_len;
     }
     *(t->text + t->len) = c;
     t->len++;
@@ -158,13 +181,9 @@ agoo_text_prepend(agooText t, const char *s, int len) {
 	len = (int)strlen(s);
     }
     if (t->alen <= t->len + len) {
-	long	new_len = t->alen + len + t->alen / 2;
-	size_t	size = sizeof(struct _agooText) - AGOO_TEXT_MIN_SIZE + new_len + 1;
-
-	if (NULL == (t = (agooText)AGOO_REALLOC(t, size))) {
+	if (NULL == (t = text_grow(t, t->alen + len + t->alen / 2))) {
 	    return NULL;
 	}
-	t->alen = new_len;
     }
     memmove(t->text + len, t->text, t->len + 1);
     memcpy(t->text, s, len);
@@ -185,13 +204,9 @@ agoo_text_append_json(agooText t, const char *s, int len) {
     }
     jlen = json_size(s, len);
     if (t->alen <= (long)(t->len + jlen)) {
-	long	new_len = t->alen + jlen + t->alen / 2;
-	size_t	size = sizeof(struct _agooText) - AGOO_TEXT_MIN_SIZE + new_len + 1;
-
-	if (NULL == (t = (agooText)AGOO_REALLOC(t, size))) {
+	if (NULL == (t = text_grow(t, t->alen + jlen + t->alen / 2))) {
 	    return NULL;
 	}
-	t->alen = new_len;
     }
     if (jlen == (size_t)len) {
 	memcpy(t->text + t->len, s, len);
@@ -15,6 +15,7 @@ typedef struct _agooText {
     long		alen; // size of allocated text
     atomic_int		ref_cnt;
     bool		bin;
+    bool		pinned; // never counted or freed, may be read-only
     char		text[AGOO_TEXT_MIN_SIZE];
 } *agooText;
 
@@ -164,6 +164,11 @@ agoo_upgraded_pending(agooUpgraded up) {
     return (int)(long)atomic_load(&up->pending);
 }
 
+int
+agoo_upgraded_dropped(agooUpgraded up) {
+    return (int)(long)atomic_load(&up->dropped);
+}
+
 agooUpgraded
 agoo_upgraded_create(agooCon c, void * ctx, void *env) {
     agooUpgraded	up = (agooUpgraded)AGOO_CALLOC(1, sizeof(struct _agooUpgraded));
@@ -174,6 +179,7 @@ agoo_upgraded_create(agooCon c, void * ctx, void *env) {
 	up->env = env;
 	atomic_init(&up->pending, 0);
 	atomic_init(&up->ref_cnt, 0);
+	atomic_init(&up->dropped, 0);
 	atomic_store(&up->ref_cnt, 1); // start with 1 for the Con reference
     }
     return up;
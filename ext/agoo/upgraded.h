@@ -18,6 +18,7 @@ typedef struct _agooUpgraded {
     struct _agooCon		*con;
     atomic_int			pending;
     atomic_int			ref_cnt;
+    atomic_int			dropped;
     struct _agooSubject		*subjects;
 
     void			*ctx;
@@ -48,5 +49,6 @@ extern void		agoo_upgraded_subscribe(agooUpgraded up, const char *subject, int s
 extern void		agoo_upgraded_unsubscribe(agooUpgraded up, const char *subject, int slen, bool inc_ref);
 extern void		agoo_upgraded_close(agooUpgraded up, bool inc_ref);
 extern int		agoo_upgraded_pending(agooUpgraded up);
+extern int		agoo_upgraded_dropped(agooUpgraded up);
 
 #endif // AGOO_UPGRADED_H
@@ -14,6 +14,7 @@
 #include "text.h"
 #include "upgraded.h"
 #include "websocket.h"
+#include "wsmask.h"
 
 #define MAX_KEY_LEN	1024
 
@@ -78,11 +79,13 @@ agoo_ws_expand(agooText t) {
     return agoo_text_prepend(t, (const char*)buf, (int)(b - buf));
 }
 
+// Decodes a complete frame in place. The payload is left where it is in the
+// buffer, the offset from the start of the buffer is returned in offp, and
+// the payload length is returned.
 size_t
-agoo_ws_decode(char *buf, size_t mlen) {
+agoo_ws_decode(char *buf, size_t mlen, size_t *offp) {
     uint8_t	*b = (uint8_t*)buf;
     bool	is_masked;
-    uint8_t	*payload;
     uint64_t	plen;
 
     b++; // op
@@ -103,22 +106,13 @@ agoo_ws_decode(char *buf, size_t mlen) {
 	plen = (plen << 8) | *b++;
     }
     if (is_masked) {
-	uint8_t		mask[4];
-	uint64_t	i;
+	uint8_t	*mask = b;
 
-	for (i = 0; i < 4; i++, b++) {
-	    mask[i] = *b;
-	}
-	payload = b;
-	for (i = 0; i < plen; i++, b++) {
-	    *b = *b ^ mask[i % 4];
-	}
-    } else {
-	payload = b;
-	b += plen;
+	b += 4;
+	agoo_ws_unmask(b, plen, mask);
     }
-    memmove(buf, payload, plen);
-    buf[plen] = '\0';
+    *offp = (size_t)(b - (uint8_t*)buf);
+    b[plen] = '\0';
 
     return plen;
 }
@@ -220,6 +214,7 @@ agoo_ws_ping(agooCon c) {
 	res->close = false;
 	res->con_kind = AGOO_CON_WS;
 	res->ping = true;
+	agoo_res_message_set(res, NULL);
 	agoo_con_res_append(c, res);
     }
 }
@@ -234,6 +229,7 @@ agoo_ws_pong(agooCon c) {
 	res->close = false;
 	res->con_kind = AGOO_CON_WS;
 	res->pong = true;
+	agoo_res_message_set(res, NULL);
 	agoo_con_res_append(c, res);
     }
 }
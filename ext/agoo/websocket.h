@@ -15,7 +15,7 @@ struct _agooText;
 
 extern struct _agooText*	agoo_ws_add_headers(struct _agooReq *req, struct _agooText *t);
 extern struct _agooText*	agoo_ws_expand(agooText t);
-extern size_t			agoo_ws_decode(char *buf, size_t mlen);
+extern size_t			agoo_ws_decode(char *buf, size_t mlen, size_t *offp);
 
 extern long			agoo_ws_calc_len(agooCon c, uint8_t *buf, size_t cnt);
 extern bool			agoo_ws_create_req(agooCon c, long mlen);
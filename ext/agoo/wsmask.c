@@ -0,0 +1,92 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "wsmask.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define WS_AVX2	1
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static uint8_t*
+unmask_avx2(uint8_t *b, uint8_t *end, uint64_t m64) {
+    __m256i	vm = _mm256_set1_epi64x((long long)m64);
+
+    for (; 32 <= end - b; b += 32) {
+	__m256i	v = _mm256_loadu_si256((__m256i*)b);
+
+	_mm256_storeu_si256((__m256i*)b, _mm256_xor_si256(v, vm));
+    }
+    return b;
+}
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Unmask a payload in place. Every stride is a multiple of 4 so the mask
+// phase is the same at the start of each stride and only the tail needs the
+// per byte mask index.
+void
+agoo_ws_unmask(uint8_t *b, size_t len, const uint8_t *mask) {
+    uint8_t	*end = b + len;
+    uint32_t	m32;
+    uint64_t	m64;
+    int		i;
+
+    if (8 > len) {
+	// Too short for a word so skip building the wide masks.
+	for (i = 0; b < end; b++, i++) {
+	    *b ^= mask[i & 0x03];
+	}
+	return;
+    }
+    memcpy(&m32, mask, sizeof(m32));
+    m64 = ((uint64_t)m32 << 32) | (uint64_t)m32;
+#ifdef WS_AVX2
+    if (64 <= len) {
+	static int	has_avx2 = -1;
+
+	if (has_avx2 < 0) {
+	    has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+	if (has_avx2) {
+	    b = unmask_avx2(b, end, m64);
+	}
+    }
+#endif
+#if defined(__SSE2__)
+    {
+	__m128i	vm = _mm_set1_epi64x((long long)m64);
+
+	for (; 16 <= end - b; b += 16) {
+	    __m128i	v = _mm_loadu_si128((__m128i*)b);
+
+	    _mm_storeu_si128((__m128i*)b, _mm_xor_si128(v, vm));
+	}
+    }
+#elif defined(__ARM_NEON)
+    {
+	uint8x16_t	vm = vreinterpretq_u8_u64(vdupq_n_u64(m64));
+
+	for (; 16 <= end - b; b += 16) {
+	    vst1q_u8(b, veorq_u8(vld1q_u8(b), vm));
+	}
+    }
+#endif
+    for (; 8 <= end - b; b += 8) {
+	uint64_t	w;
+
+	memcpy(&w, b, sizeof(w));
+	w ^= m64;
+	memcpy(b, &w, sizeof(w));
+    }
+    for (i = 0; b < end; b++, i++) {
+	*b ^= mask[i & 0x03];
+    }
+}
@@ -0,0 +1,13 @@
+// Copyright (c) 2018, Peter Ohler, All rights reserved.
+
+#ifndef AGOO_WSMASK_H
+#define AGOO_WSMASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Kept apart from the rest of the WebSocket code, with no other
+// dependencies, so example/push/unmask_bench.c can build against it.
+extern void	agoo_ws_unmask(uint8_t *b, size_t len, const uint8_t *mask);
+
+#endif // AGOO_WSMASK_H
@@ -0,0 +1,77 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'socket'
+
+require 'agoo'
+
+# In busy poll mode the loops spin for a while after each burst of work and
+# report the time spent spinning and parked.
+class BusyPollTest < Minitest::Test
+  PORT = 6481
+
+  class Hello
+    def call(env)
+      [ 200, { }, [ 'hello' ] ]
+    end
+  end
+
+  @@server_started = false
+
+  def start_server
+    return if @@server_started
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			  push: false,
+			})
+    Agoo::Server.init(PORT, 'root', thread_count: 1, busy_poll: 0.0001)
+    Agoo::Server.handle(:GET, "/hello", Hello.new)
+    Agoo::Server.start()
+    @@server_started = true
+  end
+
+  Minitest.after_run {
+    GC.start
+    Agoo::shutdown
+  }
+
+  def test_stats
+    start_server
+    sock = TCPSocket.new('127.0.0.1', PORT)
+    50.times {
+      sock.write("GET /hello HTTP/1.1\r\nHost: localhost:#{PORT}\r\n\r\n")
+      content = ''
+      content << sock.readpartial(1024) until content.end_with?('hello')
+      assert_match(/^HTTP\/1.1 200 OK/, content)
+    }
+    sock.close
+    stats = nil
+    giveup = Time.now + 3.0
+    while Time.now < giveup
+      stats = Agoo::Server.poll_stats
+      break if 0 < stats[:spin_wakes]
+      sleep(0.2)
+    end
+    assert_equal([:park, :parks, :spin, :spin_wakes], stats.keys.sort)
+    assert(0 < stats[:spin], 'expected time spent spinning')
+    assert(0 < stats[:spin_wakes], 'expected spins that found work')
+    assert(0 < stats[:parks], 'expected parked waits')
+  end
+
+end
@@ -0,0 +1,173 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'net/http'
+require 'json'
+
+require 'agoo'
+
+$calls = []
+
+class Author
+  attr_reader :name
+
+  def initialize(name)
+    @name = name
+  end
+end
+
+class Post
+  attr_reader :id
+
+  def initialize(id)
+    @id = id
+  end
+
+  def author
+    $calls << "author(#{@id})"
+    Author.new("author #{@id}")
+  end
+
+  def self.author_batch(posts, args)
+    $calls << "author_batch(#{posts.map(&:id).join(',')})"
+    posts.map { |p| Author.new("author #{p.id}") }
+  end
+
+  def comments(args)
+    $calls << "comments(#{@id})"
+    (1..args['count']).map { |i| Comment.new(@id * 10 + i) }
+  end
+end
+
+class Comment
+  attr_reader :id
+
+  def initialize(id)
+    @id = id
+  end
+
+  def author
+    $calls << "author(#{@id})"
+    Author.new("commenter #{@id}")
+  end
+
+  def self.author_batch(comments)
+    $calls << "author_batch(#{comments.map(&:id).join(',')})"
+    comments.map { |c| Author.new("commenter #{c.id}") }
+  end
+end
+
+class Query
+  def posts(args={})
+    (1..args['count']).map { |i| Post.new(i) }
+  end
+
+  def post(args={})
+    Post.new(args['id'])
+  end
+end
+
+class Schema
+  attr_reader :query
+
+  def initialize
+    @query = Query.new
+  end
+end
+
+# Fields on the members of a list are resolved with one call to a batch
+# method when the member class has one.
+class GraphQLBatchTest < Minitest::Test
+  PORT = 6486
+  @@server_started = false
+
+  def start_server
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			})
+
+    Agoo::Server.init(PORT, 'root', thread_count: 1, graphql: '/graphql')
+    Agoo::Server.start()
+    Agoo::GraphQL.schema(Schema.new) {
+      Agoo::GraphQL.load(%^
+type Query {
+  posts(count: Int!): [Post]
+  post(id: Int!): Post
+}
+type Post @ruby(class: "Post") {
+  id: Int
+  author: Author
+  comments(count: Int!): [Comment]
+}
+type Comment @ruby(class: "Comment") {
+  id: Int
+  author: Author
+}
+type Author {
+  name: String
+}
+^)
+    }
+    @@server_started = true
+  end
+
+  def setup
+    unless @@server_started
+      start_server
+    end
+    $calls = []
+  end
+
+  Minitest.after_run {
+    GC.start
+    Agoo::shutdown
+  }
+
+  def query(q)
+    path = "/graphql?query=#{URI.encode_www_form_component(q).gsub('+', '%20')}"
+    Net::HTTP.start('localhost', PORT) { |h| h.get(path) }.body
+  end
+
+  def test_list
+    body = query('{posts(count:3){id author{name}}}')
+    assert_equal('{"data":{"posts":[{"id":1,"author":{"name":"author 1"}},{"id":2,"author":{"name":"author 2"}},{"id":3,"author":{"name":"author 3"}}]}}', body)
+    assert_equal(['author_batch(1,2,3)'], $calls)
+  end
+
+  def test_nested
+    body = query('{posts(count:2){comments(count:2){id author{name}}}}')
+    comments = JSON.parse(body)['data']['posts'].map { |p| p['comments'] }
+    assert_equal([[{ 'id' => 11, 'author' => { 'name' => 'commenter 11' } }, { 'id' => 12, 'author' => { 'name' => 'commenter 12' } }],
+		  [{ 'id' => 21, 'author' => { 'name' => 'commenter 21' } }, { 'id' => 22, 'author' => { 'name' => 'commenter 22' } }]], comments)
+    assert_equal(['comments(1)', 'comments(2)', 'author_batch(11,12,21,22)'], $calls)
+  end
+
+  def test_fragment
+    body = query('{posts(count:2){...F}} fragment F on Post {writer:author{name}}')
+    assert_equal('{"data":{"posts":[{"writer":{"name":"author 1"}},{"writer":{"name":"author 2"}}]}}', body)
+    assert_equal(['author_batch(1,2)'], $calls)
+  end
+
+  def test_single
+    body = query('{post(id:7){id author{name}}}')
+    assert_equal('{"data":{"post":{"id":7,"author":{"name":"author 7"}}}}', body)
+    assert_equal(['author(7)'], $calls)
+  end
+
+end
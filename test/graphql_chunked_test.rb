@@ -0,0 +1,120 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'net/http'
+require 'json'
+
+require 'agoo'
+
+class Row
+  attr_reader :id
+  attr_reader :name
+
+  def initialize(id)
+    @id = id
+    @name = "row #{id}"
+  end
+end
+
+class Query
+  def rows(args={})
+    (1..args['count']).map { |i| Row.new(i) }
+  end
+end
+
+class Schema
+  attr_reader :query
+
+  def initialize
+    @query = Query.new
+  end
+end
+
+# Large GraphQL results are sent with chunked transfer encoding as they are
+# written while small ones still have a Content-Length.
+class GraphQLChunkedTest < Minitest::Test
+  PORT = 6485
+  @@server_started = false
+
+  def start_server
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			})
+
+    Agoo::Server.init(PORT, 'root', thread_count: 1, graphql: '/graphql', graphql_chunked: true)
+    Agoo::Server.start()
+    Agoo::GraphQL.schema(Schema.new) {
+      Agoo::GraphQL.load(%^
+type Query {
+  rows(count: Int!): [Row]
+}
+type Row {
+  id: Int
+  name: String
+}
+^)
+    }
+    @@server_started = true
+  end
+
+  def setup
+    unless @@server_started
+      start_server
+    end
+  end
+
+  Minitest.after_run {
+    GC.start
+    Agoo::shutdown
+  }
+
+  def path(count, indent=0)
+    "/graphql?query=#{URI.encode_www_form_component("{rows(count:#{count}){id name}}").gsub('+', '%20')}&indent=#{indent}"
+  end
+
+  def query(count, indent=0)
+    Net::HTTP.start('localhost', PORT) { |h| h.get(path(count, indent)) }
+  end
+
+  def test_small
+    res = query(3)
+    assert_equal('200', res.code)
+    assert_nil(res['Transfer-Encoding'])
+    assert_equal(res.body.size, res['Content-Length'].to_i)
+    assert_equal('{"data":{"rows":[{"id":1,"name":"row 1"},{"id":2,"name":"row 2"},{"id":3,"name":"row 3"}]}}', res.body)
+  end
+
+  def test_large
+    h = Net::HTTP.start('localhost', PORT)
+    res = h.get(path(20_000, 2))
+    assert_equal('200', res.code)
+    assert_equal('chunked', res['Transfer-Encoding'])
+    assert_nil(res['Content-Length'])
+    assert(64 * 1024 < res.body.size)
+    rows = JSON.parse(res.body)['data']['rows']
+    assert_equal(20_000, rows.size)
+    assert_equal({ 'id' => 20_000, 'name' => 'row 20000' }, rows[-1])
+
+    # The connection is still good for another request.
+    assert_equal('{"data":{"rows":[{"id":1,"name":"row 1"}]}}', h.get(path(1)).body)
+  ensure
+    h.finish unless h.nil?
+  end
+
+end
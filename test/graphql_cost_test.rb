@@ -0,0 +1,153 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'net/http'
+require 'json'
+
+require 'agoo'
+
+class Row
+  attr_reader :id
+
+  def initialize(id)
+    @id = id
+  end
+
+  def children(args={})
+    (1..(args['limit'] || 5)).map { |i| Row.new(@id * 10 + i) }
+  end
+end
+
+class Query
+  attr_reader :calls
+
+  def initialize
+    @calls = 0
+  end
+
+  def rows(args={})
+    @calls += 1
+    (1..(args['first'] || 10)).map { |i| Row.new(i) }
+  end
+
+  def all
+    @calls += 1
+    (1..1000).map { |i| Row.new(i) }
+  end
+
+  def slow
+    @calls += 1
+    7
+  end
+end
+
+class Schema
+  attr_reader :query
+
+  def initialize
+    @query = Query.new
+  end
+end
+
+# Queries with an estimated cost over the graphql_max_cost are rejected
+# before any field is resolved.
+class GraphQLCostTest < Minitest::Test
+  PORT = 6489
+  @@server_started = false
+  @@schema = Schema.new
+
+  def start_server
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			})
+
+    Agoo::Server.init(PORT, 'root', thread_count: 1, graphql: '/graphql', graphql_max_cost: 100)
+    Agoo::Server.start()
+    Agoo::GraphQL.schema(@@schema) {
+      Agoo::GraphQL.load(%^
+directive @cost(value: Int, size: Int) on FIELD_DEFINITION
+
+type Query {
+  rows(first: Int): [Row]
+  all: [Row] @cost(size: 1000)
+  slow: Int @cost(value: 50)
+}
+type Row {
+  id: Int
+  children(limit: Int = 5): [Row]
+}
+^)
+    }
+    @@server_started = true
+  end
+
+  def setup
+    unless @@server_started
+      start_server
+    end
+  end
+
+  Minitest.after_run {
+    GC.start
+    Agoo::shutdown
+  }
+
+  def query(q, vars=nil)
+    path = "/graphql?query=#{URI.encode_www_form_component(q).gsub('+', '%20')}"
+    path += "&variables=#{URI.encode_www_form_component(vars).gsub('+', '%20')}" unless vars.nil?
+    Net::HTTP.start('localhost', PORT) { |h| h.get(path) }
+  end
+
+  def assert_rejected(q, vars=nil)
+    calls = @@schema.query.calls
+    res = query(q, vars)
+    assert_equal('400', res.code)
+    assert_equal('Query cost exceeds the maximum of 100.', JSON.parse(res.body)['errors'][0]['message'])
+    assert_equal(calls, @@schema.query.calls, 'nothing should be resolved')
+  end
+
+  def test_under
+    res = query('{rows(first:3){id children{id}}}')
+    assert_equal('200', res.code)
+    rows = JSON.parse(res.body)['data']['rows']
+    assert_equal(3, rows.size)
+    assert_equal(5, rows[0]['children'].size)
+
+    assert_equal('{"data":{"slow":7}}', query('{slow}').body)
+
+    # The default for the limit argument is the size of the children list
+    # so the cost is 64 and not the 109 it would be with a size of 10.
+    assert_equal('200', query('{rows(first:9){id children{id}}}').code)
+  end
+
+  def test_list_size
+    assert_rejected('{all{id}}')
+    assert_rejected('{rows(first:20){id children(limit:10){id}}}')
+  end
+
+  def test_variable
+    assert_equal('200', query('query($n: Int){rows(first:$n){id}}', '{"n":50}').code)
+    assert_rejected('query($n: Int){rows(first:$n){id}}', '{"n":200}')
+  end
+
+  def test_field_cost
+    assert_rejected('{a:slow b:slow c:slow}')
+  end
+
+end
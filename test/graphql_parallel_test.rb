@@ -0,0 +1,134 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'net/http'
+require 'json'
+
+require 'agoo'
+
+class Query
+  def slow(args={})
+    sleep(0.5)
+    "slow #{args['id']}"
+  end
+
+  def thread
+    Thread.current.object_id.to_s
+  end
+
+  def fail
+    raise StandardError.new('failed')
+  end
+end
+
+class Mutation
+  def initialize
+    @log = []
+  end
+
+  def add(args={})
+    sleep(0.1 * (3 - args['n']))
+    @log << args['n']
+    @log.join(',')
+  end
+end
+
+class Schema
+  attr_reader :query
+  attr_reader :mutation
+
+  def initialize
+    @query = Query.new
+    @mutation = Mutation.new
+  end
+end
+
+# With :graphql_parallel the root fields of a query are resolved in
+# separate threads but mutations are still resolved in order.
+class GraphQLParallelTest < Minitest::Test
+  PORT = 6487
+  @@server_started = false
+
+  def start_server
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			})
+
+    Agoo::Server.init(PORT, 'root', thread_count: 1, graphql: '/graphql', graphql_parallel: true)
+    Agoo::Server.start()
+    Agoo::GraphQL.schema(Schema.new) {
+      Agoo::GraphQL.load(%^
+type Query {
+  slow(id: Int): String
+  thread: String
+  fail: String
+}
+type Mutation {
+  add(n: Int!): String
+}
+^)
+    }
+    @@server_started = true
+  end
+
+  def setup
+    unless @@server_started
+      start_server
+    end
+  end
+
+  Minitest.after_run {
+    GC.start
+    Agoo::shutdown
+  }
+
+  def post(q)
+    Net::HTTP.start('localhost', PORT) { |h| h.post('/graphql', q, 'Content-Type' => 'application/graphql') }.body
+  end
+
+  def test_query
+    start = Time.now
+    body = post('{a:slow(id:1) b:slow(id:2) c:slow(id:3) d:slow(id:4)}')
+    dt = Time.now - start
+    assert_equal('{"data":{"a":"slow 1","b":"slow 2","c":"slow 3","d":"slow 4"}}', body)
+    assert(dt < 1.5, "expected the fields to be resolved in parallel but took #{dt} seconds")
+  end
+
+  def test_query_threads
+    result = JSON.parse(post('{a:thread b:thread}'))['data']
+    refute_equal(result['a'], result['b'])
+
+    # Over the limit the fields are resolved sequentially in one thread.
+    q = '{' + (1..9).map { |i| "f#{i}:thread" }.join(' ') + '}'
+    result = JSON.parse(post(q))['data']
+    assert_equal(9, result.size)
+    assert_equal(1, result.values.uniq.size)
+  end
+
+  def test_error
+    result = JSON.parse(post('{slow fail}'))
+    assert_nil(result['data'])
+    assert_equal('StandardError: failed', result['errors'][0]['message'])
+  end
+
+  def test_mutation
+    assert_equal('{"data":{"a":"1","b":"1,2"}}', post('mutation {a:add(n:1) b:add(n:2)}'))
+  end
+
+end
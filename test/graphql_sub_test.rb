@@ -0,0 +1,146 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'net/http'
+require 'socket'
+
+require 'agoo'
+
+class Result
+  @@calls = 0
+
+  attr_reader :previous
+
+  def self.calls
+    @@calls
+  end
+
+  def initialize(word, previous)
+    @word = word
+    @previous = previous
+  end
+
+  def word(args={})
+    @@calls += 1
+    args['upper'] ? @word.upcase : @word
+  end
+end
+
+class Query
+  def hello
+    'Hello'
+  end
+end
+
+class Subscription
+  def watch(args={})
+    'watch.me'
+  end
+end
+
+class Schema
+  attr_reader :query
+  attr_reader :subscription
+
+  def initialize
+    @query = Query.new
+    @subscription = Subscription.new
+  end
+end
+
+# Subscriptions with the same query and variables are evaluated once for
+# each published event and all of them get the result.
+class GraphQLSubTest < Minitest::Test
+  PORT = 6488
+  @@server_started = false
+
+  def start_server
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			})
+
+    Agoo::Server.init(PORT, 'root', thread_count: 1, graphql: '/graphql')
+    Agoo::Server.start()
+    Agoo::GraphQL.schema(Schema.new) {
+      Agoo::GraphQL.load(%^
+type Query {
+  hello: String
+}
+type Subscription {
+  watch: Result
+}
+type Result @ruby(class: "Result") {
+  word(upper: Boolean): String
+  previous: String
+}
+^)
+    }
+    @@server_started = true
+  end
+
+  def setup
+    unless @@server_started
+      start_server
+    end
+  end
+
+  Minitest.after_run {
+    GC.start
+    Agoo::shutdown
+  }
+
+  def subscribe(query, vars=nil)
+    path = "/graphql?subscription=#{URI.encode_www_form_component(query).gsub('+', '%20')}"
+    path += "&variables=#{URI.encode_www_form_component(vars).gsub('+', '%20')}" unless vars.nil?
+    sock = TCPSocket.new('127.0.0.1', PORT)
+    sock.write("GET #{path} HTTP/1.1\r\nHost: localhost:#{PORT}\r\nAccept: text/event-stream\r\n\r\n")
+    assert_match(/^HTTP\/1.1 200/, read_until(sock, "\r\n\r\n"))
+    sock
+  end
+
+  def read_until(sock, mark)
+    content = ''
+    giveup = Time.now + 2.0
+    while Time.now < giveup && !content.include?(mark)
+      next if IO.select([sock], nil, nil, 0.1).nil?
+      content << sock.read_nonblock(1024)
+    end
+    content
+  end
+
+  def test_shared
+    plain = 3.times.map { subscribe('subscription{watch{word previous}}') }
+    upper = subscribe('subscription($u: Boolean){watch{word(upper: $u) previous}}', '{"u":true}')
+    # Give the subscriptions time to be registered.
+    sleep(0.2)
+    calls = Result.calls
+    Agoo::GraphQL.publish('watch.me', Result.new('word', 'hello'))
+
+    plain.each { |sock|
+      assert_equal(%|event: msg\ndata: {"word":"word","previous":"hello"}\n\n|, read_until(sock, "\n\n"))
+    }
+    assert_equal(%|event: msg\ndata: {"word":"WORD","previous":"hello"}\n\n|, read_until(upper, "\n\n"))
+    # Once for the plain group and once for the upper case one.
+    assert_equal(calls + 2, Result.calls)
+  ensure
+    plain.each { |sock| sock.close } unless plain.nil?
+    upper.close unless upper.nil?
+  end
+
+end
@@ -6,6 +6,7 @@ $root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
   $: << File.join($root_dir, dir)
 end
 
+require 'digest'
 require 'minitest'
 require 'minitest/autorun'
 require 'net/http'
@@ -502,6 +503,35 @@ fragment loop on Artist {
     post_test(uri, body, 'application/graphql', expect, 'errors.0.timestamp')
   end
 
+  def test_post_fragment_duplicate
+    uri = URI('http://localhost:6472/graphql?indent=2')
+    body = %^
+{
+  artist(name:"Fazerdaze") {
+    ...basic
+  }
+}
+
+fragment basic on Artist {
+  name
+}
+
+fragment basic on Artist {
+  origin
+}
+^
+    expect = %^{
+  "errors":[
+    {
+      "message":"Multiple fragments named 'basic'.",
+      "code":"eval error"
+    }
+  ]
+}
+^
+    post_test(uri, body, 'application/graphql', expect, 'errors.0.timestamp')
+  end
+
   def test_post_json_fragment
     uri = URI('http://localhost:6472/graphql?indent=2')
     body = %^{
@@ -972,6 +1002,25 @@ query skippy($boo: Boolean = true){
     req_test(uri, expect)
   end
 
+  def test_intro_cached
+    uri = URI('http://localhost:6472/graphql?indent=2')
+    query = 'query intro($n: String!){__type(name:$n){name} artist(name:"Fazerdaze"){name}}'
+    %w(Artist Song Artist).each { |name|
+      body = Oj.dump({ 'query' => query, 'variables' => { 'n' => name } }, mode: :strict)
+      expect = %^{
+  "data":{
+    "__type":{
+      "name":"#{name}"
+    },
+    "artist":{
+      "name":"Fazerdaze"
+    }
+  }
+}^
+      post_test(uri, body, 'application/json', expect)
+    }
+  end
+
   def test_intro_schema_directives
     uri = URI('http://localhost:6472/graphql?query={__schema{directives{name,locations,args{name}}}}&indent=2')
     expect = %^{
@@ -1057,7 +1106,84 @@ mutation {
     post_test(uri, body, 'application/graphql', expect)
   end
 
+  def test_cached_variables
+    uri = URI('http://localhost:6472/graphql?indent=2')
+    query = 'query byGenre($genre: Genre) { artist(name: "Fazerdaze") { genre_songs(genre: $genre) { name } } }'
+    indie = %^{
+  "data":{
+    "artist":{
+      "genre_songs":[
+        {
+          "name":"Jennifer"
+        },
+        {
+          "name":"Lucky Girl"
+        },
+        {
+          "name":"Friends"
+        },
+        {
+          "name":"Reel"
+        }
+      ]
+    }
+  }
+}^
+    pop = %^{
+  "data":{
+    "artist":{
+      "genre_songs":[
+      ]
+    }
+  }
+}^
+    2.times {
+      post_test(uri, Oj.dump({ 'query' => query, 'variables' => { 'genre' => 'INDIE' } }, mode: :strict), 'application/json', indie)
+      post_test(uri, Oj.dump({ 'query' => query, 'variables' => { 'genre' => 'POP' } }, mode: :strict), 'application/json', pop)
+    }
+  end
+
+  def test_persisted_query
+    uri = URI('http://localhost:6472/graphql?indent=2')
+    query = '{ artist(name: "Fazerdaze") { origin } }'
+    ext = { 'persistedQuery' => { 'version' => 1, 'sha256Hash' => Digest::SHA256.hexdigest(query) } }
+    expect = %^{
+  "data":{
+    "artist":{
+      "origin":[
+        "Morningside",
+        "Auckland",
+        "New Zealand"
+      ]
+    }
+  }
+}^
+    not_found = %^{
+  "errors":[
+    {
+      "message":"PersistedQueryNotFound",
+      "code":"eval error"
+    }
+  ]
+}
+^
+    post_test(uri, Oj.dump({ 'extensions' => ext }, mode: :strict), 'application/json', not_found, 'errors.0.timestamp')
+    post_test(uri, Oj.dump({ 'query' => query, 'extensions' => ext }, mode: :strict), 'application/json', expect)
+    post_test(uri, Oj.dump({ 'extensions' => ext }, mode: :strict), 'application/json', expect)
 
+    req_test(URI("http://localhost:6472/graphql?indent=2&extensions=#{URI.encode_www_form_component(Oj.dump(ext, mode: :strict))}"), expect)
+
+    bad = { 'persistedQuery' => { 'version' => 1, 'sha256Hash' => Digest::SHA256.hexdigest('{}') } }
+    post_test(uri, Oj.dump({ 'query' => query, 'extensions' => bad }, mode: :strict), 'application/json', %^{
+  "errors":[
+    {
+      "message":"provided sha does not match query",
+      "code":"eval error"
+    }
+  ]
+}
+^, 'errors.0.timestamp')
+  end
 
   ##################################
 
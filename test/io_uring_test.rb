@@ -0,0 +1,87 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'net/http'
+require 'socket'
+
+require 'agoo'
+
+# The same requests are served whether the connection loops wait on io_uring
+# or fall back to epoll when io_uring is not available.
+class IoUringTest < Minitest::Test
+  PORT = 6479
+
+  class Echo
+    def call(env)
+      size = env['QUERY_STRING'].to_i
+      [ 200, { }, [ 'x' * size ] ]
+    end
+  end
+
+  @@server_started = false
+
+  def start_server
+    return if @@server_started
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			})
+
+    Agoo::Server.init(PORT, 'root', thread_count: 1, io_uring: true)
+    Agoo::Server.handle(:GET, "/echo", Echo.new)
+    Agoo::Server.start()
+    @@server_started = true
+  end
+
+  Minitest.after_run {
+    GC.start
+    Agoo::shutdown
+  }
+
+  def test_keep_alive
+    start_server
+    Net::HTTP.start('127.0.0.1', PORT) { |h|
+      10.times { |i|
+	res = h.get("/echo?#{i}")
+	assert_equal('200', res.code)
+	assert_equal('x' * i, res.body)
+      }
+    }
+  end
+
+  # A large body needs several writes so the connection is polled for output.
+  def test_large_body
+    start_server
+    size = 4_000_000
+    res = Net::HTTP.get_response(URI("http://127.0.0.1:#{PORT}/echo?#{size}"))
+    assert_equal(size, res.body.size)
+  end
+
+  def test_many_connections
+    start_server
+    socks = 50.times.map { TCPSocket.new('127.0.0.1', PORT) }
+    socks.each { |s| s.write("GET /echo?3 HTTP/1.1\r\nHost: localhost\r\n\r\n") }
+    socks.each { |s|
+      content = ''
+      content << s.readpartial(1024) until content.end_with?('xxx')
+      assert_match(/^HTTP\/1.1 200 OK/, content)
+      s.close
+    }
+  end
+
+end
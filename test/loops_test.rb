@@ -0,0 +1,87 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'socket'
+
+require 'agoo'
+
+# Connection loops are added as connections pile up even when there are
+# several eval threads. The loops and eval threads are pinned to the first
+# CPU.
+class LoopsTest < Minitest::Test
+  PORT = 6480
+
+  class Hello
+    def call(env)
+      [ 200, { }, [ 'hello' ] ]
+    end
+  end
+
+  @@server_started = false
+
+  def start_server
+    return if @@server_started
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			  push: false,
+			})
+    Agoo::Server.init(PORT, 'root', thread_count: 2, max_io_loops: 3, io_cpus: [0], eval_cpus: '0')
+    Agoo::Server.handle(:GET, "/hello", Hello.new)
+    Agoo::Server.start()
+    @@server_started = true
+  end
+
+  Minitest.after_run {
+    GC.start
+    Agoo::shutdown
+  }
+
+  def thread_count
+    Dir.glob('/proc/self/task/*').size
+  end
+
+  def get(sock)
+    sock.write("GET /hello HTTP/1.1\r\nHost: localhost:#{PORT}\r\n\r\n")
+    content = ''
+    content << sock.readpartial(1024) until content.end_with?('hello')
+    content
+  end
+
+  def test_pinned
+    skip('no /proc to check CPUs') unless File.directory?('/proc/self/task')
+    start_server
+    cpus = Dir.glob('/proc/self/task/*').map { |t| File.read("#{t}/status")[/Cpus_allowed_list:\s*(\S+)/, 1] }
+    assert(3 <= cpus.count('0'), 'expected a loop and two eval threads pinned to CPU 0')
+  end
+
+  def test_grow
+    skip('no /proc to count threads') unless File.directory?('/proc/self/task')
+    start_server
+    before = thread_count
+    socks = 250.times.map { TCPSocket.new('127.0.0.1', PORT) }
+    socks.each { |sock| assert_match(/^HTTP\/1.1 200 OK/, get(sock)) }
+    giveup = Time.now + 5.0
+    sleep(0.2) while thread_count <= before && Time.now < giveup
+    assert(before < thread_count, 'expected another connection loop')
+    # Every connection is still served whichever loop it ended up on.
+    socks.each { |sock| assert_match(/^HTTP\/1.1 200 OK/, get(sock)) }
+    socks.each { |sock| sock.close }
+  end
+
+end
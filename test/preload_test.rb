@@ -0,0 +1,127 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'net/http'
+require 'socket'
+require 'fileutils'
+require 'tmpdir'
+
+require 'agoo'
+
+# Static files are read into the page cache when the server starts and
+# files that change afterwards are reread.
+class PreloadTest < Minitest::Test
+  PORT = 6484
+  @@server_started = false
+  @@dir = File.join(Dir.tmpdir, "agoo_preload_#{Process.pid}")
+
+  def start_server
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			})
+
+    Dir.mkdir(@@dir) unless Dir.exist?(@@dir)
+    File.write(File.join(@@dir, 'change.txt'), 'before')
+    Agoo::Server.init(PORT, 'root', thread_count: 1, preload: true)
+    Agoo::Server.path_group('/group', [@@dir])
+    Agoo::Server.start()
+
+    @@server_started = true
+  end
+
+  def setup
+    unless @@server_started
+      start_server
+    end
+  end
+
+  Minitest.after_run {
+    FileUtils.rm_rf(@@dir)
+    GC.start
+    Agoo::shutdown
+  }
+
+  def fetch(path)
+    Net::HTTP.get_response(URI("http://localhost:#{PORT}#{path}"))
+  end
+
+  def test_root
+    res = fetch('/index.html')
+    assert_equal('200', res.code)
+    assert_equal('text/html', res['Content-Type'])
+    assert_equal(File.read(File.join(File.dirname(__FILE__), 'root/index.html')), res.body)
+
+    res = fetch('/nest/something.txt')
+    assert_equal('200', res.code)
+    assert_equal(File.read(File.join(File.dirname(__FILE__), 'root/nest/something.txt')), res.body)
+
+    assert_equal('404', fetch('/not-there.html').code)
+  end
+
+  def read_responses(sock, cnt)
+    bodies = []
+    buf = ''
+    giveup = Time.now + 2.0
+    while bodies.size < cnt && Time.now < giveup
+      if (hend = buf.index("\r\n\r\n"))
+        len = buf[0...hend][/Content-Length: (\d+)/i, 1].to_i
+        if hend + 4 + len <= buf.size
+          assert_match(/^HTTP\/1.1 200/, buf)
+          bodies << buf[hend + 4, len]
+          buf = buf[(hend + 4 + len)..-1]
+          next
+        end
+      end
+      next if IO.select([sock], nil, nil, 0.1).nil?
+      buf << sock.read_nonblock(65536)
+    end
+    bodies
+  end
+
+  # Preloaded pages are shared and read-only so responses that queue them
+  # must not change them.
+  def test_pipelined
+    index = File.read(File.join(File.dirname(__FILE__), 'root/index.html'))
+    something = File.read(File.join(File.dirname(__FILE__), 'root/nest/something.txt'))
+    req = "GET %s HTTP/1.1\r\nHost: localhost:#{PORT}\r\n\r\n"
+    sock = TCPSocket.new('127.0.0.1', PORT)
+
+    sock.write([req % '/index.html', req % '/nest/something.txt', req % '/index.html'].join)
+    assert_equal([index, something, index], read_responses(sock, 3))
+
+    # The same connection is kept alive for more requests.
+    3.times {
+      sock.write(req % '/nest/something.txt')
+      assert_equal([something], read_responses(sock, 1))
+    }
+  ensure
+    sock.close unless sock.nil?
+  end
+
+  def test_changed
+    path = File.join(@@dir, 'change.txt')
+    assert_equal('before', fetch('/group/change.txt').body)
+
+    File.write(path, 'after')
+    File.utime(Time.now + 10, Time.now + 10, path)
+    sleep(5.5) # page recheck interval
+    assert_equal('after', fetch('/group/change.txt').body)
+  end
+
+end
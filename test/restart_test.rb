@@ -0,0 +1,108 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'net/http'
+require 'rbconfig'
+require 'socket'
+require 'tmpdir'
+
+# A restart hands the listening socket to a new process which serves new
+# connections while the old process drains its own and exits.
+class RestartTest < Minitest::Test
+  PORT = 6482
+
+  SERVER = %|
+require 'agoo'
+
+class Pid
+  def call(env)
+    [ 200, { }, [ Process.pid.to_s ] ]
+  end
+end
+
+Agoo::Log.configure(dir: '', console: true, classic: true, colorize: false,
+                    states: { INFO: false, DEBUG: false, connect: false, request: false, response: false, eval: true })
+Agoo::Server.init(#{PORT}, 'root', thread_count: 1, drain_timeout: 3.0, restart_timeout: 20.0)
+Agoo::Server.handle(:GET, '/pid', Pid.new)
+Agoo::Server.start()
+sleep
+|
+
+  def fetch_pid
+    Net::HTTP.start('127.0.0.1', PORT) { |h| h.get('/pid').body.to_i }
+  end
+
+  def read_pid(sock)
+    sock.write("GET /pid HTTP/1.1\r\nHost: localhost:#{PORT}\r\n\r\n")
+    content = ''
+    giveup = Time.now + 2.0
+    while Time.now < giveup && content !~ /\r\n\r\n\d+$/
+      next if IO.select([sock], nil, nil, 0.1).nil?
+      content << sock.read_nonblock(1024)
+    end
+    content[/\d+$/].to_i
+  end
+
+  def wait_exit(pid, limit)
+    giveup = Time.now + limit
+    while Time.now < giveup
+      _, status = Process.wait2(pid, Process::WNOHANG)
+      return status unless status.nil?
+      sleep(0.1)
+    end
+    nil
+  end
+
+  def test_restart
+    script = File.join(Dir.tmpdir, "agoo_restart_#{Process.pid}.rb")
+    File.write(script, SERVER)
+    old_pid = spawn(RbConfig.ruby, '-I', File.join($root_dir, 'lib'), '-I', File.join($root_dir, 'ext'), script, out: File::NULL, err: File::NULL)
+    new_pid = nil
+    giveup = Time.now + 10.0
+    begin
+      assert_equal(old_pid, fetch_pid)
+    rescue Errno::ECONNREFUSED
+      raise if giveup < Time.now
+      sleep(0.1)
+      retry
+    end
+    keep = TCPSocket.new('127.0.0.1', PORT)
+    assert_equal(old_pid, read_pid(keep))
+
+    Process.kill('USR2', old_pid)
+    failures = 0
+    giveup = Time.now + 20.0
+    while new_pid.nil? && Time.now < giveup
+      begin
+        pid = fetch_pid
+        new_pid = pid unless old_pid == pid
+      rescue SystemCallError, EOFError
+        failures += 1
+      end
+    end
+    refute_nil(new_pid, 'expected a new process to take over')
+    assert_equal(0, failures, 'no request should fail during the restart')
+    # New connections keep going to the new process.
+    10.times { assert_equal(new_pid, fetch_pid) }
+
+    # The idle keep-alive connection to the old process is closed and the
+    # old process exits once drained.
+    assert(IO.select([keep], nil, nil, 3.0), 'expected the old connection to be closed')
+    assert_raises(EOFError, Errno::ECONNRESET) { keep.read_nonblock(1024) }
+    keep.close
+    status = wait_exit(old_pid, 5.0)
+    refute_nil(status, 'expected the old process to exit')
+    assert(status.success?)
+  ensure
+    Process.kill('TERM', new_pid) unless new_pid.nil?
+    File.delete(script) if File.exist?(script)
+  end
+
+end
@@ -29,3 +29,42 @@ echo "----- graphql_error_test.rb ----------------------------------------------
 
 echo "----- early_hints_test.rb ----------------------------------------------------------"
 ./early_hints_test.rb
+
+echo "----- websocket_test.rb --------------------------------------------------------"
+./websocket_test.rb
+
+echo "----- workers_test.rb ----------------------------------------------------------"
+./workers_test.rb
+
+echo "----- timeout_test.rb ----------------------------------------------------------"
+./timeout_test.rb
+
+echo "----- io_uring_test.rb ---------------------------------------------------------"
+./io_uring_test.rb
+
+echo "----- loops_test.rb ------------------------------------------------------------"
+./loops_test.rb
+
+echo "----- busy_poll_test.rb --------------------------------------------------------"
+./busy_poll_test.rb
+
+echo "----- restart_test.rb ----------------------------------------------------------"
+./restart_test.rb
+
+echo "----- preload_test.rb ----------------------------------------------------------"
+./preload_test.rb
+
+echo "----- graphql_chunked_test.rb --------------------------------------------------"
+./graphql_chunked_test.rb
+
+echo "----- graphql_batch_test.rb ----------------------------------------------------"
+./graphql_batch_test.rb
+
+echo "----- graphql_parallel_test.rb -------------------------------------------------"
+./graphql_parallel_test.rb
+
+echo "----- graphql_sub_test.rb ------------------------------------------------------"
+./graphql_sub_test.rb
+
+echo "----- graphql_cost_test.rb -----------------------------------------------------"
+./graphql_cost_test.rb
@@ -0,0 +1,108 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'socket'
+
+require 'agoo'
+
+# Idle connections are closed, pinged, or sent a heartbeat as their deadlines
+# expire in the timer wheel.
+class TimeoutTest < Minitest::Test
+  PORT = 6478
+
+  class Quiet
+  end
+
+  class Listen
+    def call(env)
+      env['rack.upgrade'] = Quiet.new unless env['rack.upgrade?'].nil?
+      [ 200, { }, [ 'ok' ] ]
+    end
+  end
+
+  @@server_started = false
+
+  def start_server
+    return if @@server_started
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			  push: false,
+			})
+
+    Agoo::Server.init(PORT, 'root', thread_count: 1, connection_timeout: 0.5)
+    Agoo::Server.handle(:GET, "/listen", Listen.new)
+    Agoo::Server.start()
+    @@server_started = true
+  end
+
+  Minitest.after_run {
+    GC.start
+    Agoo::shutdown
+  }
+
+  def read_until(sock, pattern, limit)
+    content = ''
+    giveup = Time.now + limit
+    while Time.now < giveup && content !~ pattern
+      next if IO.select([sock], nil, nil, 0.1).nil?
+      begin
+        content << sock.read_nonblock(1024)
+      rescue IO::WaitReadable
+      rescue EOFError
+        break
+      end
+    end
+    content
+  end
+
+  def test_http_idle_close
+    start_server
+    sock = TCPSocket.new('127.0.0.1', PORT)
+    sock.write("GET /listen HTTP/1.1\r\nHost: localhost:#{PORT}\r\n\r\n")
+    assert_match(/^HTTP\/1.1 200 OK/, read_until(sock, /ok$/, 2.0))
+    start = Time.now
+    read_until(sock, /never/, 3.0)
+    assert(Time.now - start < 2.5, 'expected the idle connection to be closed')
+    sock.close
+  end
+
+  def test_ws_ping
+    start_server
+    sock = TCPSocket.new('127.0.0.1', PORT)
+    sock.write(%|GET /listen HTTP/1.1\r
+Host: localhost:#{PORT}\r
+Upgrade: websocket\r
+Connection: Upgrade\r
+Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r
+Sec-WebSocket-Version: 13\r
+\r
+|)
+    assert(read_until(sock, /\x89\x00/n, 3.0).b.end_with?("\x89\x00".b))
+    sock.close
+  end
+
+  def test_sse_heartbeat
+    start_server
+    sock = TCPSocket.new('127.0.0.1', PORT)
+    sock.write("GET /listen HTTP/1.1\r\nHost: localhost:#{PORT}\r\nAccept: text/event-stream\r\n\r\n")
+    assert(read_until(sock, /^:\n\n/, 3.0).end_with?(":\n\n"))
+    sock.close
+  end
+
+end
@@ -0,0 +1,209 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'minitest'
+require 'minitest/autorun'
+require 'socket'
+
+require 'agoo'
+
+class WebSocketTest < Minitest::Test
+  PORT = 6476
+
+  class Echo
+    def on_message(client, data)
+      if data.start_with?('flood:')
+        size = data[6..-1].to_i
+        200.times { |i|
+          msg = "#{i}:" + 'x' * size
+          sleep(0.001) until client.write(msg)
+        }
+      elsif 'dropped' == data
+        client.write("dropped:#{client.dropped}")
+      elsif data.start_with?('burst:')
+        size = data[6..-1].to_i
+        20.times { |i| client.write("#{i}:" + 'x' * size) }
+      elsif data.start_with?('t:')
+        client.write("echo #{data[2..-1]}")
+      else
+        client.write("#{data.bytesize}:#{data.sum}")
+      end
+    end
+  end
+
+  class Ticker
+    def on_open(client)
+      3.times { |i| client.write("tick #{i}") }
+    end
+  end
+
+  class Listen
+    def initialize(handler)
+      @handler = handler
+    end
+
+    def call(env)
+      unless env['rack.upgrade?'].nil?
+        env['rack.upgrade'] = @handler.new
+        [ 200, { }, [ ] ]
+      else
+        [ 404, { }, [ ] ]
+      end
+    end
+  end
+
+  @@server_started = false
+
+  def start_server
+    return if @@server_started
+    Agoo::Log.configure(dir: '',
+			console: true,
+			classic: true,
+			colorize: true,
+			states: {
+			  INFO: false,
+			  DEBUG: false,
+			  connect: false,
+			  request: false,
+			  response: false,
+			  eval: true,
+			  push: false,
+			})
+
+    Agoo::Server.init(PORT, 'root', thread_count: 1, max_push_bytes: 4_000_000, push_policy: :drop_newest)
+    Agoo::Server.handle(:GET, "/upgrade", Listen.new(Echo))
+    Agoo::Server.handle(:GET, "/sse", Listen.new(Ticker))
+    Agoo::Server.start()
+    @@server_started = true
+  end
+
+  Minitest.after_run {
+    GC.start
+    Agoo::shutdown
+  }
+
+  def connect
+    sock = TCPSocket.new('127.0.0.1', PORT)
+    sock.write(%|GET /upgrade HTTP/1.1\r
+Host: localhost:#{PORT}\r
+Upgrade: websocket\r
+Connection: Upgrade\r
+Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r
+Sec-WebSocket-Version: 13\r
+\r
+|)
+    header = ''
+    header << sock.readpartial(1) until header.end_with?("\r\n\r\n")
+    assert_match(/^HTTP\/1.1 101/, header)
+    assert_match(/Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK\+xOo=/, header)
+    sock
+  end
+
+  def send_frame(sock, data, op)
+    mask = Array.new(4) { rand(256) }
+    frame = [0x80 | op].pack('C')
+    len = data.bytesize
+    if len < 126
+      frame << [0x80 | len].pack('C')
+    elsif len < 0x10000
+      frame << [0x80 | 126, len].pack('Cn')
+    else
+      frame << [0x80 | 127, len].pack('CQ>')
+    end
+    frame << mask.pack('C4')
+    bytes = data.bytes
+    bytes.each_index { |i| bytes[i] ^= mask[i % 4] }
+    frame << bytes.pack('C*')
+    sock.write(frame)
+  end
+
+  def read_frame(sock)
+    op, len = sock.read(2).unpack('CC')
+    if 126 == len
+      len = sock.read(2).unpack1('n')
+    elsif 127 == len
+      len = sock.read(8).unpack1('Q>')
+    end
+    [op & 0x0F, sock.read(len)]
+  end
+
+  def test_text
+    start_server
+    sock = connect
+    send_frame(sock, 't:hello', 0x01)
+    assert_equal([0x01, 'echo hello'], read_frame(sock))
+    sock.close
+  end
+
+  # Sizes cover the byte, word, and vector strides of the unmasking as well as
+  # frames larger than the connection read buffer.
+  def test_binary_sizes
+    start_server
+    sock = connect
+    [1, 3, 7, 8, 15, 16, 31, 33, 64, 125, 126, 1000, 8191, 8192, 70000].each { |size|
+      data = Array.new(size) { |i| (i * 7) & 0xFF }.pack('C*')
+      send_frame(sock, data, 0x02)
+      assert_equal([0x01, "#{size}:#{data.sum}"], read_frame(sock), "size #{size}")
+    }
+    sock.close
+  end
+
+  def test_pipelined
+    start_server
+    sock = connect
+    3.times { |i| send_frame(sock, "t:msg #{i}", 0x01) }
+    3.times { |i| assert_equal([0x01, "echo msg #{i}"], read_frame(sock)) }
+    sock.close
+  end
+
+  # A burst of writes is coalesced into fewer sends. Large messages exceed the
+  # write budget and are likely to be partially written.
+  def test_burst
+    start_server
+    sock = connect
+    [10, 100_000].each { |size|
+      send_frame(sock, "burst:#{size}", 0x01)
+      20.times { |i| assert_equal([0x01, "#{i}:" + 'x' * size], read_frame(sock)) }
+    }
+    sock.close
+  end
+
+  # A client that does not read lets the push queue reach the byte
+  # limit. Every message is either delivered in order or counted as dropped.
+  def test_slow_consumer
+    start_server
+    sock = connect
+    send_frame(sock, 'flood:100000', 0x01)
+    sleep(1.0)
+    indexes = []
+    while IO.select([sock], nil, nil, 1.0)
+      op, data = read_frame(sock)
+      indexes << data.to_i
+    end
+    assert_equal(indexes.sort, indexes)
+    send_frame(sock, 'dropped', 0x01)
+    op, data = read_frame(sock)
+    dropped = data[8..-1].to_i
+    assert(0 < dropped, 'expected some messages to be dropped')
+    assert_equal(200, indexes.size + dropped)
+    assert(0 < Agoo::Server.push_dropped)
+    sock.close
+  end
+
+  def test_sse
+    start_server
+    sock = TCPSocket.new('127.0.0.1', PORT)
+    sock.write("GET /sse HTTP/1.1\r\nHost: localhost:#{PORT}\r\nAccept: text/event-stream\r\n\r\n")
+    expect = 3.times.map { |i| "event: msg\ndata: tick #{i}\n\n" }.join
+    content = ''
+    content << sock.readpartial(1024) until content.end_with?(expect)
+    assert_match(/^HTTP\/1.1 200 OK/, content)
+    sock.close
+  end
+
+end
@@ -0,0 +1,165 @@
+#!/usr/bin/env ruby
+
+$: << File.dirname(__FILE__)
+$root_dir = File.dirname(File.expand_path(File.dirname(__FILE__)))
+%w(lib ext).each do |dir|
+  $: << File.join($root_dir, dir)
+end
+
+require 'socket'
+
+require 'agoo'
+
+PORT = 6477
+
+class Sub
+  def on_open(client)
+    client.subscribe('bus')
+    client.write("ready #{Process.pid}")
+  end
+end
+
+class Listen
+  def call(env)
+    unless env['rack.upgrade?'].nil?
+      env['rack.upgrade'] = Sub.new
+      [ 200, { }, [ ] ]
+    else
+      [ 404, { }, [ ] ]
+    end
+  end
+end
+
+class Publish
+  def call(env)
+    msg = env['QUERY_STRING']
+    msg = msg.start_with?('bin') ? msg.b : msg.dup.force_encoding('UTF-8')
+    # Larger than the socket buffers so the bus writes it in pieces.
+    msg = msg + 'x' * 300_000 if msg.start_with?('big')
+    Agoo.publish('bus', msg)
+    [ 200, { }, [ Process.pid.to_s ] ]
+  end
+end
+
+# The server with two workers runs in a separate process since forking the
+# test process would run the tests in every worker. The server and workers
+# share a process group so they can all be killed together.
+$server_pid = fork {
+  Process.setpgrp
+  Agoo::Log.configure(dir: '',
+		      console: true,
+		      classic: true,
+		      colorize: true,
+		      states: {
+			INFO: false,
+			DEBUG: false,
+			connect: false,
+			request: false,
+			response: false,
+			eval: true,
+			push: false,
+		      })
+  Agoo::Server.init(PORT, 'root', thread_count: 0, worker_count: 2)
+  Agoo::Server.handle(:GET, "/upgrade", Listen.new)
+  Agoo::Server.handle(:GET, "/publish", Publish.new)
+  Agoo::Server.start()
+}
+
+require 'minitest'
+require 'minitest/autorun'
+
+class WorkersTest < Minitest::Test
+
+  Minitest.after_run {
+    Process.kill('KILL', -$server_pid)
+    Process.wait($server_pid)
+  }
+
+  def connect
+    sock = nil
+    20.times {
+      begin
+        sock = TCPSocket.new('127.0.0.1', PORT)
+        break
+      rescue Errno::ECONNREFUSED
+        sleep(0.1)
+      end
+    }
+    sock.write(%|GET /upgrade HTTP/1.1\r
+Host: localhost:#{PORT}\r
+Upgrade: websocket\r
+Connection: Upgrade\r
+Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r
+Sec-WebSocket-Version: 13\r
+\r
+|)
+    header = ''
+    header << sock.readpartial(1) until header.end_with?("\r\n\r\n")
+    assert_match(/^HTTP\/1.1 101/, header)
+    sock
+  end
+
+  def read_frame(sock)
+    read_op_frame(sock)[1]
+  end
+
+  def read_op_frame(sock)
+    op, len = sock.read(2).unpack('CC')
+    if 126 == len
+      len = sock.read(2).unpack1('n')
+    elsif 127 == len
+      len = sock.read(8).unpack1('Q>')
+    end
+    [op, sock.read(len)]
+  end
+
+  def publish(msg)
+    Net::HTTP.get(URI("http://127.0.0.1:#{PORT}/publish?#{msg}"))
+  end
+
+  # Clients are connected until both workers have at least one so every
+  # publish has to cross to the other process for some clients.
+  def connect_both
+    require 'net/http'
+    clients = {}
+    40.times {
+      sock = connect
+      pid = read_frame(sock).split(' ')[1].to_i
+      (clients[pid] ||= []) << sock
+      break if 2 <= clients.size
+    }
+    assert_equal(2, clients.size, 'expected connections on both workers')
+    clients
+  end
+
+  def test_publish_across_workers
+    clients = connect_both
+
+    publishers = 6.times.map { |i| publish("msg#{i}").to_i }
+    clients.each_value { |socks|
+      socks.each { |sock|
+        assert_equal(6.times.map { |i| "msg#{i}" }, 6.times.map { read_frame(sock) }.sort)
+      }
+    }
+    assert((publishers - clients.keys).empty?)
+    clients.each_value { |socks| socks.each { |sock| sock.close } }
+  end
+
+  # A binary message stays binary after crossing the bus and a large one
+  # arrives whole.
+  def test_binary_across_workers
+    clients = connect_both
+
+    publish('bin1')
+    publish('txt2')
+    publish('big3')
+    clients.each_value { |socks|
+      socks.each { |sock|
+        frames = 3.times.map { read_op_frame(sock) }.sort_by { |f| f[1] }
+        assert_equal([[0x81, 'big3' + 'x' * 300_000], [0x82, 'bin1'], [0x81, 'txt2']], frames)
+      }
+    }
+    clients.each_value { |socks| socks.each { |sock| sock.close } }
+  end
+
+end